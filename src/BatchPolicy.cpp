@@ -0,0 +1,142 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+#include "BatchPolicy.h"
+
+BatchPolicy::BatchPolicy(const size_t max_batch_size,
+                         const double latency_target_ms)
+    : m_max_batch_size(std::max(size_t{1}, max_batch_size)),
+      m_latency_target(latency_target_ms),
+      m_latency(m_max_batch_size + 1, 0.0),
+      m_histogram(m_max_batch_size + 1, 0) {}
+
+void BatchPolicy::record_arrival(const double now_ms) {
+    if (m_last_arrival >= 0.0) {
+        const auto interval = std::max(0.0, now_ms - m_last_arrival);
+        if (m_interval > 0.0) {
+            m_interval += SMOOTHING * (interval - m_interval);
+        } else {
+            // Several positions can arrive at the same time, keep the
+            // rate finite.
+            m_interval = std::max(interval, 1e-3);
+        }
+        m_interval = std::max(m_interval, 1e-3);
+    }
+    m_last_arrival = now_ms;
+}
+
+void BatchPolicy::record_batch(const size_t batch_size,
+                               const double latency_ms) {
+    assert(batch_size >= 1 && batch_size <= m_max_batch_size);
+    auto& latency = m_latency[batch_size];
+    if (latency > 0.0) {
+        latency += SMOOTHING * (latency_ms - latency);
+    } else {
+        latency = std::max(latency_ms, 1e-6);
+    }
+    m_histogram[batch_size]++;
+}
+
+double BatchPolicy::get_arrival_rate() const {
+    return m_interval > 0.0 ? 1.0 / m_interval : 0.0;
+}
+
+double BatchPolicy::get_latency(const size_t batch_size) const {
+    assert(batch_size >= 1 && batch_size <= m_max_batch_size);
+    if (m_latency[batch_size] > 0.0) {
+        return m_latency[batch_size];
+    }
+    auto below = batch_size;
+    while (below > 1 && m_latency[below] == 0.0) {
+        below--;
+    }
+    auto above = batch_size;
+    while (above < m_max_batch_size && m_latency[above] == 0.0) {
+        above++;
+    }
+    const auto lo = m_latency[below];
+    const auto hi = m_latency[above];
+    if (lo > 0.0 && hi > 0.0) {
+        const auto t = double(batch_size - below) / double(above - below);
+        return lo + t * (hi - lo);
+    }
+    // On one side only: larger batches are assumed to cost no more than
+    // the largest one measured, so that they get tried, and smaller ones
+    // no more than the smallest one.
+    return std::max(lo, hi);
+}
+
+BatchPolicy::Decision BatchPolicy::decide(const size_t queued,
+                                          const double oldest_wait_ms,
+                                          const double busy_ms) const {
+    if (queued >= m_max_batch_size) {
+        return {m_max_batch_size, 0.0};
+    }
+    const auto rate = get_arrival_rate();
+    if (rate == 0.0 || get_latency(std::max(queued, size_t{1})) == 0.0) {
+        // Nothing known yet: wait a while for a full batch.
+        return {m_max_batch_size, MAX_WAIT_MS};
+    }
+
+    const auto now = std::max(queued, size_t{1});
+    auto best = Decision{now, 0.0};
+    auto best_throughput = now / (busy_ms + get_latency(now));
+    for (auto size = now + 1; size <= m_max_batch_size; size++) {
+        const auto wait = (size - queued) / rate;
+        if (wait > MAX_WAIT_MS) {
+            break;
+        }
+        const auto start = std::max(wait, busy_ms);
+        const auto latency = get_latency(size);
+        if (m_latency_target > 0.0) {
+            if (oldest_wait_ms + start + latency > m_latency_target) {
+                break;
+            }
+            best = Decision{size, wait};
+        } else {
+            const auto throughput = size / (start + latency);
+            if (throughput > best_throughput) {
+                best_throughput = throughput;
+                best = Decision{size, wait};
+            }
+        }
+    }
+    if (busy_ms > best.wait_ms) {
+        // The batch can't start before, keep filling it up.
+        return {m_max_batch_size, busy_ms};
+    }
+    return best;
+}
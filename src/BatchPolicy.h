@@ -0,0 +1,98 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef BATCHPOLICY_H_INCLUDED
+#define BATCHPOLICY_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Chooses how many queued positions a batch scheduler evaluates
+// together, and how long it waits for them.  It keeps track of the rate
+// at which positions are queued and of the time taken by the forward
+// pass at each batch size, and picks the batch that maximizes the
+// throughput or, with a latency target, the largest batch that still
+// returns the first queued position within the target.
+//
+// Times are in milliseconds, on any clock shared by the caller.  Not
+// thread safe: the scheduler calls it under its queue lock.
+class BatchPolicy {
+public:
+    // Longest wait for a batch to fill up.  Bounds the time lost when
+    // the search threads can't queue any more positions, because they
+    // are all waiting for the positions already queued.
+    static constexpr double MAX_WAIT_MS = 10.0;
+
+    struct Decision {
+        // Run as soon as this many positions are queued...
+        size_t batch_size;
+        // ...or after waiting this long, with whatever is queued then.
+        double wait_ms;
+    };
+
+    // latency_target_ms of 0 maximizes the throughput.
+    explicit BatchPolicy(size_t max_batch_size,
+                         double latency_target_ms = 0.0);
+
+    void record_arrival(double now_ms);
+    void record_batch(size_t batch_size, double latency_ms);
+    // busy_ms is how long before the batch could start anyway, because
+    // the previous one is still being evaluated: waiting that long for
+    // more positions costs nothing.
+    Decision decide(size_t queued, double oldest_wait_ms,
+                    double busy_ms = 0.0) const;
+
+    // Positions queued per millisecond, 0 if unknown.
+    double get_arrival_rate() const;
+    // Expected forward pass time for a batch, 0 if nothing was measured.
+    double get_latency(size_t batch_size) const;
+    // Number of batches run at each size, indexed by size.
+    const std::vector<std::uint64_t>& get_histogram() const {
+        return m_histogram;
+    }
+
+private:
+    // Weight of a new sample in the moving averages
+    static constexpr double SMOOTHING = 0.1;
+
+    size_t m_max_batch_size;
+    double m_latency_target;
+    double m_last_arrival{-1.0};
+    // average time between two arrivals, 0 if unknown
+    double m_interval{0.0};
+    // average forward pass time by batch size, 0 if never run
+    std::vector<double> m_latency;
+    std::vector<std::uint64_t> m_histogram;
+};
+
+#endif
@@ -0,0 +1,310 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <utility>
+
+#include "BatchScheduler.h"
+
+BatchScheduler::BatchScheduler(const size_t max_batch_size,
+                               const double latency_target_ms)
+    : m_max_batch_size(std::max(size_t{1}, max_batch_size)),
+      m_policy(m_max_batch_size, latency_target_ms) {}
+
+BatchScheduler::~BatchScheduler() {
+    stop_workers();
+}
+
+double BatchScheduler::now_ms() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+void BatchScheduler::BufferQueue::push(const size_t buffer) {
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_buffers.push_back(buffer);
+    }
+    m_cv.notify_one();
+}
+
+bool BatchScheduler::BufferQueue::pop(size_t& buffer) {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_cv.wait(lk, [this] () { return m_closed || !m_buffers.empty(); });
+    if (m_buffers.empty()) {
+        return false;
+    }
+    buffer = m_buffers.front();
+    m_buffers.pop_front();
+    return true;
+}
+
+void BatchScheduler::BufferQueue::close() {
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_closed = true;
+    }
+    m_cv.notify_all();
+}
+
+void BatchScheduler::start_workers(const size_t workers) {
+    for (auto i = size_t{0}; i < workers; i++) {
+        auto pipeline = std::make_unique<Pipeline>();
+        for (auto j = size_t{0}; j < PIPELINE_DEPTH; j++) {
+            pipeline->free.push(j);
+        }
+        m_pipelines.emplace_back(std::move(pipeline));
+    }
+    for (auto i = size_t{0}; i < workers; i++) {
+        m_worker_threads.emplace_back(&BatchScheduler::gather_worker, this, i);
+        m_worker_threads.emplace_back(&BatchScheduler::forward_worker, this, i);
+        m_worker_threads.emplace_back(&BatchScheduler::scatter_worker, this, i);
+    }
+}
+
+void BatchScheduler::stop_workers() {
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_running = false;
+    }
+    m_cv.notify_all();
+    // The gather threads exit first, and each stage closes the next one
+    // when it is done, so the batches in flight drain out.
+    for (auto & x : m_worker_threads) {
+        x.join();
+    }
+    m_worker_threads.clear();
+    m_pipelines.clear();
+}
+
+std::vector<std::uint64_t> BatchScheduler::get_batch_histogram() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    return m_policy.get_histogram();
+}
+
+void BatchScheduler::enqueue(
+    const std::vector<std::shared_ptr<ForwardQueueEntry>>& entries) {
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        const auto now = now_ms();
+        for (const auto& entry : entries) {
+            entry->queued_ms = now;
+            m_policy.record_arrival(now);
+            m_forward_queue.push_back(entry);
+        }
+    }
+    m_cv.notify_all();
+    for (auto& entry : entries) {
+        std::unique_lock<std::mutex> lk(entry->mutex);
+        entry->cv.wait(lk, [&entry] () { return entry->done; });
+    }
+}
+
+void BatchScheduler::forward(const std::vector<float>& input,
+                             std::vector<float>& output_pol,
+                             std::vector<float>& output_val,
+                             std::vector<float>& output_vbe) {
+    enqueue({std::make_shared<ForwardQueueEntry>(
+        input, output_pol, output_val, output_vbe)});
+}
+
+void BatchScheduler::forward_multiple(const std::vector<std::vector<float>>& inputs,
+                                      std::vector<std::vector<float>>& output_pol,
+                                      std::vector<std::vector<float>>& output_val,
+                                      std::vector<std::vector<float>>& output_vbe) {
+    auto entries = std::vector<std::shared_ptr<ForwardQueueEntry>>{};
+    entries.reserve(inputs.size());
+    for (auto i = size_t{0}; i < inputs.size(); i++) {
+        entries.emplace_back(std::make_shared<ForwardQueueEntry>(
+            inputs[i], output_pol[i], output_val[i], output_vbe[i]));
+    }
+    enqueue(entries);
+}
+
+BatchScheduler::EntryList BatchScheduler::pickup_task(const size_t worker) {
+    // Ask the policy how many positions to wait for, and for how long,
+    // then run whatever is queued when either is reached.  The wait is
+    // bounded, because the positions needed to fill the batch may never
+    // come: the search threads can be all waiting for those queued.
+    // While the forward thread is busy there is no hurry, so the policy
+    // is told how long it should still take.
+    const auto& pipeline = *m_pipelines[worker];
+    EntryList inputs;
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (true) {
+        if (!m_running) return inputs;
+
+        if (m_forward_queue.empty()) {
+            m_cv.wait(lk, [this] () {
+                return !m_running || !m_forward_queue.empty();
+            });
+            continue;
+        }
+
+        const auto now = now_ms();
+        auto busy = 0.0;
+        if (pipeline.forward_count > 0) {
+            busy = std::max(0.0, pipeline.forward_start_ms
+                                 + m_policy.get_latency(pipeline.forward_count)
+                                 - now);
+        }
+        const auto decision = m_policy.decide(
+            m_forward_queue.size(),
+            now - m_forward_queue.front()->queued_ms,
+            busy);
+        if (m_forward_queue.size() >= decision.batch_size) {
+            break;
+        }
+        const auto filled = m_cv.wait_for(
+            lk,
+            std::chrono::duration<double, std::milli>(decision.wait_ms),
+            [this, &decision, &pipeline, busy] () {
+                return !m_running
+                    || m_forward_queue.size() >= decision.batch_size
+                    || (busy > 0.0 && pipeline.forward_count == 0);
+            }
+        );
+        if (!filled && !m_forward_queue.empty()) {
+            break;
+        }
+    }
+    // Move up to a full batch from the shared queue to the local list.
+    const auto count = std::min(m_forward_queue.size(), m_max_batch_size);
+    auto end = begin(m_forward_queue);
+    std::advance(end, count);
+    inputs.splice(begin(inputs), m_forward_queue, begin(m_forward_queue), end);
+    return inputs;
+}
+
+void BatchScheduler::gather_worker(const size_t worker) {
+    auto& pipeline = *m_pipelines[worker];
+    auto buffer = size_t{0};
+    while (pipeline.free.pop(buffer)) {
+        auto inputs = pickup_task(worker);
+        if (inputs.empty()) {
+            break;
+        }
+
+        // prepare input for forward_batch() call
+        auto& batch = pipeline.batches[buffer];
+        const auto in_size = inputs.front()->in.size();
+        batch.input.resize(in_size * inputs.size());
+        auto index = size_t{0};
+        for (auto & x : inputs) {
+            std::copy(begin(x->in), end(x->in), begin(batch.input) + in_size * index);
+            index++;
+        }
+        batch.entries = std::move(inputs);
+        pipeline.gathered.push(buffer);
+    }
+    pipeline.gathered.close();
+}
+
+void BatchScheduler::forward_worker(const size_t worker) {
+    auto& pipeline = *m_pipelines[worker];
+    auto buffer = size_t{0};
+    while (pipeline.gathered.pop(buffer)) {
+        auto& batch = pipeline.batches[buffer];
+        const auto& front = batch.entries.front();
+        const auto count = batch.entries.size();
+        batch.output_pol.resize(front->out_p.size() * count);
+        batch.output_val.resize(front->out_va.size() * count);
+        batch.output_vbe.resize(front->out_vb.size() * count);
+
+        // run the NN evaluation
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            batch.start_ms = now_ms();
+            pipeline.forward_start_ms = batch.start_ms;
+            pipeline.forward_count = count;
+        }
+        forward_batch(worker * PIPELINE_DEPTH + buffer, batch.input,
+                      batch.output_pol, batch.output_val, batch.output_vbe,
+                      count);
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            pipeline.forward_count = 0;
+        }
+        // The gather thread may be waiting for the forward thread.
+        m_cv.notify_all();
+        pipeline.evaluated.push(buffer);
+    }
+    pipeline.evaluated.close();
+}
+
+void BatchScheduler::scatter_worker(const size_t worker) {
+    auto& pipeline = *m_pipelines[worker];
+    auto buffer = size_t{0};
+    while (pipeline.evaluated.pop(buffer)) {
+        auto& batch = pipeline.batches[buffer];
+        const auto count = batch.entries.size();
+        finish_batch(worker * PIPELINE_DEPTH + buffer,
+                     batch.output_pol, batch.output_val, batch.output_vbe,
+                     count);
+        const auto latency = now_ms() - batch.start_ms;
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_policy.record_batch(count, latency);
+        }
+
+        // Get output and copy back
+        const auto& front = batch.entries.front();
+        const auto out_pol_size = front->out_p.size();
+        const auto out_val_size = front->out_va.size();
+        const auto out_vbe_size = front->out_vb.size();
+        auto index = size_t{0};
+        for (auto & x : batch.entries) {
+            std::copy(begin(batch.output_pol) + out_pol_size * index,
+                      begin(batch.output_pol) + out_pol_size * (index + 1),
+                      begin(x->out_p));
+            std::copy(begin(batch.output_val) + out_val_size * index,
+                      begin(batch.output_val) + out_val_size * (index + 1),
+                      begin(x->out_va));
+            if (out_vbe_size > 0) {
+                std::copy(begin(batch.output_vbe) + out_vbe_size * index,
+                          begin(batch.output_vbe) + out_vbe_size * (index + 1),
+                          begin(x->out_vb));
+            }
+            {
+                std::lock_guard<std::mutex> lk(x->mutex);
+                x->done = true;
+            }
+            x->cv.notify_all();
+            index++;
+        }
+        batch.entries.clear();
+        pipeline.free.push(buffer);
+    }
+}
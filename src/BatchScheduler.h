@@ -0,0 +1,176 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef BATCHSCHEDULER_H_INCLUDED
+#define BATCHSCHEDULER_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "BatchPolicy.h"
+#include "ForwardPipe.h"
+
+// Queues the evaluations requested by the search threads and runs them
+// in batches, sized by a BatchPolicy.  Subclasses provide the batched
+// forward pass of their backend.
+//
+// Every worker is a pipeline of three threads sharing PIPELINE_DEPTH
+// batch buffers: one gathers the queued inputs into a buffer, one runs
+// forward_batch() on it, and one runs finish_batch() and scatters the
+// outputs back.  The next batch is gathered, and the previous one
+// scattered, while the current one is evaluated.
+class BatchScheduler : public ForwardPipe {
+public:
+    static constexpr size_t PIPELINE_DEPTH = 2;
+
+    virtual ~BatchScheduler();
+
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val,
+                         std::vector<float>& output_vbe);
+    virtual void forward_multiple(const std::vector<std::vector<float>>& inputs,
+                                  std::vector<std::vector<float>>& output_pol,
+                                  std::vector<std::vector<float>>& output_val,
+                                  std::vector<std::vector<float>>& output_vbe);
+    virtual std::vector<std::uint64_t> get_batch_histogram();
+
+protected:
+    BatchScheduler(size_t max_batch_size, double latency_target_ms);
+
+    // Starts the worker pipelines.  A subclass keeping state per batch
+    // buffer needs workers * PIPELINE_DEPTH of them: the buffer index
+    // is passed to forward_batch() and finish_batch().
+    void start_workers(size_t workers);
+    // Subclasses call this in their destructor, since the workers use
+    // their forward_batch().  The batches in flight are completed.
+    void stop_workers();
+
+    // Evaluates batch_size positions stored one after the other in
+    // input, the outputs are stored in the same way.
+    virtual void forward_batch(size_t buffer,
+                               const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               std::vector<float>& output_vbe,
+                               size_t batch_size) = 0;
+    // Runs on the scatter thread after forward_batch(), so that it
+    // overlaps the evaluation of the next batch.
+    virtual void finish_batch(size_t /*buffer*/,
+                              std::vector<float>& /*output_pol*/,
+                              std::vector<float>& /*output_val*/,
+                              std::vector<float>& /*output_vbe*/,
+                              size_t /*batch_size*/) {}
+
+private:
+    class ForwardQueueEntry {
+    public:
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done{false};
+        double queued_ms{0.0};
+        const std::vector<float>& in;
+        std::vector<float>& out_p;
+        std::vector<float>& out_va;
+        std::vector<float>& out_vb;
+        ForwardQueueEntry(const std::vector<float>& input,
+                          std::vector<float>& output_pol,
+                          std::vector<float>& output_val,
+                          std::vector<float>& output_vbe)
+        : in(input), out_p(output_pol), out_va(output_val), out_vb(output_vbe)
+          {}
+    };
+    using EntryList = std::list<std::shared_ptr<ForwardQueueEntry>>;
+
+    class Batch {
+    public:
+        EntryList entries;
+        std::vector<float> input;
+        std::vector<float> output_pol;
+        std::vector<float> output_val;
+        std::vector<float> output_vbe;
+        double start_ms{0.0};
+    };
+
+    // Hands batch buffer indices from one pipeline stage to the next.
+    class BufferQueue {
+    public:
+        void push(size_t buffer);
+        // Returns false once closed and empty.
+        bool pop(size_t& buffer);
+        void close();
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<size_t> m_buffers;
+        bool m_closed{false};
+    };
+
+    class Pipeline {
+    public:
+        std::array<Batch, PIPELINE_DEPTH> batches;
+        BufferQueue free;
+        BufferQueue gathered;
+        BufferQueue evaluated;
+        // Batch being evaluated, 0 if none : scheduler lock protected
+        size_t forward_count{0};
+        double forward_start_ms{0.0};
+    };
+
+    static double now_ms();
+    void enqueue(const std::vector<std::shared_ptr<ForwardQueueEntry>>& entries);
+    EntryList pickup_task(size_t worker);
+    void gather_worker(size_t worker);
+    void forward_worker(size_t worker);
+    void scatter_worker(size_t worker);
+
+    bool m_running{true};
+    size_t m_max_batch_size;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    // lock protected
+    BatchPolicy m_policy;
+    EntryList m_forward_queue;
+
+    std::vector<std::unique_ptr<Pipeline>> m_pipelines;
+    std::vector<std::thread> m_worker_threads;
+};
+
+#endif
@@ -0,0 +1,66 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <cassert>
+
+#include "BitBoard.h"
+
+static std::array<BitBoard::Geometry, BOARD_SIZE + 1> make_geometries() {
+    auto geometries = std::array<BitBoard::Geometry, BOARD_SIZE + 1>{};
+    for (auto size = 1; size <= BOARD_SIZE; size++) {
+        auto& g = geometries[size];
+        g.size = size;
+        g.on_board.fill(0);
+        g.not_first_column.fill(0);
+        g.not_last_column.fill(0);
+        for (auto y = 0; y < size; y++) {
+            for (auto x = 0; x < size; x++) {
+                const auto idx = y * size + x;
+                const auto bit = std::uint64_t{1} << (idx % 64);
+                g.on_board[idx / 64] |= bit;
+                if (x != 0) {
+                    g.not_first_column[idx / 64] |= bit;
+                }
+                if (x != size - 1) {
+                    g.not_last_column[idx / 64] |= bit;
+                }
+            }
+        }
+    }
+    return geometries;
+}
+
+const BitBoard::Geometry& BitBoard::geometry(const int size) {
+    static const auto s_geometries = make_geometries();
+    assert(size >= 1 && size <= BOARD_SIZE);
+    return s_geometries[size];
+}
@@ -0,0 +1,198 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef BITBOARD_H_INCLUDED
+#define BITBOARD_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <cstdint>
+
+#include "Utils.h"
+
+// A set of intersections, one bit each, indexed by y * size + x where
+// size is the board size in use.  Region operations (flood fill,
+// neighbours) are done a whole board at a time with shifts and masks.
+class BitBoard {
+public:
+    static constexpr int WORDS = (NUM_INTERSECTIONS + 63) / 64;
+    using words_t = std::array<std::uint64_t, WORDS>;
+
+    // Masks of a board size, for the shifts not to wrap around.
+    struct Geometry {
+        int size;
+        words_t on_board;
+        words_t not_first_column;
+        words_t not_last_column;
+    };
+    static const Geometry& geometry(int size);
+
+    BitBoard() { m_bits.fill(0); }
+
+    void set(const int idx) {
+        m_bits[idx / 64] |= std::uint64_t{1} << (idx % 64);
+    }
+    void reset(const int idx) {
+        m_bits[idx / 64] &= ~(std::uint64_t{1} << (idx % 64));
+    }
+    void flip(const int idx) {
+        m_bits[idx / 64] ^= std::uint64_t{1} << (idx % 64);
+    }
+    bool test(const int idx) const {
+        return (m_bits[idx / 64] >> (idx % 64)) & 1;
+    }
+    void clear() { m_bits.fill(0); }
+
+    int count() const {
+        auto total = 0;
+        for (const auto w : m_bits) {
+            total += Utils::popcount(w);
+        }
+        return total;
+    }
+    bool empty() const {
+        auto any = std::uint64_t{0};
+        for (const auto w : m_bits) {
+            any |= w;
+        }
+        return any == 0;
+    }
+    std::uint64_t word(const int i) const { return m_bits[i]; }
+
+    BitBoard operator|(const BitBoard& other) const {
+        auto res = BitBoard(NoInit{});
+        for (auto i = 0; i < WORDS; i++) {
+            res.m_bits[i] = m_bits[i] | other.m_bits[i];
+        }
+        return res;
+    }
+    BitBoard operator&(const BitBoard& other) const {
+        auto res = BitBoard(NoInit{});
+        for (auto i = 0; i < WORDS; i++) {
+            res.m_bits[i] = m_bits[i] & other.m_bits[i];
+        }
+        return res;
+    }
+    // Intersections of this set not in other
+    BitBoard operator-(const BitBoard& other) const {
+        auto res = BitBoard(NoInit{});
+        for (auto i = 0; i < WORDS; i++) {
+            res.m_bits[i] = m_bits[i] & ~other.m_bits[i];
+        }
+        return res;
+    }
+    bool operator==(const BitBoard& other) const {
+        return m_bits == other.m_bits;
+    }
+    bool operator!=(const BitBoard& other) const {
+        return m_bits != other.m_bits;
+    }
+
+    // The intersections of the board, of geometry g, not in this set.
+    BitBoard complement(const Geometry& g) const {
+        auto res = BitBoard(NoInit{});
+        for (auto i = 0; i < WORDS; i++) {
+            res.m_bits[i] = g.on_board[i] & ~m_bits[i];
+        }
+        return res;
+    }
+
+    // The 4-way neighbours of the intersections of this set.
+    BitBoard adjacent(const Geometry& g) const {
+        const auto up = shift_up(1);
+        const auto down = shift_down(1);
+        const auto up_row = shift_up(g.size);
+        const auto down_row = shift_down(g.size);
+        auto res = BitBoard(NoInit{});
+        for (auto i = 0; i < WORDS; i++) {
+            res.m_bits[i] = ((up.m_bits[i] & g.not_first_column[i])
+                             | (down.m_bits[i] & g.not_last_column[i])
+                             | up_row.m_bits[i]
+                             | down_row.m_bits[i]) & g.on_board[i];
+        }
+        return res;
+    }
+
+    // This set and its 4-way neighbours.
+    BitBoard dilate(const Geometry& g) const {
+        return *this | adjacent(g);
+    }
+
+    // This set and the intersections of spread connected to it through
+    // spread.
+    BitBoard flood(const BitBoard& spread, const Geometry& g) const {
+        auto reach = *this;
+        while (true) {
+            const auto next = reach | (reach.dilate(g) & spread);
+            if (next == reach) {
+                return reach;
+            }
+            reach = next;
+        }
+    }
+
+    // Calls f(idx) for every intersection of the set, in index order.
+    template<class Function>
+    void for_each(Function f) const {
+        for (auto i = 0; i < WORDS; i++) {
+            for (auto w = m_bits[i]; w != 0; w &= w - 1) {
+                f(i * 64 + Utils::lowest_bit(w));
+            }
+        }
+    }
+
+private:
+    struct NoInit {};
+    explicit BitBoard(NoInit) {}
+
+    // Moves every bit n places towards the higher (lower) indices,
+    // 0 < n < 64.
+    BitBoard shift_up(const int n) const {
+        auto res = BitBoard(NoInit{});
+        res.m_bits[0] = m_bits[0] << n;
+        for (auto i = 1; i < WORDS; i++) {
+            res.m_bits[i] = (m_bits[i] << n) | (m_bits[i - 1] >> (64 - n));
+        }
+        return res;
+    }
+    BitBoard shift_down(const int n) const {
+        auto res = BitBoard(NoInit{});
+        for (auto i = 0; i < WORDS - 1; i++) {
+            res.m_bits[i] = (m_bits[i] >> n) | (m_bits[i + 1] << (64 - n));
+        }
+        res.m_bits[WORDS - 1] = m_bits[WORDS - 1] >> n;
+        return res;
+    }
+
+    words_t m_bits;
+};
+
+#endif
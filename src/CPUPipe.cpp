@@ -43,9 +43,21 @@
 #include <Eigen/Dense>
 #endif
 
+#include <algorithm>
+#include <array>
+
 #include "CPUPipe.h"
 #include "Network.h"
-#include "Im2Col.h"
+#include "Utils.h"
+
+// The SIMD kernels are compiled for their instruction set with function
+// attributes and only called when CPUID reports it, so the rest of the
+// program doesn't need to be built with -mavx2.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_WINOGRAD_AVX2
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
 
 #ifndef USE_BLAS
 // Eigen helpers
@@ -57,19 +69,172 @@ using ConstEigenMatrixMap =
     Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
 #endif
 
+CPUPipe::simd_t CPUPipe::detect_simd()
+{
+#ifdef USE_WINOGRAD_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return simd_t::AVX2;
+    }
+#endif
+    return simd_t::SCALAR;
+}
+
 void CPUPipe::initialize(int channels)
 {
     m_input_channels = channels;
+    m_simd = detect_simd();
+    if (m_simd == simd_t::AVX2) {
+        Utils::myprintf("CPU: using AVX2 Winograd transforms.\n");
+    }
 }
 
-void CPUPipe::winograd_transform_in(const std::vector<float> &in,
-                                    std::vector<float> &V,
-                                    const int C)
+// multiple vector [i0..i5] by Bt and produce [o0..o5]
+// const auto Bt = std::array<float, WINOGRAD_TILE>
+//           {1.0f,  0.0f,     -5.0f/2.0f,  0.0f,      1.0f, 0.0f,
+//            0.0f, -SQ2,      -2.0f,       SQ2/2.0f,  1.0f, 0.0f,
+//            0.0f,  SQ2,      -2.0f,      -SQ2/2.0f,  1.0f, 0.0f,
+//            0.0f, -SQ2/2.0f, -1.0f/2.0f,  SQ2,       1.0f, 0.0f,
+//            0.0f,  SQ2/2.0f, -1.0f/2.0f, -SQ2,       1.0f, 0.0f,
+//            0.0f,  1.0f,      0.0f,      -5.0f/2.0f, 0.0f, 1.0f};
+static inline void multiply_bt(
+    float & o0, float & o1, float & o2, float & o3, float & o4, float & o5,
+    float i0, float i1, float i2, float i3, float i4, float i5)
+{
+    auto i3m1 = i1 * -SQ2 + i3 * (SQ2 / 2.0f);
+    auto i4m2 = i2 * -2.0f + i4 * 1.0f;
+
+    o0 = i0 + i2 * (-5.0f/2.0f) + i4;
+    o1 = i3m1 + i4m2;
+    o2 = -i3m1 + i4m2;
+
+    auto i3m1_2 = i3 * (SQ2) + i1 * (-SQ2/2.0f);
+    auto i4m2_2 = i2 * (-1.0f/2.0f) + i4;
+
+    o3 = i3m1_2 + i4m2_2;
+    o4 = -i3m1_2 + i4m2_2;
+
+    o5 = i1 + i3 * (-5.0f/2.0f) + i5;
+}
+
+// multiple vector [i0..i5] by At and produce [o0..o3]
+// const auto At = std::array<float, WINOGRAD_ALPHA * WINOGRAD_M>
+//       {1.0f, 1.0f,      1.0f,       1.0f,      1.0f,     0.0f,
+//        0.0f, SQ2/2.0f, -SQ2/2.0f,   SQ2,      -SQ2,      0.0f,
+//        0.0f, 1.0f/2.0f, 1.0f/2.0f,  2.0f,      2.0f,     0.0f,
+//        0.0f, SQ2/4.0f, -SQ2/4.0f,   2.0f*SQ2, -2.0f*SQ2, 1.0f};
+static inline void multiply_at(
+    float & o0, float & o1, float & o2, float & o3,
+    float i0, float i1, float i2, float i3, float i4, float i5)
+{
+    auto t1p2 = (i1 + i2) * (1.0f / 2.0f);
+    auto t1m2 = (i1 - i2) * (SQ2/4.0f);
+    auto t3p4 = i3 + i4;
+    auto t3m4 = (i3 - i4) * (SQ2);
+
+    o0 = i0 + t1p2 + t1p2 + t3p4;
+    o1 = t1m2 + t1m2 + t3m4;
+    o2 = t1p2 + t3p4 + t3p4;
+    o3 = t1m2 + t3m4 + t3m4 + i5;
+}
+
+// Input transform of the single tile whose top-left corner is at in_pad,
+// the 36 outputs are written v_stride apart.
+static void winograd_tile_in(const float* in_pad, const int in_stride,
+                             float* V, const size_t v_stride)
+{
+    std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA> T1;
+
+    // Calculates transpose(B).x.B
+    for (auto c = 0; c < WINOGRAD_ALPHA; c++) {
+        multiply_bt(
+            T1[0][c], T1[1][c], T1[2][c], T1[3][c], T1[4][c], T1[5][c],
+            in_pad[0 * in_stride + c], in_pad[1 * in_stride + c],
+            in_pad[2 * in_stride + c], in_pad[3 * in_stride + c],
+            in_pad[4 * in_stride + c], in_pad[5 * in_stride + c]);
+    }
+    for (auto r = 0; r < WINOGRAD_ALPHA; r++) {
+        const auto out = V + r * WINOGRAD_ALPHA * v_stride;
+        multiply_bt(
+            out[0 * v_stride], out[1 * v_stride], out[2 * v_stride],
+            out[3 * v_stride], out[4 * v_stride], out[5 * v_stride],
+            T1[r][0], T1[r][1], T1[r][2], T1[r][3], T1[r][4], T1[r][5]);
+    }
+}
+
+// Output transform of a single tile, with optional batchnorm, residual
+// add and ReLU. M points to the first of the 36 inputs, which are
+// m_stride apart, and Y to the top-left corner of the tile in the output.
+static void winograd_tile_out(const float* M, const size_t m_stride,
+                              float* Y, const int y, const int x,
+                              const float* means, const float* stddevs,
+                              const float* eltwise)
+{
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+
+    using WinogradTile =
+        std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
+    WinogradTile temp_m;
+    for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++)
+    {
+        for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++)
+        {
+            temp_m[xi][nu] = M[(xi * WINOGRAD_ALPHA + nu) * m_stride];
+        }
+    }
+    std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_M> temp;
+    std::array<std::array<float, WINOGRAD_M>, WINOGRAD_M> o;
+
+    // Calculates transpose(A).temp_m.A
+    for (auto j = 0; j < WINOGRAD_ALPHA; j++){
+        multiply_at(
+            temp[0][j], temp[1][j], temp[2][j], temp[3][j],
+            temp_m[0][j], temp_m[1][j], temp_m[2][j], temp_m[3][j], temp_m[4][j], temp_m[5][j]
+        );
+    }
+
+    for (auto i = 0; i < WINOGRAD_M; i++){
+        multiply_at(
+            o[i][0], o[i][1], o[i][2], o[i][3],
+            temp[i][0], temp[i][1], temp[i][2], temp[i][3], temp[i][4], temp[i][5]
+        );
+    }
+
+    for (auto i = 0; i < WINOGRAD_M; i++)
+    {
+        for (auto j = 0; j < WINOGRAD_M; j++)
+        {
+            if (y + i < H && x + j < W)
+            {
+                auto val = o[i][j];
+                if (means != nullptr)
+                {
+                    val = stddevs[0] * (val - means[0]);
+                    if (eltwise != nullptr)
+                    {
+                        val += eltwise[i * W + j];
+                    }
+                    val = (val > 0.0f) ? val : 0.0f;
+                }
+                Y[i * W + j] = val;
+            }
+        }
+    }
+}
+
+static void winograd_transform_in_scalar(const std::vector<float> &in,
+                                         std::vector<float> &V,
+                                         const int C,
+                                         const size_t batch_size)
 {
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
     constexpr auto WTILES = WINOGRAD_WTILES;
     constexpr auto P = WINOGRAD_P;
+    // Tiles of all the positions in the batch are laid out next to each
+    // other, so that a single SGEMM per tile element covers the batch.
+    const auto BP = batch_size * P;
 
     constexpr auto Wpad = 2 + WINOGRAD_M * WTILES;
 
@@ -81,39 +246,12 @@ void CPUPipe::winograd_transform_in(const std::vector<float> &in,
     auto buffer_offset = 0;
     auto buffer_entries = 0;
 
-
-    // multiple vector [i0..i5] by Bt and produce [o0..o5]
-    // const auto Bt = std::array<float, WINOGRAD_TILE>
-    //           {1.0f,  0.0f,     -5.0f/2.0f,  0.0f,      1.0f, 0.0f,
-    //            0.0f, -SQ2,      -2.0f,       SQ2/2.0f,  1.0f, 0.0f,
-    //            0.0f,  SQ2,      -2.0f,      -SQ2/2.0f,  1.0f, 0.0f,
-    //            0.0f, -SQ2/2.0f, -1.0f/2.0f,  SQ2,       1.0f, 0.0f,
-    //            0.0f,  SQ2/2.0f, -1.0f/2.0f, -SQ2,       1.0f, 0.0f,
-    //            0.0f,  1.0f,      0.0f,      -5.0f/2.0f, 0.0f, 1.0f};
-    auto multiply_bt = [](
-        float & o0, float & o1, float & o2, float & o3, float & o4, float & o5,
-        float i0, float i1, float i2, float i3, float i4, float i5
-    ) {
-        auto i3m1 = i1 * -SQ2 + i3 * (SQ2 / 2.0f);
-        auto i4m2 = i2 * -2.0f + i4 * 1.0f;
-
-        o0 = i0 + i2 * (-5.0f/2.0f) + i4;
-        o1 = i3m1 + i4m2;
-        o2 = -i3m1 + i4m2;
-
-        auto i3m1_2 = i3 * (SQ2) + i1 * (-SQ2/2.0f);
-        auto i4m2_2 = i2 * (-1.0f/2.0f) + i4;
-
-        o3 = i3m1_2 + i4m2_2;
-        o4 = -i3m1_2 + i4m2_2;
-
-        o5 = i1 + i3 * (-5.0f/2.0f) + i5;
-    };
-
     for (auto ch = 0; ch < C; ch++) {
+      for (auto batch = size_t{0}; batch < batch_size; batch++) {
+        const auto in_offset = (batch * C + ch) * (W*H);
         for (auto yin = 0; yin < H; yin++) {
             for (auto xin = 0; xin < W; xin++) {
-                in_pad[yin + 1][xin + 1] = in[ch*(W*H) + yin*W + xin];
+                in_pad[yin + 1][xin + 1] = in[in_offset + yin*W + xin];
             }
         }
         for (auto block_y = 0; block_y < WTILES; block_y++)
@@ -123,132 +261,51 @@ void CPUPipe::winograd_transform_in(const std::vector<float> &in,
             for (auto block_x = 0; block_x < WTILES; block_x++)
             {
                 const auto xin = WINOGRAD_M * block_x;
-#define DECL_T1(XX) \
-                float T1_##XX##_0, T1_##XX##_1, T1_##XX##_2, T1_##XX##_3, T1_##XX##_4, T1_##XX##_5;
-                DECL_T1(0)
-                DECL_T1(1)
-                DECL_T1(2)
-                DECL_T1(3)
-                DECL_T1(4)
-                DECL_T1(5)
-
-                // Calculates transpose(B).x.B
-#define MULTIPLY_BT(XX) \
-                multiply_bt( \
-                    T1_0_##XX, T1_1_##XX, T1_2_##XX, T1_3_##XX, T1_4_##XX, T1_5_##XX, \
-                    in_pad[yin + 0][xin + XX], \
-                    in_pad[yin + 1][xin + XX], \
-                    in_pad[yin + 2][xin + XX], \
-                    in_pad[yin + 3][xin + XX], \
-                    in_pad[yin + 4][xin + XX], \
-                    in_pad[yin + 5][xin + XX] \
-                );
-                MULTIPLY_BT(0)
-                MULTIPLY_BT(1)
-                MULTIPLY_BT(2)
-                MULTIPLY_BT(3)
-                MULTIPLY_BT(4)
-                MULTIPLY_BT(5)
-
-#define MULTIPLY_B(XX) \
-                multiply_bt( \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 0) + buffer_entries], \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 1) + buffer_entries], \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 2) + buffer_entries], \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 3) + buffer_entries], \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 4) + buffer_entries], \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 5) + buffer_entries], \
-                    T1_##XX##_0, T1_##XX##_1, T1_##XX##_2, T1_##XX##_3, T1_##XX##_4, T1_##XX##_5 \
-                );
-                MULTIPLY_B(0)
-                MULTIPLY_B(1)
-                MULTIPLY_B(2)
-                MULTIPLY_B(3)
-                MULTIPLY_B(4)
-                MULTIPLY_B(5)
 
                 if (buffer_entries == 0) {
-                    buffer_offset = ch * P + block_y * WTILES + block_x;
+                    buffer_offset = ch * BP + batch * P + block_y * WTILES + block_x;
                 }
+                winograd_tile_in(&in_pad[yin][xin], Wpad,
+                                 &buffer[buffer_entries], buffersize);
                 buffer_entries++;
 
                 if (buffer_entries >= buffersize ||
-                    (ch == C - 1 && block_x == WTILES - 1 && block_y == WTILES - 1))
+                    (ch == C - 1 && batch == batch_size - 1
+                     && block_x == WTILES - 1 && block_y == WTILES - 1))
                 {
 
                     for (auto i = 0; i < WINOGRAD_ALPHA * WINOGRAD_ALPHA; i++)
                     {
                         for (auto entry = 0; entry < buffer_entries; entry++)
                         {
-                            V[i * C * P + buffer_offset + entry] = buffer[i * buffersize + entry];
+                            V[i * C * BP + buffer_offset + entry] = buffer[i * buffersize + entry];
                         }
                     }
                     buffer_entries = 0;
                 }
             }
         }
+      }
     }
 }
 
-void CPUPipe::winograd_sgemm(const std::vector<float> &U,
-                             const std::vector<float> &V,
-                             std::vector<float> &M,
-                             const int C, const int K)
-{
-    constexpr auto P = WINOGRAD_P;
-
-    for (auto b = 0; b < WINOGRAD_TILE; b++)
-    {
-        const auto offset_u = b * K * C;
-        const auto offset_v = b * C * P;
-        const auto offset_m = b * K * P;
-#ifdef USE_BLAS
-        cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
-                    K, P, C,
-                    1.0f,
-                    &U[offset_u], K,
-                    &V[offset_v], P,
-                    0.0f,
-                    &M[offset_m], P);
-#else
-        auto C_mat = EigenMatrixMap<float>(M.data() + offset_m, P, K);
-        C_mat.noalias() =
-            ConstEigenMatrixMap<float>(V.data() + offset_v, P, C) * ConstEigenMatrixMap<float>(U.data() + offset_u, K, C).transpose();
-#endif
-    }
-}
-
-void CPUPipe::winograd_transform_out(const std::vector<float> &M,
-                                     std::vector<float> &Y,
-                                     const int K)
+static void winograd_transform_out_scalar(const std::vector<float> &M,
+                                          std::vector<float> &Y,
+                                          const int K,
+                                          const size_t batch_size,
+                                          const float* means,
+                                          const float* stddevs,
+                                          const float* eltwise)
 {
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
     constexpr auto WTILES = WINOGRAD_WTILES;
     constexpr auto P = WINOGRAD_P;
+    const auto BP = batch_size * P;
 
-    // multiple vector [i0..i5] by At and produce [o0..o3]
-    // const auto At = std::array<float, WINOGRAD_ALPHA * WINOGRAD_M>
-    //       {1.0f, 1.0f,      1.0f,       1.0f,      1.0f,     0.0f,
-    //        0.0f, SQ2/2.0f, -SQ2/2.0f,   SQ2,      -SQ2,      0.0f,
-    //        0.0f, 1.0f/2.0f, 1.0f/2.0f,  2.0f,      2.0f,     0.0f,
-    //        0.0f, SQ2/4.0f, -SQ2/4.0f,   2.0f*SQ2, -2.0f*SQ2, 1.0f};
-    auto multiply_at = [](
-        float & o0, float & o1, float & o2, float & o3,
-        float i0, float i1, float i2, float i3, float i4, float i5
-    ) {
-        auto t1p2 = (i1 + i2) * (1.0f / 2.0f);
-        auto t1m2 = (i1 - i2) * (SQ2/4.0f);
-        auto t3p4 = i3 + i4;
-        auto t3m4 = (i3 - i4) * (SQ2);
-
-        o0 = i0 + t1p2 + t1p2 + t3p4;
-        o1 = t1m2 + t1m2 + t3m4;
-        o2 = t1p2 + t3p4 + t3p4;
-        o3 = t1m2 + t3m4 + t3m4 + i5;
-    };
-
-    for (auto k = 0; k < K; k++) {
+    for (auto batch = size_t{0}; batch < batch_size; batch++) {
+      for (auto k = 0; k < K; k++) {
+        const auto y_offset = (batch * K + k) * H * W;
         for (auto block_x = 0; block_x < WTILES; block_x++) {
             const auto x = WINOGRAD_M * block_x;
             for (auto block_y = 0; block_y < WTILES; block_y++)
@@ -256,65 +313,331 @@ void CPUPipe::winograd_transform_out(const std::vector<float> &M,
                 const auto y = WINOGRAD_M * block_y;
 
                 const auto b = block_y * WTILES + block_x;
-                using WinogradTile =
-                    std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
-                WinogradTile temp_m;
-                for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++)
-                {
-                    for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++)
-                    {
-                        temp_m[xi][nu] =
-                            M[(xi * WINOGRAD_ALPHA + nu) * K * P + k * P + b];
+                const auto y_ind = y_offset + y * W + x;
+                winograd_tile_out(&M[k * BP + batch * P + b], K * BP,
+                                  &Y[y_ind], y, x,
+                                  means ? means + k : nullptr,
+                                  stddevs ? stddevs + k : nullptr,
+                                  eltwise ? eltwise + y_ind : nullptr);
+            }
+        }
+      }
+    }
+}
+
+#ifdef USE_WINOGRAD_AVX2
+// AVX2 versions of the transforms. They work on 8 tiles of the same
+// channel at once, one per lane, so that all the arithmetic is the same
+// as in the scalar version. The tiles that don't fill a whole vector are
+// handled by the scalar single tile functions.
+static constexpr auto AVX2_LANES = 8;
+static constexpr auto AVX2_TILES = WINOGRAD_P / AVX2_LANES * AVX2_LANES;
+
+AVX2_TARGET
+static inline void multiply_bt_avx2(
+    __m256 & o0, __m256 & o1, __m256 & o2, __m256 & o3, __m256 & o4, __m256 & o5,
+    __m256 i0, __m256 i1, __m256 i2, __m256 i3, __m256 i4, __m256 i5)
+{
+    const auto i3m1 = _mm256_fmadd_ps(i1, _mm256_set1_ps(-SQ2),
+                                      _mm256_mul_ps(i3, _mm256_set1_ps(SQ2 / 2.0f)));
+    const auto i4m2 = _mm256_fmadd_ps(i2, _mm256_set1_ps(-2.0f), i4);
+
+    o0 = _mm256_add_ps(_mm256_fmadd_ps(i2, _mm256_set1_ps(-5.0f/2.0f), i0), i4);
+    o1 = _mm256_add_ps(i3m1, i4m2);
+    o2 = _mm256_sub_ps(i4m2, i3m1);
+
+    const auto i3m1_2 = _mm256_fmadd_ps(i3, _mm256_set1_ps(SQ2),
+                                        _mm256_mul_ps(i1, _mm256_set1_ps(-SQ2/2.0f)));
+    const auto i4m2_2 = _mm256_fmadd_ps(i2, _mm256_set1_ps(-1.0f/2.0f), i4);
+
+    o3 = _mm256_add_ps(i3m1_2, i4m2_2);
+    o4 = _mm256_sub_ps(i4m2_2, i3m1_2);
+
+    o5 = _mm256_add_ps(_mm256_fmadd_ps(i3, _mm256_set1_ps(-5.0f/2.0f), i1), i5);
+}
+
+AVX2_TARGET
+static inline void multiply_at_avx2(
+    __m256 & o0, __m256 & o1, __m256 & o2, __m256 & o3,
+    __m256 i0, __m256 i1, __m256 i2, __m256 i3, __m256 i4, __m256 i5)
+{
+    const auto t1p2 = _mm256_mul_ps(_mm256_add_ps(i1, i2), _mm256_set1_ps(1.0f / 2.0f));
+    const auto t1m2 = _mm256_mul_ps(_mm256_sub_ps(i1, i2), _mm256_set1_ps(SQ2/4.0f));
+    const auto t3p4 = _mm256_add_ps(i3, i4);
+    const auto t3m4 = _mm256_mul_ps(_mm256_sub_ps(i3, i4), _mm256_set1_ps(SQ2));
+
+    o0 = _mm256_add_ps(_mm256_add_ps(i0, t1p2), _mm256_add_ps(t1p2, t3p4));
+    o1 = _mm256_add_ps(_mm256_add_ps(t1m2, t1m2), t3m4);
+    o2 = _mm256_add_ps(_mm256_add_ps(t1p2, t3p4), t3p4);
+    o3 = _mm256_add_ps(_mm256_add_ps(t1m2, t3m4), _mm256_add_ps(t3m4, i5));
+}
+
+AVX2_TARGET
+static void winograd_transform_in_avx2(const std::vector<float> &in,
+                                       std::vector<float> &V,
+                                       const int C,
+                                       const size_t batch_size)
+{
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = WINOGRAD_WTILES;
+    constexpr auto P = WINOGRAD_P;
+    const auto BP = batch_size * P;
+
+    constexpr auto Wpad = 2 + WINOGRAD_M * WTILES;
+
+    std::array<float, Wpad * Wpad> in_pad{0.0f};
+
+    // Offset of the top-left corner of each tile inside in_pad
+    std::array<int, P> tile_offset;
+    for (auto b = 0; b < P; b++) {
+        tile_offset[b] = WINOGRAD_M * (b / WTILES) * Wpad
+                       + WINOGRAD_M * (b % WTILES);
+    }
+
+    for (auto ch = 0; ch < C; ch++) {
+        for (auto batch = size_t{0}; batch < batch_size; batch++) {
+            const auto in_offset = (batch * C + ch) * (W*H);
+            for (auto yin = 0; yin < H; yin++) {
+                std::copy(&in[in_offset + yin * W],
+                          &in[in_offset + yin * W] + W,
+                          &in_pad[(yin + 1) * Wpad + 1]);
+            }
+            const auto v_offset = ch * BP + batch * P;
+
+            for (auto b = 0; b < AVX2_TILES; b += AVX2_LANES) {
+                const auto idx = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(&tile_offset[b]));
+
+                std::array<std::array<__m256, WINOGRAD_ALPHA>, WINOGRAD_ALPHA> T1;
+                for (auto c = 0; c < WINOGRAD_ALPHA; c++) {
+                    std::array<__m256, WINOGRAD_ALPHA> d;
+                    for (auto r = 0; r < WINOGRAD_ALPHA; r++) {
+                        d[r] = _mm256_i32gather_ps(&in_pad[r * Wpad + c], idx, 4);
                     }
+                    multiply_bt_avx2(T1[0][c], T1[1][c], T1[2][c],
+                                     T1[3][c], T1[4][c], T1[5][c],
+                                     d[0], d[1], d[2], d[3], d[4], d[5]);
                 }
-                std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_M> temp;
-                std::array<std::array<float, WINOGRAD_M>, WINOGRAD_M> o;
-
-                // Calculates transpose(A).temp_m.A
-                for (auto j = 0; j < WINOGRAD_ALPHA; j++){
-                    multiply_at(
-                        temp[0][j], temp[1][j], temp[2][j], temp[3][j],
-                        temp_m[0][j], temp_m[1][j], temp_m[2][j], temp_m[3][j], temp_m[4][j], temp_m[5][j]
-                    );
+                for (auto r = 0; r < WINOGRAD_ALPHA; r++) {
+                    std::array<__m256, WINOGRAD_ALPHA> o;
+                    multiply_bt_avx2(o[0], o[1], o[2], o[3], o[4], o[5],
+                                     T1[r][0], T1[r][1], T1[r][2],
+                                     T1[r][3], T1[r][4], T1[r][5]);
+                    for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
+                        const auto i = r * WINOGRAD_ALPHA + nu;
+                        _mm256_storeu_ps(&V[i * C * BP + v_offset + b], o[nu]);
+                    }
                 }
+            }
+            for (auto b = AVX2_TILES; b < P; b++) {
+                winograd_tile_in(&in_pad[tile_offset[b]], Wpad,
+                                 &V[v_offset + b], C * BP);
+            }
+        }
+    }
+}
+
+AVX2_TARGET
+static void winograd_transform_out_avx2(const std::vector<float> &M,
+                                        std::vector<float> &Y,
+                                        const int K,
+                                        const size_t batch_size,
+                                        const float* means,
+                                        const float* stddevs,
+                                        const float* eltwise)
+{
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = WINOGRAD_WTILES;
+    constexpr auto P = WINOGRAD_P;
+    const auto BP = batch_size * P;
+
+    // Offset of the top-left corner of each tile in the output, and how
+    // many of its rows and columns are still on the board
+    std::array<int, P> tile_offset;
+    std::array<int, P> tile_rows;
+    std::array<int, P> tile_cols;
+    for (auto b = 0; b < P; b++) {
+        const auto y = WINOGRAD_M * (b / WTILES);
+        const auto x = WINOGRAD_M * (b % WTILES);
+        tile_offset[b] = y * W + x;
+        tile_rows[b] = std::min(WINOGRAD_M, H - y);
+        tile_cols[b] = std::min(WINOGRAD_M, W - x);
+    }
 
-                for (auto i = 0; i < WINOGRAD_M; i++){
-                    multiply_at(
-                        o[i][0], o[i][1], o[i][2], o[i][3],
-                        temp[i][0], temp[i][1], temp[i][2], temp[i][3], temp[i][4], temp[i][5]
-                    );
+    for (auto batch = size_t{0}; batch < batch_size; batch++) {
+        for (auto k = 0; k < K; k++) {
+            const auto y_offset = (batch * K + k) * H * W;
+            const auto m_offset = k * BP + batch * P;
+            const auto mean = _mm256_set1_ps(means ? means[k] : 0.0f);
+            const auto scale = _mm256_set1_ps(stddevs ? stddevs[k] : 1.0f);
+
+            for (auto b = 0; b < AVX2_TILES; b += AVX2_LANES) {
+                std::array<std::array<__m256, WINOGRAD_ALPHA>, WINOGRAD_M> temp;
+                for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                    std::array<__m256, WINOGRAD_ALPHA> m;
+                    for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
+                        const auto i = xi * WINOGRAD_ALPHA + j;
+                        m[xi] = _mm256_loadu_ps(&M[i * K * BP + m_offset + b]);
+                    }
+                    multiply_at_avx2(temp[0][j], temp[1][j], temp[2][j], temp[3][j],
+                                     m[0], m[1], m[2], m[3], m[4], m[5]);
                 }
 
-                const auto y_ind = k * H * W + y * W + x;
-                for (auto i = 0; i < WINOGRAD_M; i++)
-                {
-                    for (auto j = 0; j < WINOGRAD_M; j++)
-                    {
-                        if (y + i < H && x + j < W)
-                        {
-                            Y[y_ind + i * W + j] = o[i][j];
+                const auto idx = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(&tile_offset[b]));
+                const auto rows = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(&tile_rows[b]));
+                const auto cols = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(&tile_cols[b]));
+
+                for (auto i = 0; i < WINOGRAD_M; i++) {
+                    std::array<__m256, WINOGRAD_M> o;
+                    multiply_at_avx2(o[0], o[1], o[2], o[3],
+                                     temp[i][0], temp[i][1], temp[i][2],
+                                     temp[i][3], temp[i][4], temp[i][5]);
+                    for (auto j = 0; j < WINOGRAD_M; j++) {
+                        auto val = o[j];
+                        if (means != nullptr) {
+                            val = _mm256_mul_ps(scale, _mm256_sub_ps(val, mean));
+                            if (eltwise != nullptr) {
+                                const auto on_board = _mm256_and_si256(
+                                    _mm256_cmpgt_epi32(rows, _mm256_set1_epi32(i)),
+                                    _mm256_cmpgt_epi32(cols, _mm256_set1_epi32(j)));
+                                const auto res = _mm256_mask_i32gather_ps(
+                                    _mm256_setzero_ps(),
+                                    &eltwise[y_offset + i * W + j], idx,
+                                    _mm256_castsi256_ps(on_board), 4);
+                                val = _mm256_add_ps(val, res);
+                            }
+                            val = _mm256_max_ps(val, _mm256_setzero_ps());
+                        }
+                        alignas(32) std::array<float, AVX2_LANES> out;
+                        _mm256_store_ps(out.data(), val);
+                        for (auto lane = 0; lane < AVX2_LANES; lane++) {
+                            if (i < tile_rows[b + lane] && j < tile_cols[b + lane]) {
+                                Y[y_offset + tile_offset[b + lane] + i * W + j] = out[lane];
+                            }
                         }
                     }
                 }
             }
+            for (auto b = AVX2_TILES; b < P; b++) {
+                const auto y = WINOGRAD_M * (b / WTILES);
+                const auto x = WINOGRAD_M * (b % WTILES);
+                const auto y_ind = y_offset + tile_offset[b];
+                winograd_tile_out(&M[m_offset + b], K * BP,
+                                  &Y[y_ind], y, x,
+                                  means ? means + k : nullptr,
+                                  stddevs ? stddevs + k : nullptr,
+                                  eltwise ? eltwise + y_ind : nullptr);
+            }
         }
     }
 }
+#endif
+
+void CPUPipe::winograd_transform_in(const simd_t simd,
+                                    const std::vector<float> &in,
+                                    std::vector<float> &V,
+                                    const int C,
+                                    const size_t batch_size)
+{
+#ifdef USE_WINOGRAD_AVX2
+    if (simd == simd_t::AVX2) {
+        winograd_transform_in_avx2(in, V, C, batch_size);
+        return;
+    }
+#else
+    (void)simd;
+#endif
+    winograd_transform_in_scalar(in, V, C, batch_size);
+}
+
+void CPUPipe::winograd_transform_out(const simd_t simd,
+                                     const std::vector<float> &M,
+                                     std::vector<float> &Y,
+                                     const int K,
+                                     const size_t batch_size,
+                                     const float* means,
+                                     const float* stddevs,
+                                     const float* eltwise)
+{
+#ifdef USE_WINOGRAD_AVX2
+    if (simd == simd_t::AVX2) {
+        winograd_transform_out_avx2(M, Y, K, batch_size,
+                                    means, stddevs, eltwise);
+        return;
+    }
+#else
+    (void)simd;
+#endif
+    winograd_transform_out_scalar(M, Y, K, batch_size,
+                                  means, stddevs, eltwise);
+}
+
+void CPUPipe::winograd_sgemm(const std::vector<float> &U,
+                             const std::vector<float> &V,
+                             std::vector<float> &M,
+                             const int C, const int K,
+                             const size_t batch_size)
+{
+    const auto BP = static_cast<int>(batch_size * WINOGRAD_P);
+
+    for (auto b = 0; b < WINOGRAD_TILE; b++)
+    {
+        const auto offset_u = b * K * C;
+        const auto offset_v = b * C * BP;
+        const auto offset_m = b * K * BP;
+#ifdef USE_BLAS
+        cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+                    K, BP, C,
+                    1.0f,
+                    &U[offset_u], K,
+                    &V[offset_v], BP,
+                    0.0f,
+                    &M[offset_m], BP);
+#else
+        auto C_mat = EigenMatrixMap<float>(M.data() + offset_m, BP, K);
+        C_mat.noalias() =
+            ConstEigenMatrixMap<float>(V.data() + offset_v, BP, C) * ConstEigenMatrixMap<float>(U.data() + offset_u, K, C).transpose();
+#endif
+    }
+}
+
+
+void CPUPipe::winograd_multiply(const size_t layer,
+                                const std::vector<float> &V,
+                                std::vector<float> &M,
+                                const int C, const int K,
+                                const size_t batch_size)
+{
+    winograd_sgemm(m_weights->m_conv_weights[layer], V, M, C, K, batch_size);
+}
 
-void CPUPipe::winograd_convolve3(const int outputs,
+void CPUPipe::winograd_convolve3(const size_t layer,
+                                 const int outputs,
                                  const std::vector<float> &input,
-                                 const std::vector<float> &U,
                                  std::vector<float> &V,
                                  std::vector<float> &M,
-                                 std::vector<float> &output)
+                                 std::vector<float> &output,
+                                 const size_t batch_size,
+                                 const float* eltwise)
 {
 
     constexpr unsigned int filter_len = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
+    const auto& U = m_weights->m_conv_weights[layer];
     const auto input_channels = U.size() / (outputs * filter_len);
 
-    winograd_transform_in(input, V, input_channels);
-    winograd_sgemm(U, V, M, input_channels, outputs);
-    winograd_transform_out(M, output, outputs);
+    // Batchnorm, ReLU and the residual add are done by the output
+    // transform.
+    winograd_transform_in(m_simd, input, V, input_channels, batch_size);
+    winograd_multiply(layer, V, M, input_channels, outputs, batch_size);
+    winograd_transform_out(m_simd, M, output, outputs, batch_size,
+                           m_weights->m_batchnorm_means[layer].data(),
+                           m_weights->m_batchnorm_stddevs[layer].data(),
+                           eltwise);
 }
 
 template <unsigned int filter_size>
@@ -322,8 +645,13 @@ void convolve(const size_t outputs,
               const std::vector<float> &input,
               const std::vector<float> &weights,
               const std::vector<float> &biases,
-              std::vector<float> &output)
+              std::vector<float> &output,
+              const size_t batch_size)
 {
+    // Only the 1x1 convolutions of the heads go through here, so the
+    // input is already in im2col layout and can be fed to SGEMM directly.
+    static_assert(filter_size == 1, "Only 1x1 convolutions are supported");
+
     // The size of the board is defined at compile time
     constexpr unsigned int width = BOARD_SIZE;
     constexpr unsigned int height = BOARD_SIZE;
@@ -331,74 +659,43 @@ void convolve(const size_t outputs,
     constexpr auto filter_len = filter_size * filter_size;
     const auto input_channels = weights.size() / (biases.size() * filter_len);
     const auto filter_dim = filter_len * input_channels;
-    assert(outputs * num_intersections == output.size());
-
-    std::vector<float> col(filter_dim * width * height);
-    im2col<filter_size>(input_channels, input, col);
-
-    // Weight shape (output, input, filter_size, filter_size)
-    // 96 18 3 3
-    // C←αAB + βC
-    // outputs[96,19x19] = weights[96,18x3x3] x col[18x3x3,19x19]
-    // M Number of rows in matrices A and C.
-    // N Number of columns in matrices B and C.
-    // K Number of columns in matrix A; number of rows in matrix B.
-    // lda The size of the first dimention of matrix A; if you are
-    // passing a matrix A[m][n], the value should be m.
-    //    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
-    //                ldb, beta, C, N);
+    assert(outputs * num_intersections * batch_size == output.size());
+
+    for (auto batch = size_t{0}; batch < batch_size; batch++)
+    {
+        const auto in_ptr = input.data() + batch * filter_dim * num_intersections;
+        const auto out_ptr = output.data() + batch * outputs * num_intersections;
+
+        // Weight shape (output, input, filter_size, filter_size)
+        // 96 18 3 3
+        // C←αAB + βC
+        // outputs[96,19x19] = weights[96,18x3x3] x col[18x3x3,19x19]
+        // M Number of rows in matrices A and C.
+        // N Number of columns in matrices B and C.
+        // K Number of columns in matrix A; number of rows in matrix B.
+        // lda The size of the first dimention of matrix A; if you are
+        // passing a matrix A[m][n], the value should be m.
+        //    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
+        //                ldb, beta, C, N);
 #ifdef USE_BLAS
-    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
-                // M        N            K
-                outputs, num_intersections, filter_dim,
-                1.0f, &weights[0], filter_dim,
-                &col[0], num_intersections,
-                0.0f, &output[0], num_intersections);
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                    // M        N            K
+                    outputs, num_intersections, filter_dim,
+                    1.0f, &weights[0], filter_dim,
+                    in_ptr, num_intersections,
+                    0.0f, out_ptr, num_intersections);
 #else
-    auto C_mat = EigenMatrixMap<float>(output.data(),
-                                       num_intersections, outputs);
-    C_mat.noalias() =
-        ConstEigenMatrixMap<float>(col.data(), num_intersections, filter_dim) * ConstEigenMatrixMap<float>(weights.data(), filter_dim, outputs);
+        auto C_mat = EigenMatrixMap<float>(out_ptr,
+                                           num_intersections, outputs);
+        C_mat.noalias() =
+            ConstEigenMatrixMap<float>(in_ptr, num_intersections, filter_dim) * ConstEigenMatrixMap<float>(weights.data(), filter_dim, outputs);
 #endif
 
-    for (unsigned int o = 0; o < outputs; o++)
-    {
-        for (unsigned int b = 0; b < num_intersections; b++)
-        {
-            output[(o * num_intersections) + b] += biases[o];
-        }
-    }
-}
-
-template <size_t spatial_size>
-void batchnorm(const size_t channels,
-               std::vector<float> &data,
-               const float *const means,
-               const float *const stddevs,
-               const float *const eltwise = nullptr)
-{
-    const auto lambda_ReLU = [](const auto val) { return (val > 0.0f) ? val : 0.0f; };
-    for (auto c = size_t{0}; c < channels; ++c)
-    {
-        const auto mean = means[c];
-        const auto scale_stddev = stddevs[c];
-        const auto arr = &data[c * spatial_size];
-
-        if (eltwise == nullptr)
-        {
-            // Classical BN
-            for (auto b = size_t{0}; b < spatial_size; b++)
-            {
-                arr[b] = lambda_ReLU(scale_stddev * (arr[b] - mean));
-            }
-        }
-        else
+        for (unsigned int o = 0; o < outputs; o++)
         {
-            // BN + residual add
-            const auto res = &eltwise[c * spatial_size];
-            for (auto b = size_t{0}; b < spatial_size; b++)
+            for (unsigned int b = 0; b < num_intersections; b++)
             {
-                arr[b] = lambda_ReLU((scale_stddev * (arr[b] - mean)) + res[b]);
+                out_ptr[(o * num_intersections) + b] += biases[o];
             }
         }
     }
@@ -408,6 +705,25 @@ void CPUPipe::forward(const std::vector<float> &input,
                       std::vector<float> &output_pol,
                       std::vector<float> &output_val,
                       std::vector<float> &output_vbe)
+{
+    static thread_local ForwardContext context;
+    forward_batch(input, output_pol, output_val, output_vbe, 1, context);
+}
+
+void CPUPipe::forward_batch(const std::vector<float> &input,
+                            std::vector<float> &output_pol,
+                            std::vector<float> &output_val,
+                            std::vector<float> &output_vbe,
+                            const size_t batch_size,
+                            ForwardContext &context)
+{
+    forward_tower(input, batch_size, context);
+    forward_heads(output_pol, output_val, output_vbe, batch_size, context);
+}
+
+void CPUPipe::forward_tower(const std::vector<float> &input,
+                            const size_t batch_size,
+                            ForwardContext &context)
 {
     // Input convolution
     constexpr auto P = WINOGRAD_P;
@@ -417,44 +733,49 @@ void CPUPipe::forward(const std::vector<float> &input,
     // convolution. Residual blocks are identical, but the first convolution
     // might be bigger when the network has very few filters
     const auto input_channels = std::max(static_cast<size_t>(output_channels),
-                                         static_cast<size_t>(input.size() / NUM_INTERSECTIONS));
-    auto conv_out = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-
-    auto V = std::vector<float>(WINOGRAD_TILE * input_channels * P);
-    auto M = std::vector<float>(WINOGRAD_TILE * output_channels * P);
-
-    winograd_convolve3(output_channels, input, m_weights->m_conv_weights[0], V, M, conv_out);
-    batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
-                                 m_weights->m_batchnorm_means[0].data(),
-                                 m_weights->m_batchnorm_stddevs[0].data());
+                                         static_cast<size_t>(input.size() / NUM_INTERSECTIONS / batch_size));
+    // Every element of the buffers is overwritten before being read, so
+    // they are only resized, which doesn't allocate once they are large
+    // enough.
+    auto& conv_out = context.conv_out;
+    auto& V = context.V;
+    auto& M = context.M;
+    conv_out.resize(batch_size * output_channels * NUM_INTERSECTIONS);
+    V.resize(WINOGRAD_TILE * input_channels * P * batch_size);
+    M.resize(WINOGRAD_TILE * output_channels * P * batch_size);
+
+    winograd_convolve3(0, output_channels, input, V, M, conv_out, batch_size);
 
     // Residual tower
-    auto conv_in = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-    auto res = std::vector<float>(output_channels * NUM_INTERSECTIONS);
+    auto& conv_in = context.conv_in;
+    auto& res = context.res;
+    conv_in.resize(batch_size * output_channels * NUM_INTERSECTIONS);
+    res.resize(batch_size * output_channels * NUM_INTERSECTIONS);
     for (auto i = size_t{1}; i < m_weights->m_conv_weights.size(); i += 2)
     {
         auto output_channels = m_input_channels;
         std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-                           m_weights->m_conv_weights[i], V, M, conv_out);
-        batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
-                                     m_weights->m_batchnorm_means[i].data(),
-                                     m_weights->m_batchnorm_stddevs[i].data());
+        winograd_convolve3(i, output_channels, conv_in, V, M, conv_out, batch_size);
 
         std::swap(conv_in, res);
         std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-                           m_weights->m_conv_weights[i + 1], V, M, conv_out);
-        batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
-                                     m_weights->m_batchnorm_means[i + 1].data(),
-                                     m_weights->m_batchnorm_stddevs[i + 1].data(),
-                                     res.data());
+        winograd_convolve3(i + 1, output_channels, conv_in, V, M, conv_out, batch_size,
+                           res.data());
     }
-    convolve<1>(m_conv_pol_b.size(), conv_out, m_conv_pol_w, m_conv_pol_b, output_pol);
-    convolve<1>(m_conv_val_b.size(), conv_out, m_conv_val_w, m_conv_val_b, output_val);
+}
+
+void CPUPipe::forward_heads(std::vector<float> &output_pol,
+                            std::vector<float> &output_val,
+                            std::vector<float> &output_vbe,
+                            const size_t batch_size,
+                            ForwardContext &context)
+{
+    const auto& conv_out = context.conv_out;
+    convolve<1>(m_conv_pol_b.size(), conv_out, m_conv_pol_w, m_conv_pol_b, output_pol, batch_size);
+    convolve<1>(m_conv_val_b.size(), conv_out, m_conv_val_w, m_conv_val_b, output_val, batch_size);
     if (m_conv_vbe_b.size() > 0)
     {
-        convolve<1>(m_conv_vbe_b.size(), conv_out, m_conv_vbe_w, m_conv_vbe_b, output_vbe);
+        convolve<1>(m_conv_vbe_b.size(), conv_out, m_conv_vbe_w, m_conv_vbe_b, output_vbe, batch_size);
     }
 }
 
@@ -39,43 +39,104 @@
 
 class CPUPipe : public ForwardPipe {
 public:
+    // Instruction sets the Winograd transforms have kernels for
+    enum class simd_t {
+        SCALAR, AVX2
+    };
+    static simd_t detect_simd();
+
+    // Scratch buffers of a forward pass. Every thread evaluating
+    // positions keeps its own, so that once they have grown to the size
+    // needed by the network no memory is allocated on the hot path.
+    class ForwardContext {
+        friend class CPUPipe;
+    private:
+        std::vector<float> V;
+        std::vector<float> M;
+        std::vector<float> conv_out;
+        std::vector<float> conv_in;
+        std::vector<float> res;
+    };
+
     virtual void initialize(const int channels);
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val,
                          std::vector<float>& output_vbe);
 
+    // Evaluate batch_size positions at once, inputs and outputs are
+    // concatenated position after position.
+    void forward_batch(const std::vector<float>& input,
+                       std::vector<float>& output_pol,
+                       std::vector<float>& output_val,
+                       std::vector<float>& output_vbe,
+                       const size_t batch_size,
+                       ForwardContext& context);
+    // The two halves of forward_batch: the residual tower leaves its
+    // output in the context, where the heads read it.  Batch schedulers
+    // run them on different threads.
+    void forward_tower(const std::vector<float>& input,
+                       const size_t batch_size,
+                       ForwardContext& context);
+    void forward_heads(std::vector<float>& output_pol,
+                       std::vector<float>& output_val,
+                       std::vector<float>& output_vbe,
+                       const size_t batch_size,
+                       ForwardContext& context);
+
     virtual void push_weights(unsigned int filter_size,
                               unsigned int channels,
                               unsigned int outputs,
                               std::shared_ptr<const ForwardPipeWeights> weights);
-private:
-    void winograd_transform_in(const std::vector<float>& in,
-                               std::vector<float>& V,
-                               const int C);
 
-    void winograd_sgemm(const std::vector<float>& U,
-                        const std::vector<float>& V,
-                        std::vector<float>& M,
-                        const int C, const int K);
+    static void winograd_transform_in(const simd_t simd,
+                                      const std::vector<float>& in,
+                                      std::vector<float>& V,
+                                      const int C,
+                                      const size_t batch_size);
+
+    // When means and stddevs are given, batchnorm, the residual add of
+    // eltwise (if any) and ReLU are applied while writing the output.
+    static void winograd_transform_out(const simd_t simd,
+                                       const std::vector<float>& M,
+                                       std::vector<float>& Y,
+                                       const int K,
+                                       const size_t batch_size,
+                                       const float* means = nullptr,
+                                       const float* stddevs = nullptr,
+                                       const float* eltwise = nullptr);
+
+    static void winograd_sgemm(const std::vector<float>& U,
+                               const std::vector<float>& V,
+                               std::vector<float>& M,
+                               const int C, const int K,
+                               const size_t batch_size);
+protected:
+    // Multiplies the transformed input V by the transformed weights of
+    // the convolution with index layer, producing M.
+    virtual void winograd_multiply(const size_t layer,
+                                   const std::vector<float>& V,
+                                   std::vector<float>& M,
+                                   const int C, const int K,
+                                   const size_t batch_size);
+
+    simd_t m_simd{simd_t::SCALAR};
 
-    void winograd_transform_out(const std::vector<float>& M,
-                                std::vector<float>& Y,
-                                const int K);
+    // Input + residual block tower
+    std::shared_ptr<const ForwardPipeWeights> m_weights;
 
-    void winograd_convolve3(const int outputs,
+private:
+    void winograd_convolve3(const size_t layer,
+                            const int outputs,
                             const std::vector<float>& input,
-                            const std::vector<float>& U,
                             std::vector<float>& V,
                             std::vector<float>& M,
-                            std::vector<float>& output);
-
+                            std::vector<float>& output,
+                            const size_t batch_size,
+                            const float* eltwise = nullptr);
 
     int m_input_channels;
 
-    // Input + residual block tower
-    std::shared_ptr<const ForwardPipeWeights> m_weights;
-
     std::vector<float> m_conv_pol_w;
     std::vector<float> m_conv_val_w;
     std::vector<float> m_conv_vbe_w;
@@ -0,0 +1,344 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "CPUPipeInt8.h"
+#include "Network.h"
+#include "Utils.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_INT8_AVX2
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define VNNI_TARGET __attribute__((target("avx2,fma,avx512f,avx512vl,avx512vnni")))
+#endif
+
+// The AVX2 kernel multiplies unsigned input bytes by signed weight bytes
+// and sums pairs of products into 16 bit integers, which must not
+// saturate: 2 * 255 * 63 < 32767. So the weights only use 7 bits.
+static constexpr auto WEIGHT_MAX = 63.0f;
+static constexpr auto INPUT_MAX = 127.0f;
+static constexpr auto INPUT_SHIFT = 128;
+
+// Input channels are multiplied 4 at a time, output channels are
+// computed 4 at a time and tile positions 16 at a time.
+static constexpr auto C_BLOCK = 4;
+static constexpr auto K_BLOCK = 4;
+static constexpr auto BP_BLOCK = 16;
+
+using Utils::ceilMultiple;
+
+// Quantizes the transformed input V, [tile][C][BP], to Vq, laid out as
+// [tile][C / 4][BP padded][4] so that the 4 input channels multiplied
+// together by the kernels are next to each other. Each tile position
+// gets its own scale, taken from the largest value over the channels.
+static void quantize_input(const std::vector<float>& V,
+                           const int C, const size_t BP,
+                           const size_t Cp, const size_t BPp,
+                           std::vector<std::uint8_t>& Vq,
+                           std::vector<float>& scales,
+                           std::vector<float>& inv_scales)
+{
+    Vq.resize(WINOGRAD_TILE * Cp * BPp);
+    scales.assign(WINOGRAD_TILE * BPp, 0.0f);
+    inv_scales.resize(BPp);
+
+    for (auto i = 0; i < WINOGRAD_TILE; i++) {
+        // Padding channels and positions must be zero after the shift.
+        for (auto c = size_t{0}; c < Cp; c++) {
+            const auto out = &Vq[(i * Cp + c / C_BLOCK * C_BLOCK) * BPp
+                                 + c % C_BLOCK];
+            const auto first = c < size_t(C) ? BP : 0;
+            for (auto bp = first; bp < BPp; bp++) {
+                out[bp * C_BLOCK] = INPUT_SHIFT;
+            }
+        }
+        const auto tile_scales = &scales[i * BPp];
+        for (auto c = 0; c < C; c++) {
+            const auto row = &V[(i * C + c) * BP];
+            for (auto bp = size_t{0}; bp < BP; bp++) {
+                tile_scales[bp] = std::max(tile_scales[bp], std::abs(row[bp]));
+            }
+        }
+        for (auto bp = size_t{0}; bp < BP; bp++) {
+            const auto absmax = tile_scales[bp];
+            inv_scales[bp] = absmax > 0.0f ? INPUT_MAX / absmax : 0.0f;
+            tile_scales[bp] = absmax / INPUT_MAX;
+        }
+        for (auto c = 0; c < C; c++) {
+            const auto row = &V[(i * C + c) * BP];
+            const auto out = &Vq[(i * Cp + c / C_BLOCK * C_BLOCK) * BPp
+                                 + c % C_BLOCK];
+            for (auto bp = size_t{0}; bp < BP; bp++) {
+                const auto q = std::nearbyint(row[bp] * inv_scales[bp]);
+                out[bp * C_BLOCK] =
+                    static_cast<std::uint8_t>(static_cast<int>(q) + INPUT_SHIFT);
+            }
+        }
+    }
+}
+
+// M[K][BP] = U[K][C] x Vq[C][BP] for a single tile element, dequantized.
+static void multiply_scalar(const std::uint8_t* Vq,
+                            const std::int8_t* U,
+                            const std::int32_t* offsets,
+                            const float* u_scales,
+                            const float* v_scales,
+                            float* M,
+                            const int K, const size_t Cp,
+                            const size_t BP, const size_t BPp)
+{
+    for (auto k = 0; k < K; k++) {
+        for (auto bp = size_t{0}; bp < BP; bp++) {
+            auto acc = std::int32_t{0};
+            for (auto c = size_t{0}; c < Cp; c++) {
+                const auto v = Vq[(c / C_BLOCK * BPp + bp) * C_BLOCK + c % C_BLOCK];
+                acc += std::int32_t{v} * std::int32_t{U[k * Cp + c]};
+            }
+            M[k * BP + bp] = static_cast<float>(acc - offsets[k])
+                           * (u_scales[k] * v_scales[bp]);
+        }
+    }
+}
+
+#ifdef USE_INT8_AVX2
+// Dequantizes and stores the accumulators of 4 output channels and 16
+// tile positions.
+AVX2_TARGET
+static inline void store_block(const __m256i (&acc)[K_BLOCK][2],
+                               const std::int32_t* offsets,
+                               const float* u_scales,
+                               const float* v_scales,
+                               float* M,
+                               const int k0, const int K,
+                               const size_t bp0, const size_t BP)
+{
+    for (auto kk = 0; kk < K_BLOCK && k0 + kk < K; kk++) {
+        const auto k = k0 + kk;
+        const auto offset = _mm256_set1_epi32(offsets[k]);
+        const auto u_scale = _mm256_set1_ps(u_scales[k]);
+        for (auto j = 0; j < 2; j++) {
+            const auto bp = bp0 + 8 * j;
+            if (bp >= BP) {
+                break;
+            }
+            const auto scale = _mm256_mul_ps(u_scale, _mm256_loadu_ps(&v_scales[bp]));
+            const auto val = _mm256_mul_ps(
+                _mm256_cvtepi32_ps(_mm256_sub_epi32(acc[kk][j], offset)), scale);
+            if (bp + 8 <= BP) {
+                _mm256_storeu_ps(&M[k * BP + bp], val);
+            } else {
+                // Don't write over the next output channel
+                alignas(32) float out[8];
+                _mm256_store_ps(out, val);
+                std::copy(out, out + (BP - bp), &M[k * BP + bp]);
+            }
+        }
+    }
+}
+
+AVX2_TARGET
+static void multiply_avx2(const std::uint8_t* Vq,
+                          const std::int8_t* U,
+                          const std::int32_t* offsets,
+                          const float* u_scales,
+                          const float* v_scales,
+                          float* M,
+                          const int K, const size_t Cp,
+                          const size_t BP, const size_t BPp)
+{
+    const auto ones = _mm256_set1_epi16(1);
+
+    for (auto k0 = 0; k0 < K; k0 += K_BLOCK) {
+        for (auto bp0 = size_t{0}; bp0 < BP; bp0 += BP_BLOCK) {
+            // Each vector holds 8 tile positions of 4 input channels
+            __m256i acc[K_BLOCK][2];
+            for (auto kk = 0; kk < K_BLOCK; kk++) {
+                acc[kk][0] = _mm256_setzero_si256();
+                acc[kk][1] = _mm256_setzero_si256();
+            }
+            for (auto cq = size_t{0}; cq < Cp / C_BLOCK; cq++) {
+                const auto v = &Vq[(cq * BPp + bp0) * C_BLOCK];
+                const auto v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v));
+                const auto v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + 32));
+                for (auto kk = 0; kk < K_BLOCK; kk++) {
+                    std::int32_t u;
+                    std::memcpy(&u, &U[(k0 + kk) * Cp + cq * C_BLOCK], sizeof(u));
+                    const auto ub = _mm256_set1_epi32(u);
+                    acc[kk][0] = _mm256_add_epi32(acc[kk][0],
+                        _mm256_madd_epi16(_mm256_maddubs_epi16(v0, ub), ones));
+                    acc[kk][1] = _mm256_add_epi32(acc[kk][1],
+                        _mm256_madd_epi16(_mm256_maddubs_epi16(v1, ub), ones));
+                }
+            }
+            store_block(acc, offsets, u_scales, v_scales, M, k0, K, bp0, BP);
+        }
+    }
+}
+
+// Same as multiply_avx2, but VNNI multiplies and accumulates the 4
+// products into 32 bits in a single instruction.
+VNNI_TARGET
+static void multiply_vnni(const std::uint8_t* Vq,
+                          const std::int8_t* U,
+                          const std::int32_t* offsets,
+                          const float* u_scales,
+                          const float* v_scales,
+                          float* M,
+                          const int K, const size_t Cp,
+                          const size_t BP, const size_t BPp)
+{
+    for (auto k0 = 0; k0 < K; k0 += K_BLOCK) {
+        for (auto bp0 = size_t{0}; bp0 < BP; bp0 += BP_BLOCK) {
+            __m256i acc[K_BLOCK][2];
+            for (auto kk = 0; kk < K_BLOCK; kk++) {
+                acc[kk][0] = _mm256_setzero_si256();
+                acc[kk][1] = _mm256_setzero_si256();
+            }
+            for (auto cq = size_t{0}; cq < Cp / C_BLOCK; cq++) {
+                const auto v = &Vq[(cq * BPp + bp0) * C_BLOCK];
+                const auto v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v));
+                const auto v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + 32));
+                for (auto kk = 0; kk < K_BLOCK; kk++) {
+                    std::int32_t u;
+                    std::memcpy(&u, &U[(k0 + kk) * Cp + cq * C_BLOCK], sizeof(u));
+                    const auto ub = _mm256_set1_epi32(u);
+                    acc[kk][0] = _mm256_dpbusd_epi32(acc[kk][0], v0, ub);
+                    acc[kk][1] = _mm256_dpbusd_epi32(acc[kk][1], v1, ub);
+                }
+            }
+            store_block(acc, offsets, u_scales, v_scales, M, k0, K, bp0, BP);
+        }
+    }
+}
+#endif
+
+void CPUPipeInt8::initialize(const int channels)
+{
+    CPUPipe::initialize(channels);
+#ifdef USE_INT8_AVX2
+    m_vnni = m_simd == simd_t::AVX2
+        && __builtin_cpu_supports("avx512vnni")
+        && __builtin_cpu_supports("avx512vl");
+    if (m_vnni) {
+        Utils::myprintf("CPU: using VNNI int8 multiplications.\n");
+    }
+#endif
+}
+
+void CPUPipeInt8::push_weights(unsigned int filter_size,
+                               unsigned int channels,
+                               unsigned int outputs,
+                               std::shared_ptr<const ForwardPipeWeights> weights)
+{
+    CPUPipe::push_weights(filter_size, channels, outputs, weights);
+
+    m_layers.clear();
+    for (const auto& U : weights->m_conv_weights) {
+        auto layer = QuantizedLayer{};
+        layer.K = outputs;
+        layer.C = U.size() / (WINOGRAD_TILE * outputs);
+        const auto Kp = ceilMultiple(layer.K, K_BLOCK);
+        const auto Cp = ceilMultiple(layer.C, C_BLOCK);
+        layer.weights.resize(WINOGRAD_TILE * Kp * Cp, 0);
+        layer.scales.resize(WINOGRAD_TILE * Kp, 0.0f);
+        layer.offsets.resize(WINOGRAD_TILE * Kp, 0);
+
+        // U is laid out as [tile][C][K]
+        for (auto i = 0; i < WINOGRAD_TILE; i++) {
+            for (auto k = 0; k < layer.K; k++) {
+                auto absmax = 0.0f;
+                for (auto c = 0; c < layer.C; c++) {
+                    absmax = std::max(absmax,
+                                      std::abs(U[(i * layer.C + c) * layer.K + k]));
+                }
+                const auto inv_scale = absmax > 0.0f ? WEIGHT_MAX / absmax : 0.0f;
+                auto sum = std::int32_t{0};
+                for (auto c = 0; c < layer.C; c++) {
+                    const auto q = static_cast<int>(std::nearbyint(
+                        U[(i * layer.C + c) * layer.K + k] * inv_scale));
+                    layer.weights[(i * Kp + k) * Cp + c] = static_cast<std::int8_t>(q);
+                    sum += q;
+                }
+                layer.scales[i * Kp + k] = absmax / WEIGHT_MAX;
+                layer.offsets[i * Kp + k] = sum * INPUT_SHIFT;
+            }
+        }
+        m_layers.emplace_back(std::move(layer));
+    }
+}
+
+void CPUPipeInt8::winograd_multiply(const size_t layer,
+                                    const std::vector<float>& V,
+                                    std::vector<float>& M,
+                                    const int C, const int K,
+                                    const size_t batch_size)
+{
+    const auto& weights = m_layers[layer];
+    assert(weights.C == C && weights.K == K);
+
+    const auto BP = batch_size * WINOGRAD_P;
+    const auto BPp = ceilMultiple(BP, BP_BLOCK);
+    const auto Cp = ceilMultiple(C, C_BLOCK);
+    const auto Kp = ceilMultiple(K, K_BLOCK);
+
+    static thread_local std::vector<std::uint8_t> Vq;
+    static thread_local std::vector<float> v_scales;
+    static thread_local std::vector<float> inv_scales;
+    quantize_input(V, C, BP, Cp, BPp, Vq, v_scales, inv_scales);
+
+    for (auto i = 0; i < WINOGRAD_TILE; i++) {
+#ifdef USE_INT8_AVX2
+        if (m_vnni) {
+            multiply_vnni(&Vq[i * Cp * BPp], &weights.weights[i * Kp * Cp],
+                          &weights.offsets[i * Kp], &weights.scales[i * Kp],
+                          &v_scales[i * BPp], &M[i * K * BP],
+                          K, Cp, BP, BPp);
+            continue;
+        }
+        if (m_simd == simd_t::AVX2) {
+            multiply_avx2(&Vq[i * Cp * BPp], &weights.weights[i * Kp * Cp],
+                          &weights.offsets[i * Kp], &weights.scales[i * Kp],
+                          &v_scales[i * BPp], &M[i * K * BP],
+                          K, Cp, BP, BPp);
+            continue;
+        }
+#endif
+        multiply_scalar(&Vq[i * Cp * BPp], &weights.weights[i * Kp * Cp],
+                        &weights.offsets[i * Kp], &weights.scales[i * Kp],
+                        &v_scales[i * BPp], &M[i * K * BP],
+                        K, Cp, BP, BPp);
+    }
+}
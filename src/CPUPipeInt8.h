@@ -0,0 +1,81 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2018-2019 Junhee Yoo and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef CPUPIPEINT8_H_INCLUDED
+#define CPUPIPEINT8_H_INCLUDED
+#include "config.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "CPUPipe.h"
+
+// CPUPipe with the multiplications of the residual tower done on 8 bit
+// integers. The Winograd transformed weights are quantized when they are
+// pushed, with one scale per output channel and tile element, and the
+// transformed input is quantized on the fly, with one scale per tile
+// position. Transforms, batchnorm and heads are the ones of CPUPipe.
+class CPUPipeInt8 : public CPUPipe {
+public:
+    virtual void initialize(const int channels);
+    virtual void push_weights(unsigned int filter_size,
+                              unsigned int channels,
+                              unsigned int outputs,
+                              std::shared_ptr<const ForwardPipeWeights> weights);
+
+protected:
+    virtual void winograd_multiply(const size_t layer,
+                                   const std::vector<float>& V,
+                                   std::vector<float>& M,
+                                   const int C, const int K,
+                                   const size_t batch_size);
+
+private:
+    class QuantizedLayer {
+    public:
+        int C;
+        int K;
+        // [tile][K padded][C padded], 4 consecutive input channels are
+        // multiplied and summed together by the kernels
+        std::vector<std::int8_t> weights;
+        // [tile][K padded], scale of the quantized weights
+        std::vector<float> scales;
+        // [tile][K padded], the input is stored shifted by 128 so that
+        // it fits in unsigned bytes, this is the sum of the weights
+        // multiplied by the shift, to be subtracted from the result.
+        std::vector<std::int32_t> offsets;
+    };
+
+    std::vector<QuantizedLayer> m_layers;
+    bool m_vnni{false};
+};
+
+#endif
@@ -0,0 +1,82 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2018-2019 Junhee Yoo and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+
+#include "CPUScheduler.h"
+#include "GTP.h"
+
+CPUScheduler::CPUScheduler(std::unique_ptr<CPUPipe>&& pipe)
+    : BatchScheduler(cfg_batch_size, cfg_batch_latency),
+      m_pipe(std::move(pipe)) {}
+
+CPUScheduler::~CPUScheduler() {
+    stop_workers();
+}
+
+void CPUScheduler::initialize(const int channels) {
+    m_pipe->initialize(channels);
+
+    // Search threads block while their position is evaluated, so one
+    // worker per batch worth of search threads keeps all the cores busy.
+    const auto num_worker_threads =
+        std::max(1u, (cfg_num_threads + cfg_batch_size - 1) / cfg_batch_size);
+    m_contexts.resize(num_worker_threads * PIPELINE_DEPTH);
+    start_workers(num_worker_threads);
+}
+
+void CPUScheduler::push_weights(
+    unsigned int filter_size,
+    unsigned int channels,
+    unsigned int outputs,
+    std::shared_ptr<const ForwardPipeWeights> weights) {
+
+    m_pipe->push_weights(filter_size, channels, outputs, weights);
+}
+
+void CPUScheduler::forward_batch(const size_t buffer,
+                                 const std::vector<float>& input,
+                                 std::vector<float>& /*output_pol*/,
+                                 std::vector<float>& /*output_val*/,
+                                 std::vector<float>& /*output_vbe*/,
+                                 const size_t batch_size) {
+    m_pipe->forward_tower(input, batch_size, m_contexts[buffer]);
+}
+
+void CPUScheduler::finish_batch(const size_t buffer,
+                                std::vector<float>& output_pol,
+                                std::vector<float>& output_val,
+                                std::vector<float>& output_vbe,
+                                const size_t batch_size) {
+    m_pipe->forward_heads(output_pol, output_val, output_vbe,
+                          batch_size, m_contexts[buffer]);
+}
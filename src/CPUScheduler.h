@@ -0,0 +1,74 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2018-2019 Junhee Yoo and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef CPUSCHEDULER_H_INCLUDED
+#define CPUSCHEDULER_H_INCLUDED
+#include "config.h"
+
+#include <memory>
+#include <vector>
+
+#include "BatchScheduler.h"
+#include "CPUPipe.h"
+
+// Runs the evaluations queued by the search threads through CPUPipe in
+// batches, so that the SGEMMs of every layer are done once for the whole
+// batch instead of once per position.
+class CPUScheduler : public BatchScheduler {
+public:
+    explicit CPUScheduler(std::unique_ptr<CPUPipe>&& pipe);
+    virtual ~CPUScheduler();
+
+    virtual void initialize(const int channels);
+    virtual void push_weights(unsigned int filter_size,
+                              unsigned int channels,
+                              unsigned int outputs,
+                              std::shared_ptr<const ForwardPipeWeights> weights);
+protected:
+    // The residual tower runs on the forward thread and the heads on
+    // the scatter thread, so they overlap for consecutive batches.
+    virtual void forward_batch(size_t buffer,
+                               const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               std::vector<float>& output_vbe,
+                               size_t batch_size);
+    virtual void finish_batch(size_t buffer,
+                              std::vector<float>& output_pol,
+                              std::vector<float>& output_val,
+                              std::vector<float>& output_vbe,
+                              size_t batch_size);
+private:
+    std::unique_ptr<CPUPipe> m_pipe;
+    // one per batch buffer
+    std::vector<CPUPipe::ForwardContext> m_contexts;
+};
+
+#endif
@@ -35,7 +35,6 @@
 #include <algorithm>
 #include <array>
 #include <iostream>
-#include <queue>
 #include <sstream>
 #include <string>
 
@@ -101,7 +100,13 @@ void FastBoard::set_state(int vertex, FastBoard::vertex_t content) {
     assert(vertex >= 0 && vertex < m_numvertices);
     assert(content >= BLACK && content <= INVAL);
 
+    if (m_state[vertex] == BLACK || m_state[vertex] == WHITE) {
+        flip_stone_bit(m_state[vertex], vertex);
+    }
     m_state[vertex] = content;
+    if (content == BLACK || content == WHITE) {
+        flip_stone_bit(content, vertex);
+    }
 }
 
 FastBoard::vertex_t FastBoard::get_state(int x, int y) const {
@@ -120,6 +125,9 @@ void FastBoard::reset_board(int size) {
     m_prisoners[BLACK] = 0;
     m_prisoners[WHITE] = 0;
     m_empty_cnt = 0;
+    m_stone_bits[BLACK].clear();
+    m_stone_bits[WHITE].clear();
+    m_geometry = &BitBoard::geometry(size);
 
     m_dirs[0] = -m_sidevertices;
     m_dirs[1] = +1;
@@ -276,51 +284,50 @@ void FastBoard::remove_neighbour(const int vtx, const int color) {
     }
 }
 
-int FastBoard::calc_reach_color(int color) const {
-    auto bd = std::vector<bool>(m_numvertices, false);
-
-    return calc_reach_color(color, EMPTY, bd, false);
-}
-
-
-int FastBoard::calc_reach_color(int color,
-                                int spread_color,
-                                std::vector<bool> & bd,
-                                bool territory) const {
-    auto reachable = 0;
-    bd.resize(m_numvertices);
-    auto open = std::queue<int>();
-    for (auto i = 0; i < m_boardsize; i++) {
-        for (auto j = 0; j < m_boardsize; j++) {
-            const auto vertex = get_vertex(i, j);
-            const auto peek = territory ?
-                int(m_territory[vertex]) : int(m_state[vertex]);
-            if (peek == color) {
-                reachable++;
-                bd[vertex] = true;
-                open.push(vertex);
-            } else {
-                bd[vertex] = false;
-            }
+int FastBoard::get_bit_index(const int vertex) const {
+    return (vertex / m_sidevertices - 1) * m_boardsize
+        + (vertex % m_sidevertices - 1);
+}
+
+void FastBoard::flip_stone_bit(const int color, const int vertex) {
+    m_stone_bits[color].flip(get_bit_index(vertex));
+}
+
+BitBoard FastBoard::get_playable_bits(const int color) const {
+    const auto empty = get_empty_bits();
+    // Next to an empty intersection a move is never suicide, only the
+    // surrounded ones need a closer look.
+    auto playable = empty & empty.adjacent(*m_geometry);
+    (empty - playable).for_each([&](const int idx) {
+        const auto vertex = get_vertex(idx % m_boardsize, idx / m_boardsize);
+        if (!is_suicide(vertex, color)) {
+            playable.set(idx);
         }
-    }
-    while (!open.empty()) {
-        /* colored field, spread */
-        auto vertex = open.front();
-        open.pop();
-
-        for (auto k = 0; k < 4; k++) {
-            auto neighbor = vertex + m_dirs[k];
-            const auto peek = territory ?
-                int(m_territory[neighbor]) : int(m_state[neighbor]);
-            if (!bd[neighbor] && peek == spread_color) {
-                reachable++;
-                bd[neighbor] = true;
-                open.push(neighbor);
-            }
+    });
+    return playable;
+}
+
+BitBoard FastBoard::get_territory_bits(const territory_t value) const {
+    auto bits = BitBoard{};
+    for (auto idx = 0; idx < m_boardsize * m_boardsize; idx++) {
+        const auto vertex = get_vertex(idx % m_boardsize, idx / m_boardsize);
+        if (m_territory[vertex] == value) {
+            bits.set(idx);
         }
     }
-    return reachable;
+    return bits;
+}
+
+// The intersections of seed, and those of spread connected to them
+// through spread.
+BitBoard FastBoard::calc_reach(const BitBoard& seed,
+                               const BitBoard& spread) const {
+    return seed.flood(spread, *m_geometry);
+}
+
+// Number of stones of this color, and empty intersections they reach.
+int FastBoard::calc_reach_color(int color) const {
+    return calc_reach(m_stone_bits[color], get_empty_bits()).count();
 }
 
 // Needed for scoring passed out games not in MC playouts
@@ -682,16 +689,15 @@ void FastBoard::find_dame() {
 
 void FastBoard::find_dame(std::vector<int>& all_dames) {
     all_dames.clear();
-    auto black = std::vector<bool>(m_numvertices, false);
-    auto white = std::vector<bool>(m_numvertices, false);
-
-    calc_reach_color(BLACK, EMPTY, black, false);
-    calc_reach_color(WHITE, EMPTY, white, false);
+    const auto empty = get_empty_bits();
+    const auto black = calc_reach(m_stone_bits[BLACK], empty);
+    const auto white = calc_reach(m_stone_bits[WHITE], empty);
 
     for (int i = 0; i < m_boardsize; i++) {
         for (int j = 0; j < m_boardsize; j++) {
             int vertex = get_vertex(i, j);
-            if (black[vertex] && white[vertex]) {
+            int idx = j * m_boardsize + i;
+            if (black.test(idx) && white.test(idx)) {
                 m_territory[vertex] = DAME;
                 all_dames.push_back(vertex);
             }
@@ -701,16 +707,15 @@ void FastBoard::find_dame(std::vector<int>& all_dames) {
 
 
 void FastBoard::find_seki() {
-    auto black_seki = std::vector<bool>(m_numvertices, false);
-    auto white_seki = std::vector<bool>(m_numvertices, false);
-
-    calc_reach_color(DAME, B_STONE, black_seki, true);
-    calc_reach_color(DAME, W_STONE, white_seki, true);
+    const auto dame = get_territory_bits(DAME);
+    const auto black_seki = calc_reach(dame, get_territory_bits(B_STONE));
+    const auto white_seki = calc_reach(dame, get_territory_bits(W_STONE));
 
     for (int i = 0; i < m_boardsize; i++) {
         for (int j = 0; j < m_boardsize; j++) {
             int vertex = get_vertex(i, j);
-            if ((black_seki[vertex] || white_seki[vertex])
+            int idx = j * m_boardsize + i;
+            if ((black_seki.test(idx) || white_seki.test(idx))
                 && m_territory[vertex] != DAME) {
                 m_territory[vertex] = SEKI;
             }
@@ -723,23 +728,21 @@ std::pair<int,int> FastBoard::find_territory() {
     auto b_terr_count = 0;
     auto w_terr_count = 0;
 
-    auto seki_eye = std::vector<bool>(m_numvertices, false);
-    auto b_territory = std::vector<bool>(m_numvertices, false);
-    auto w_territory = std::vector<bool>(m_numvertices, false);
-
-    calc_reach_color(SEKI, EMPTY_I, seki_eye, true);
-    calc_reach_color(B_STONE, EMPTY_I, b_territory, true);
-    calc_reach_color(W_STONE, EMPTY_I, w_territory, true);
+    const auto empty = get_territory_bits(EMPTY_I);
+    const auto seki_eye = calc_reach(get_territory_bits(SEKI), empty);
+    const auto b_territory = calc_reach(get_territory_bits(B_STONE), empty);
+    const auto w_territory = calc_reach(get_territory_bits(W_STONE), empty);
 
     for (int i = 0; i < m_boardsize; i++) {
         for (int j = 0; j < m_boardsize; j++) {
             int vertex = get_vertex(i, j);
-            if (seki_eye[vertex] && m_territory[vertex] != SEKI) {
+            int idx = j * m_boardsize + i;
+            if (seki_eye.test(idx) && m_territory[vertex] != SEKI) {
                 m_territory[vertex] = SEKI_EYE;
-            } else if (b_territory[vertex] && m_territory[vertex] != B_STONE) {
+            } else if (b_territory.test(idx) && m_territory[vertex] != B_STONE) {
                 m_territory[vertex] = B_TERR;
                 b_terr_count++;
-            } else if (w_territory[vertex] && m_territory[vertex] != W_STONE) {
+            } else if (w_territory.test(idx) && m_territory[vertex] != W_STONE) {
                 m_territory[vertex] = W_TERR;
                 w_terr_count++;
             }
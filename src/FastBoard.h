@@ -34,11 +34,12 @@
 #include "config.h"
 
 #include <array>
-#include <queue>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "BitBoard.h"
+
 class FastBoard {
     friend class FastState;
 public:
@@ -121,6 +122,20 @@ public:
     unsigned short int chain_stones(int vtx) const;
     int get_sym_move(const int vertex, const int symmetry) const;
 
+    // The stones of one color, and the empty intersections, as bitsets
+    // indexed by y * size + x.
+    const BitBoard& get_stone_bits(int color) const {
+        return m_stone_bits[color];
+    }
+    BitBoard get_empty_bits() const {
+        return (m_stone_bits[BLACK] | m_stone_bits[WHITE])
+            .complement(*m_geometry);
+    }
+    int get_bit_index(int vertex) const;
+    // The empty intersections where color can play without suicide.
+    // Ko isn't taken into account, see FastState::get_legal_bits.
+    BitBoard get_playable_bits(int color) const;
+
     void find_dame(std::vector<int>& all_dames);
     void reset_territory();
     bool is_dame(int vertex) const;
@@ -152,8 +167,14 @@ protected:
 
     std::array<territory_t, NUM_VERTICES> m_territory;
 
-    int calc_reach_color(int color, int color_spread,
-                         std::vector<bool> & bd, bool territory) const;
+    // Kept up to date with m_state, for the region operations and the
+    // network input planes.
+    std::array<BitBoard, 2> m_stone_bits;
+    const BitBoard::Geometry* m_geometry;
+
+    void flip_stone_bit(int color, int vertex);
+    BitBoard get_territory_bits(territory_t value) const;
+    BitBoard calc_reach(const BitBoard& seed, const BitBoard& spread) const;
     int calc_reach_color(int color) const;
     void find_dame();
     void find_seki();
@@ -105,6 +105,24 @@ bool FastState::is_move_legal(int color, int vertex) const {
                       !board.is_suicide(vertex, color)));
 }
 
+BitBoard FastState::get_legal_bits(int color) const {
+    auto legal = board.get_playable_bits(color);
+    if (m_komove != FastBoard::NO_VERTEX) {
+        legal.reset(board.get_bit_index(m_komove));
+    }
+    if (cfg_analyze_tags.has_move_restrictions()) {
+        const auto candidates = legal;
+        candidates.for_each([&](const int idx) {
+            const auto size = board.get_boardsize();
+            const auto vertex = board.get_vertex(idx % size, idx / size);
+            if (cfg_analyze_tags.is_to_avoid(color, vertex, m_movenum)) {
+                legal.reset(idx);
+            }
+        });
+    }
+    return legal;
+}
+
 void FastState::play_move(int vertex) {
     play_move(board.m_tomove, vertex);
 }
@@ -281,13 +299,8 @@ int FastState::get_allowed_blunders() const {
 }
 
 bool FastState::is_symmetry_invariant(const int symmetry) const {
-    for (auto y = 0; y < BOARD_SIZE; y++) {
-        for (auto x = 0; x < BOARD_SIZE; x++) {
-            const auto sym_vertex =
-                board.get_vertex(symmetry_nn_idx_table[symmetry][y * BOARD_SIZE + x]);
-            if (board.get_state(x, y) != board.get_state(sym_vertex))
-                return false;
-        }
+    if (!board.is_symmetry_invariant(symmetry)) {
+        return false;
     }
 
     if(m_komove != 0) {
@@ -46,6 +46,9 @@ public:
 
     void play_move(int vertex);
     bool is_move_legal(int color, int vertex) const;
+    // The intersections where is_move_legal holds, as a bitset indexed
+    // like FastBoard::get_stone_bits.
+    BitBoard get_legal_bits(int color) const;
 
     void set_komi(float komi);
     void add_komi(float delta);
@@ -31,6 +31,7 @@
 #ifndef FORWARDPIPE_H_INCLUDED
 #define FORWARDPIPE_H_INCLUDED
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -66,6 +67,19 @@ public:
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val,
                          std::vector<float>& output_vbe) = 0;
+    // Evaluates several positions at once. Batching pipes queue them all
+    // before waiting, so that they can end up in the same batch.
+    virtual void forward_multiple(const std::vector<std::vector<float>>& inputs,
+                                  std::vector<std::vector<float>>& output_pol,
+                                  std::vector<std::vector<float>>& output_val,
+                                  std::vector<std::vector<float>>& output_vbe) {
+        for (auto i = size_t{0}; i < inputs.size(); i++) {
+            forward(inputs[i], output_pol[i], output_val[i], output_vbe[i]);
+        }
+    }
+    // Number of batches run for each batch size, empty when the pipe
+    // does not batch.
+    virtual std::vector<std::uint64_t> get_batch_histogram() { return {}; }
     virtual void push_weights(unsigned int filter_size,
                               unsigned int channels,
                               unsigned int outputs,
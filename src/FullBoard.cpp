@@ -40,6 +40,16 @@
 
 using namespace Utils;
 
+void FullBoard::flip_sym_hashes(int color, int vertex) {
+    if (m_boardsize != BOARD_SIZE) {
+        return;
+    }
+    const auto& keys = Zobrist::zobrist_sym_stone[color][vertex];
+    for (auto s = 0; s < Zobrist::NUM_SYMMETRIES; s++) {
+        m_sym_ko_hash[s] ^= keys[s];
+    }
+}
+
 int FullBoard::remove_string(int i) {
     int pos = i;
     int removed = 0;
@@ -49,6 +59,8 @@ int FullBoard::remove_string(int i) {
         m_hash    ^= Zobrist::zobrist[m_state[pos]][pos];
         m_ko_hash ^= Zobrist::zobrist[m_state[pos]][pos];
 
+        flip_stone_bit(color, pos);
+        flip_sym_hashes(color, pos);
         m_state[pos] = EMPTY;
         m_parent[pos] = NUM_VERTICES;
 
@@ -109,14 +121,41 @@ std::uint64_t FullBoard::calc_hash(int komove) const {
 }
 
 std::uint64_t FullBoard::calc_symmetry_hash(int komove, int symmetry) const {
-    return calc_hash(komove, [this, symmetry](const auto vertex) {
+    const auto transform = [this, symmetry](const auto vertex) {
         if (vertex == NO_VERTEX) {
             return NO_VERTEX;
         } else {
             const auto newvtx = Network::get_symmetry(get_xy(vertex), symmetry, m_boardsize);
             return get_vertex(newvtx.first, newvtx.second);
         }
-    });
+    };
+    if (m_boardsize == BOARD_SIZE) {
+        auto res = m_sym_ko_hash[symmetry];
+        res ^= Zobrist::zobrist_pris[0][m_prisoners[0]];
+        res ^= Zobrist::zobrist_pris[1][m_prisoners[1]];
+        if (m_tomove == BLACK) {
+            res ^= Zobrist::zobrist_blacktomove;
+        }
+        res ^= Zobrist::zobrist_sym_ko[komove][symmetry];
+        assert(res == calc_hash(komove, transform));
+        return res;
+    }
+    return calc_hash(komove, transform);
+}
+
+bool FullBoard::is_symmetry_invariant(const int symmetry) const {
+    if (m_boardsize == BOARD_SIZE) {
+        return m_sym_ko_hash[symmetry] == m_ko_hash;
+    }
+    for (auto y = 0; y < BOARD_SIZE; y++) {
+        for (auto x = 0; x < BOARD_SIZE; x++) {
+            const auto sym_vertex =
+                get_vertex(symmetry_nn_idx_table[symmetry][y * BOARD_SIZE + x]);
+            if (get_state(x, y) != get_state(sym_vertex))
+                return false;
+        }
+    }
+    return true;
 }
 
 std::uint64_t FullBoard::get_hash() const {
@@ -142,6 +181,8 @@ int FullBoard::update_board(const int color, const int i) {
     m_ko_hash ^= Zobrist::zobrist[m_state[i]][i];
 
     m_state[i] = vertex_t(color);
+    flip_stone_bit(color, i);
+    flip_sym_hashes(color, i);
     m_next[i] = i;
     m_parent[i] = i;
     m_libs[i] = count_pliberties(i);
@@ -232,6 +273,8 @@ void FullBoard::reset_board(int size) {
 
     m_hash = calc_hash();
     m_ko_hash = calc_ko_hash();
+    // The empty board is symmetric.
+    m_sym_ko_hash.fill(m_ko_hash);
 }
 
 bool FullBoard::remove_dead_stones(const FullBoard & tt_endboard) {
@@ -32,8 +32,10 @@
 #define FULLBOARD_H_INCLUDED
 
 #include "config.h"
+#include <array>
 #include <cstdint>
 #include "FastBoard.h"
+#include "Zobrist.h"
 
 class FullBoard : public FastBoard {
 public:
@@ -53,11 +55,18 @@ public:
     std::uint64_t calc_hash(int komove = NO_VERTEX) const;
     std::uint64_t calc_symmetry_hash(int komove, int symmetry) const;
     std::uint64_t calc_ko_hash() const;
+    // Whether the stones are the same after the symmetry.  Both are O(1)
+    // on BOARD_SIZE boards, which keep the symmetric hashes up to date.
+    bool is_symmetry_invariant(int symmetry) const;
 
     std::uint64_t m_hash;
     std::uint64_t m_ko_hash;
 
 private:
+    void flip_sym_hashes(int color, int vertex);
+
+    // ko hash of the 8 symmetric positions, BOARD_SIZE boards only
+    std::array<std::uint64_t, Zobrist::NUM_SYMMETRIES> m_sym_ko_hash;
     template<class Function>
     std::uint64_t calc_hash(int komove, Function transform) const;
     bool m_lastforced{false};
@@ -37,10 +37,12 @@
 #include <cstdlib>
 #include <exception>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <limits>
 #include <memory>
 #include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -99,6 +101,13 @@ std::uint64_t cfg_rng_seed;
 bool cfg_dumbpass;
 bool cfg_restrict_tt;
 bool cfg_recordvisits;
+bool cfg_transpositions;
+int cfg_leaf_batch;
+float cfg_batch_latency;
+bool cfg_collision_aware;
+bool cfg_pin_threads;
+bool cfg_numa;
+bool cfg_numa_interleave_root;
 #ifdef USE_OPENCL
 std::vector<int> cfg_gpus;
 bool cfg_sgemm_exhaustive;
@@ -123,6 +132,11 @@ bool cfg_quiet;
 std::string cfg_options_str;
 bool cfg_benchmark;
 bool cfg_cpu_only;
+cpu_precision_t cfg_cpu_precision;
+bool cfg_cpu_selfcheck;
+NNCache::policy_format_t cfg_nncache_format;
+int cfg_nncache_topk;
+std::string cfg_nncache_file;
 float cfg_blunder_thr;
 float cfg_losing_thr;
 float cfg_blunder_rndmax_avg;
@@ -339,6 +353,9 @@ void GTP::initialize(std::unique_ptr<Network>&& net) {
         throw std::runtime_error("Error setting memory requirements.");
     }
     myprintf("%s\n", message.c_str());
+
+    // Now that the cache has its final size.
+    s_network->nncache_load();
 }
 
 void GTP::setup_default_parameters() {
@@ -408,6 +425,13 @@ void GTP::setup_default_parameters() {
     cfg_random_temp = 1.0f;
     cfg_restrict_tt = false;
     cfg_dumbpass = false;
+    cfg_transpositions = false;
+    cfg_leaf_batch = 1;
+    cfg_batch_latency = 0.0f;
+    cfg_collision_aware = false;
+    cfg_pin_threads = false;
+    cfg_numa = false;
+    cfg_numa_interleave_root = false;
     cfg_logfile_handle = nullptr;
     cfg_quiet = false;
     cfg_benchmark = false;
@@ -416,6 +440,11 @@ void GTP::setup_default_parameters() {
 #else
     cfg_cpu_only = false;
 #endif
+    cfg_cpu_precision = cpu_precision_t::SINGLE;
+    cfg_cpu_selfcheck = false;
+    cfg_nncache_format = NNCache::policy_format_t::FLOAT;
+    cfg_nncache_topk = 0;
+    cfg_nncache_file = "";
 
     cfg_analyze_tags = AnalyzeTags{};
 
@@ -461,6 +490,7 @@ const std::string GTP::s_commands[] = {
     "kgs-time_settings",
     "kgs-game_over",
     "heatmap",
+    "sai-komi_curve",
     "lz-analyze",
     "lz-genmove_analyze",
     "lz-memory_report",
@@ -558,6 +588,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
     if (input == "") {
         return;
     } else if (input == "exit") {
+        s_network->nncache_save();
         exit(EXIT_SUCCESS);
     } else if (input.find("#") == 0) {
         return;
@@ -582,6 +613,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         gtp_printf(id, PROGRAM_VERSION);
         return;
     } else if (command == "quit") {
+        s_network->nncache_save();
         gtp_printf(id, "");
         exit(EXIT_SUCCESS);
     } else if (command.find("known_command") == 0) {
@@ -633,7 +665,9 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         Training::clear_training();
         game.reset_game();
         search = std::make_unique<UCTSearch>(game, *s_network);
-        assert(UCTNodePointer::get_tree_size() == 0);
+        // Only the root of the new search and its statistics are left,
+        // in a single slab.
+        assert(UCTNodePointer::get_tree_size() == NodeArena::SLAB_SIZE);
         gtp_printf(id, "");
         return;
     } else if (command.find("komi") == 0) {
@@ -1039,6 +1073,63 @@ void GTP::execute(GameState & game, const std::string& xinput) {
 
         gtp_printf(id, "");
         return;
+    } else if (command.find("sai-komi_curve") == 0) {
+        // Winrates for black from komi min to max, from the network and
+        // from the search tree, without searching again for each komi.
+        std::istringstream cmdstream(command);
+        std::string tmp;
+        std::vector<float> args;
+        float value;
+
+        cmdstream >> tmp;   // eat sai-komi_curve
+        while (cmdstream >> value) {
+            args.push_back(value);
+        }
+        const auto komi = game.get_komi();
+        const auto min_komi = args.size() >= 2 ? args[0] : komi - 10.0f;
+        const auto max_komi = args.size() >= 2 ? args[1] : komi + 10.0f;
+        const auto step = args.size() == 3 ? args[2] : 1.0f;
+        if (!cmdstream.eof() || args.size() == 1 || args.size() > 3
+            || step <= 0.0f || max_komi < min_komi) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+        if (!s_network->m_value_head_sai) {
+            gtp_fail_printf(id, "network has no komi value head");
+            return;
+        }
+
+        auto komis = std::vector<float>{};
+        const auto steps = static_cast<int>((max_komi - min_komi) / step + 0.5f);
+        for (auto i = 0; i <= steps; i++) {
+            komis.push_back(min_komi + i * step);
+        }
+
+        const auto netres = s_network->get_output(
+            &game, Network::Ensemble::DIRECT,
+            Network::IDENTITY_SYMMETRY, cfg_use_nncache, cfg_use_nncache);
+        const auto net_winrates = Network::get_komi_winrates(
+            Network::get_extended(game, netres).alpkt, netres.beta,
+            komi, komis);
+
+        auto beta_median = 0.0f;
+        const auto quartiles = search->get_alpkt_quartiles(beta_median);
+        const auto search_winrates = Network::get_komi_winrates(
+            quartiles[2], beta_median, komi, komis);
+
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2) << "alpkt";
+        for (const auto alpkt : quartiles) {
+            out << " " << alpkt;
+        }
+        out << " beta " << std::setprecision(4) << beta_median;
+        for (auto i = size_t{0}; i < komis.size(); i++) {
+            out << "\nkomi " << std::setprecision(1) << komis[i]
+                << " net " << std::setprecision(4) << net_winrates[i]
+                << " search " << search_winrates[i];
+        }
+        gtp_printf(id, "%s", out.str().c_str());
+        return;
     } else if (command.find("fixed_handicap") == 0) {
         std::istringstream cmdstream(command);
         std::string tmp;
@@ -1356,8 +1447,13 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         auto total = base_memory + tree_size + cache_size;
         gtp_printf(id,
             "Estimated total memory consumption: %d MiB.\n"
-            "Network with overhead: %d MiB / Search tree: %d MiB / Network cache: %d\n",
-            total / MiB, base_memory / MiB, tree_size / MiB, cache_size / MiB);
+            "Network with overhead: %d MiB / Search tree: %d MiB / Network cache: %d\n"
+            "Network cache: %d entries of %d bytes, %.1fx the entries of a float cache\n",
+            total / MiB, base_memory / MiB, tree_size / MiB, cache_size / MiB,
+            int(s_network->get_cache_capacity()),
+            int(s_network->get_cache_entry_size()),
+            float(NNCache::entry_size(NNCache::policy_format_t::FLOAT, 0))
+                / s_network->get_cache_entry_size());
         return;
     } else if (command.find("lz-setoption") == 0) {
         return execute_setoption(*search.get(), id, command);
@@ -1417,7 +1513,7 @@ std::pair<bool, std::string> GTP::set_max_memory(size_t max_memory,
         cache_size_ratio_percent / 100;
 
     auto max_cache_count =
-        (int)(remove_overhead(max_cache_size) / NNCache::ENTRY_SIZE);
+        (int)(remove_overhead(max_cache_size) / s_network->get_cache_entry_size());
 
     // Verify if the setting would not result in too little cache.
     if (max_cache_count < NNCache::MIN_CACHE_COUNT) {
@@ -1532,7 +1628,7 @@ void GTP::execute_setoption(UCTSearch & search,
         valuestream >> lambda;
         if (cfg_lambda != lambda) {
             cfg_lambda = lambda;
-            search.reset();
+            search.refresh_agent_evals();
         }
 
         gtp_printf(id, "");
@@ -1542,7 +1638,7 @@ void GTP::execute_setoption(UCTSearch & search,
         valuestream >> mu;
         if (cfg_mu != mu) {
             cfg_mu = mu;
-            search.reset();
+            search.refresh_agent_evals();
         }
 
         gtp_printf(id, "");
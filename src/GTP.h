@@ -117,6 +117,13 @@ extern std::uint64_t cfg_rng_seed;
 extern bool cfg_dumbpass;
 extern bool cfg_restrict_tt;
 extern bool cfg_recordvisits;
+extern bool cfg_transpositions;
+extern int cfg_leaf_batch;
+extern float cfg_batch_latency;
+extern bool cfg_collision_aware;
+extern bool cfg_pin_threads;
+extern bool cfg_numa;
+extern bool cfg_numa_interleave_root;
 #ifdef USE_OPENCL
 extern std::vector<int> cfg_gpus;
 extern bool cfg_sgemm_exhaustive;
@@ -144,6 +151,14 @@ extern bool cfg_quiet;
 extern std::string cfg_options_str;
 extern bool cfg_benchmark;
 extern bool cfg_cpu_only;
+enum class cpu_precision_t {
+    SINGLE, INT8
+};
+extern cpu_precision_t cfg_cpu_precision;
+extern bool cfg_cpu_selfcheck;
+extern NNCache::policy_format_t cfg_nncache_format;
+extern int cfg_nncache_topk;
+extern std::string cfg_nncache_file;
 extern float cfg_blunder_thr;
 extern float cfg_losing_thr;
 extern float cfg_blunder_rndmax_avg;
@@ -60,7 +60,7 @@ void GameState::init_game(int size, float komi) {
     KoState::init_game(size, komi);
 
     game_history.clear();
-    game_history.emplace_back(std::make_shared<KoState>(*this));
+    game_history.push_back(std::make_shared<KoState>(*this));
 
     m_timecontrol.reset_clocks();
 
@@ -71,7 +71,7 @@ void GameState::reset_game() {
     KoState::reset_game();
 
     game_history.clear();
-    game_history.emplace_back(std::make_shared<KoState>(*this));
+    game_history.push_back(std::make_shared<KoState>(*this));
 
     m_timecontrol.reset_clocks();
 
@@ -119,8 +119,8 @@ void GameState::play_move(int color, int vertex) {
     }
 
     // cut off any leftover moves from navigating
-    game_history.resize(m_movenum);
-    game_history.emplace_back(std::make_shared<KoState>(*this));
+    game_history.truncate(m_movenum);
+    game_history.push_back(std::make_shared<KoState>(*this));
 }
 
 bool GameState::play_textmove(std::string color, const std::string& vertex) {
@@ -192,7 +192,7 @@ void GameState::anchor_game_history() {
     // handicap moves don't count in game history
     m_movenum = 0;
     game_history.clear();
-    game_history.emplace_back(std::make_shared<KoState>(*this));
+    game_history.push_back(std::make_shared<KoState>(*this));
 }
 
 bool GameState::set_fixed_handicap(int handicap) {
@@ -365,6 +365,6 @@ std::string GameState::eval_comment(bool print_header) const {
     return comstr.str();
 }
 
-const std::vector<std::shared_ptr<const KoState>>& GameState::get_game_history() const {
-    return game_history;
+std::vector<std::shared_ptr<const KoState>> GameState::get_game_history() const {
+    return game_history.to_vector();
 }
@@ -0,0 +1,162 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+#include "KoHashSet.h"
+
+#include <algorithm>
+#include <cassert>
+
+constexpr size_t KoHashSet::RECENT;
+
+bool KoHashSet::Table::contains(const std::uint64_t hash) const {
+    if (hash == 0) {
+        return has_zero;
+    }
+    // The hashes are random already, their low bits are the index.
+    const auto mask = slots.size() - 1;
+    for (auto i = hash & mask; slots[i] != 0; i = (i + 1) & mask) {
+        if (slots[i] == hash) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void KoHashSet::Table::insert(const std::uint64_t hash) {
+    if (hash == 0) {
+        count += !has_zero;
+        has_zero = true;
+        return;
+    }
+    const auto mask = slots.size() - 1;
+    auto i = hash & mask;
+    for (; slots[i] != 0; i = (i + 1) & mask) {
+        if (slots[i] == hash) {
+            return;
+        }
+    }
+    slots[i] = hash;
+    count++;
+}
+
+void KoHashSet::clear() {
+    m_table.reset();
+    m_recent_size = 0;
+}
+
+void KoHashSet::insert(const std::uint64_t hash) {
+    // Called on every move of every playout, so a hash already in the
+    // set is not looked up here. Duplicates are dropped by the merge.
+    if (m_recent_size == RECENT) {
+        merge_recent();
+    }
+    m_recent[m_recent_size++] = hash;
+}
+
+bool KoHashSet::contains(const std::uint64_t hash) const {
+    const auto recent_end = begin(m_recent) + m_recent_size;
+    if (std::find(begin(m_recent), recent_end, hash) != recent_end) {
+        return true;
+    }
+    for (auto table = m_table.get(); table; table = table->parent.get()) {
+        if (table->contains(hash)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t KoHashSet::size() const {
+    auto size = m_table ? m_table->total : 0;
+    for (auto i = size_t{0}; i < m_recent_size; i++) {
+        const auto hash = m_recent[i];
+        const auto recent_end = begin(m_recent) + i;
+        if (std::find(begin(m_recent), recent_end, hash) != recent_end) {
+            continue;
+        }
+        auto found = false;
+        for (auto table = m_table.get(); table; table = table->parent.get()) {
+            found = found || table->contains(hash);
+        }
+        size += !found;
+    }
+    return size;
+}
+
+void KoHashSet::merge_recent() {
+    // The top table always takes the recent hashes, the base one only
+    // when the top one has grown to about sqrt(16 * base).
+    auto merged = std::vector<const Table*>{};
+    auto count = m_recent_size;
+    auto parent = m_table;
+    while (parent && (parent->parent || count * count >= 16 * parent->count)) {
+        merged.emplace_back(parent.get());
+        count += parent->count;
+        parent = parent->parent;
+    }
+
+    // Keep the table at most half full, so that probes stay short.
+    auto capacity = size_t{32};
+    while (capacity < 2 * count) {
+        capacity *= 2;
+    }
+
+    // Start from a copy of the largest table when it is big enough,
+    // which is much cheaper than rehashing it.
+    auto table = std::make_shared<Table>();
+    if (!merged.empty() && merged.back()->slots.size() == capacity) {
+        *table = *merged.back();
+        merged.pop_back();
+    } else {
+        table->slots.resize(capacity);
+    }
+    for (const auto old : merged) {
+        for (const auto hash : old->slots) {
+            if (hash != 0) {
+                table->insert(hash);
+            }
+        }
+        if (old->has_zero) {
+            table->insert(0);
+        }
+    }
+    // Repeated hashes were not filtered by insert().
+    for (auto i = size_t{0}; i < m_recent_size; i++) {
+        if (!parent || !parent->contains(m_recent[i])) {
+            table->insert(m_recent[i]);
+        }
+    }
+    assert(table->count <= count);
+    table->total = table->count + (parent ? parent->total : 0);
+    table->parent = std::move(parent);
+    m_table = std::move(table);
+    m_recent_size = 0;
+}
@@ -0,0 +1,80 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef KOHASHSET_H_INCLUDED
+#define KOHASHSET_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Set of the ko hashes seen in a game, for positional superko checks.
+// The older hashes are kept in immutable open addressing tables that
+// copies share, the recent ones in a short list owned by each copy.
+// There are at most two tables: a large base one and a smaller one on
+// top of it, into which full lists are merged. The top table joins the
+// base one only once it holds about sqrt(16 n) hashes, so a copy filling
+// its list costs O(sqrt(n)) on average instead of copying the whole set.
+class KoHashSet {
+public:
+    static constexpr size_t RECENT = 16;
+
+    void clear();
+    void insert(std::uint64_t hash);
+    bool contains(std::uint64_t hash) const;
+    size_t size() const;
+
+private:
+    struct Table {
+        // Zero marks an empty slot, a zero hash is kept aside.
+        std::vector<std::uint64_t> slots;
+        size_t count{0};
+        bool has_zero{false};
+        // The base table below this one, none of its hashes is here.
+        std::shared_ptr<const Table> parent;
+        // count of this table and all its parents
+        size_t total{0};
+
+        bool contains(std::uint64_t hash) const;
+        void insert(std::uint64_t hash);
+    };
+
+    void merge_recent();
+
+    std::shared_ptr<const Table> m_table;
+    std::array<std::uint64_t, RECENT> m_recent{};
+    size_t m_recent_size{0};
+};
+
+#endif
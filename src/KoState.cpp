@@ -45,24 +45,28 @@ void KoState::init_game(int size, float komi) {
 
     FastState::init_game(size, komi);
 
-    m_ko_hash_history.clear();
-    m_ko_hash_history.emplace_back(board.get_ko_hash());
+    m_ko_hashes.clear();
+    m_repeat_stones = 0;
 }
 
-bool KoState::superko() const {
-    auto first = crbegin(m_ko_hash_history);
-    auto last = crend(m_ko_hash_history);
-
-    auto res = std::find(++first, last, board.get_ko_hash());
+int KoState::count_stones() const {
+    return board.get_stone_bits(FastBoard::BLACK).count()
+        + board.get_stone_bits(FastBoard::WHITE).count();
+}
 
-    return (res != last);
+bool KoState::superko() const {
+    if (count_stones() > m_repeat_stones) {
+        return false;
+    }
+    // Look for the current position among the previous ones.
+    return m_ko_hashes.contains(board.get_ko_hash());
 }
 
 void KoState::reset_game() {
     FastState::reset_game();
 
-    m_ko_hash_history.clear();
-    m_ko_hash_history.push_back(board.get_ko_hash());
+    m_ko_hashes.clear();
+    m_repeat_stones = 0;
     const StateEval void_ev;
     set_eval(void_ev);
 }
@@ -72,10 +76,14 @@ void KoState::play_move(int vertex) {
 }
 
 void KoState::play_move(int color, int vertex) {
+    m_ko_hashes.insert(board.get_ko_hash());
+    const auto stones = count_stones();
     if (vertex != FastBoard::RESIGN) {
         FastState::play_move(color, vertex);
     }
-    m_ko_hash_history.push_back(board.get_ko_hash());
+    if (count_stones() <= stones) {
+        m_repeat_stones = std::max(m_repeat_stones, stones);
+    }
 }
 
 StateEval KoState::get_eval() const {
@@ -33,11 +33,12 @@
 
 #include "config.h"
 
-#include <vector>
+#include <cstdint>
 #include <tuple>
 
 #include "FastState.h"
 #include "FullBoard.h"
+#include "KoHashSet.h"
 
 struct StateEval {
     size_t visits = 0;
@@ -76,7 +77,14 @@ public:
     void set_eval(const StateEval& ev);
 
 private:
-    std::vector<std::uint64_t> m_ko_hash_history;
+    int count_stones() const;
+
+    // Ko hashes of the positions before the current one.
+    KoHashSet m_ko_hashes;
+    // Most stones in a position played before the last capture or pass.
+    // Without captures the stones only grow, so positions with more
+    // stones than this can't be repetitions.
+    int m_repeat_stones{0};
     StateEval m_ev;
     /* float m_alpkt = 0.0f; */
     /* float m_beta = 1.0f; */
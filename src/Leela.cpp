@@ -65,11 +65,21 @@ static void license_blurb() {
 }
 
 static void calculate_thread_count_cpu(boost::program_options::variables_map & vm) {
+    // With batching, search threads wait for their batch to be
+    // evaluated, so we allow up to batch size threads per CPU.
+    if (vm["batchsize"].as<unsigned int>() > 0) {
+        cfg_batch_size = vm["batchsize"].as<unsigned int>();
+    } else {
+        cfg_batch_size = 1;
+    }
+
     // If we are CPU-based, there is no point using more than the number of CPUs/
-    auto cfg_max_threads = std::min(SMP::get_num_cpus(), size_t{MAX_CPUS});
+    auto cfg_max_threads = std::min(SMP::get_num_cpus() * cfg_batch_size,
+                                    size_t{MAX_CPUS});
 
 #ifndef NDEBUG
     cfg_max_threads = 1;
+    cfg_batch_size = 1;
 #endif
     if (vm["threads"].as<unsigned int>() > 0) {
         auto num_threads = vm["threads"].as<unsigned int>();
@@ -168,6 +178,8 @@ static void parse_commandline(int argc, char *argv[]) {
          "in the general direction of the 'polite' eightth of the board, "
          "instead of randomly.")
         ("noladdercode", "Don't use heuristics for deeper ladders exploration.")
+        ("transpositions", "Share the network evaluation and the winrate "
+         "of positions reached through different move orders.")
         ("lagbuffer,b", po::value<int>()->default_value(cfg_lagbuffer_cs),
                         "Safety margin for time usage in centiseconds.")
         ("resignpct,r", po::value<int>()->default_value(cfg_resignpct),
@@ -175,6 +187,9 @@ static void parse_commandline(int argc, char *argv[]) {
                         "-1 uses 10% but scales for handicap.")
         ("weights,w", po::value<std::string>()->default_value(cfg_weightsfile),
          "File with network weights.")
+        ("convert-weights", po::value<std::string>(),
+         "Convert the weights file to the binary format, which loads "
+         "faster, write it to this file and exit.")
         ("logfile,l", po::value<std::string>(), "File to log input/output to.")
         ("quiet,q", "Disable all diagnostic output.")
         ("timemanage", po::value<std::string>()->default_value("auto"),
@@ -188,6 +203,40 @@ static void parse_commandline(int argc, char *argv[]) {
         ("benchmark", "Test network and exit. Default args:\n-v3200 --noponder "
                       "-m0 -t1 -s1.")
         ("nocache", "Disable neural network cache.")
+        ("cache-format", po::value<std::string>(),
+            "Encoding of the policy in the neural network cache "
+            "(float/half/log8).\n"
+            "half and log8 fit 2x and 3.5x more positions in the same memory.")
+        ("cache-topk", po::value<int>(),
+            "Only cache the N most likely moves of the policy, the other "
+            "moves share what is left.")
+        ("cache-file", po::value<std::string>(),
+            "Load the neural network cache from this file at startup, "
+            "if it was saved with the same network, and save it on exit.")
+        ("batchsize", po::value<unsigned int>()->default_value(0),
+         "Max batch size.  Select 0 to let SAI pick a reasonable default.")
+        ("batch-latency", po::value<float>(),
+            "Target time in ms from queuing a position to getting its "
+            "evaluation. Batches are kept small enough to meet it. "
+            "Default 0 maximizes the throughput.")
+        ("leaf-batch", po::value<int>(),
+            "Each search thread selects N leaves ahead and sends their "
+            "evaluations to the network together. Needs the cache.")
+        ("collision-aware", "Count the simulations of different threads "
+         "that reach the same leaf, avoid the leaves being expanded and "
+         "raise the virtual loss with the threads in flight when they "
+         "collide often.")
+        ("pin-threads", "Pin every worker thread to its own logical CPU.")
+        ("numa", "Spread the worker threads over the NUMA nodes, pinned, "
+         "and keep the tree memory they allocate on their own node.")
+        ("numa-interleave-root", "With --numa, interleave the children "
+         "statistics of the root, read by every thread, over all the nodes.")
+        ("cpu-precision", po::value<std::string>(),
+            "Precision of the CPU residual tower (single/int8).\n"
+            "int8 quantizes the weights and the convolution inputs, "
+            "it requires --cpu-only.")
+        ("cpu-selfcheck", "Check every int8 CPU evaluation against the "
+         "single precision one and exit if they differ too much.")
 #ifndef USE_CPU_ONLY
         ("cpu-only", "Use CPU-only implementation and do not use OpenCL device(s).")
 #endif
@@ -199,8 +248,6 @@ static void parse_commandline(int argc, char *argv[]) {
                 "ID of the OpenCL device(s) to use (disables autodetection).")
         ("full-tuner", "Try harder to find an optimal OpenCL tuning.")
         ("tune-only", "Tune OpenCL only and then exit.")
-        ("batchsize", po::value<unsigned int>()->default_value(0),
-         "Max batch size.  Select 0 to let SAI pick a reasonable default.")
 #ifdef USE_HALF
         ("precision", po::value<std::string>(),
             "Floating-point precision (single/half/auto).\n"
@@ -259,13 +306,6 @@ static void parse_commandline(int argc, char *argv[]) {
          "The default is reduced parent's value (LeelaZero).")
         ("nolcb", "Choose move based on visits instead of LCB.")
         ;
-#endif
-    // These won't be shown, we use them to catch incorrect usage of the
-    // command line.
-    po::options_description ignore("Ignored options");
-#ifndef USE_OPENCL
-    ignore.add_options()
-        ("batchsize", po::value<unsigned int>()->default_value(1), "Max batch size.");
 #endif
     po::options_description h_desc("Hidden options");
     h_desc.add_options()
@@ -283,7 +323,7 @@ static void parse_commandline(int argc, char *argv[]) {
 #endif
     // Parse both the above, we will check if any of the latter are present.
     po::options_description all;
-    all.add(visible).add(ignore).add(h_desc);
+    all.add(visible).add(h_desc);
     po::positional_options_description p_desc;
     p_desc.add("arguments", -1);
     po::variables_map vm;
@@ -375,6 +415,14 @@ static void parse_commandline(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (vm.count("convert-weights")) {
+        const auto outfile = vm["convert-weights"].as<std::string>();
+        if (Network::convert_weights_file(cfg_weightsfile, outfile)) {
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
     if (vm.count("gtp")) {
         cfg_gtp_mode = true;
     }
@@ -434,8 +482,38 @@ static void parse_commandline(int argc, char *argv[]) {
     cfg_cpu_only = true;
 #endif
 
+    if (vm.count("cpu-precision")) {
+        auto precision = vm["cpu-precision"].as<std::string>();
+        if ("single" == precision) {
+            cfg_cpu_precision = cpu_precision_t::SINGLE;
+        } else if ("int8" == precision) {
+            cfg_cpu_precision = cpu_precision_t::INT8;
+        } else {
+            printf("Unexpected option for --cpu-precision, expecting single/int8\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("cpu-selfcheck")) {
+        cfg_cpu_selfcheck = true;
+    }
+
+    // The OpenCL pipes have no int8 tower, only the CPU one has.
+    if (!cfg_cpu_only && cfg_cpu_precision != cpu_precision_t::SINGLE) {
+        printf("--cpu-precision int8 requires --cpu-only.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (cfg_cpu_selfcheck && (!cfg_cpu_only
+                              || cfg_cpu_precision == cpu_precision_t::SINGLE)) {
+        printf("--cpu-selfcheck requires --cpu-only and --cpu-precision int8.\n");
+        exit(EXIT_FAILURE);
+    }
+
     if (cfg_cpu_only) {
         calculate_thread_count_cpu(vm);
+        if (cfg_batch_size > 1) {
+            myprintf("Using CPU batch size of %d\n", cfg_batch_size);
+        }
     } else {
 #ifdef USE_OPENCL
         calculate_thread_count_gpu(vm);
@@ -467,6 +545,70 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_max_cache_ratio_percent = 1;
     }
 
+    if (vm.count("cache-format")) {
+        auto format = vm["cache-format"].as<std::string>();
+        if ("float" == format) {
+            cfg_nncache_format = NNCache::policy_format_t::FLOAT;
+        } else if ("half" == format) {
+            cfg_nncache_format = NNCache::policy_format_t::HALF;
+        } else if ("log8" == format) {
+            cfg_nncache_format = NNCache::policy_format_t::LOG8;
+        } else {
+            printf("Unexpected option for --cache-format, expecting float/half/log8\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("cache-file")) {
+        cfg_nncache_file = vm["cache-file"].as<std::string>();
+    }
+
+    if (vm.count("cache-topk")) {
+        cfg_nncache_topk = vm["cache-topk"].as<int>();
+        if (cfg_nncache_topk < 0 || cfg_nncache_topk > NUM_INTERSECTIONS) {
+            printf("Unexpected option for --cache-topk, expecting 0-%d\n",
+                   NUM_INTERSECTIONS);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("pin-threads")) {
+        cfg_pin_threads = true;
+    }
+
+    if (vm.count("numa")) {
+        cfg_numa = true;
+        cfg_pin_threads = true;
+    }
+
+    if (vm.count("numa-interleave-root")) {
+        if (!cfg_numa) {
+            printf("--numa-interleave-root needs --numa\n");
+            exit(EXIT_FAILURE);
+        }
+        cfg_numa_interleave_root = true;
+    }
+
+    if (vm.count("collision-aware")) {
+        cfg_collision_aware = true;
+    }
+
+    if (vm.count("leaf-batch")) {
+        cfg_leaf_batch = vm["leaf-batch"].as<int>();
+        if (cfg_leaf_batch < 1) {
+            printf("Unexpected option for --leaf-batch, expecting 1 or more\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("batch-latency")) {
+        cfg_batch_latency = vm["batch-latency"].as<float>();
+        if (cfg_batch_latency < 0.0f) {
+            printf("Unexpected option for --batch-latency, expecting 0 or more\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (vm.count("dumbpass")) {
         cfg_dumbpass = true;
     }
@@ -552,6 +694,9 @@ static void parse_commandline(int argc, char *argv[]) {
     if (vm.count("noladdercode")) {
         cfg_laddercode = false;
     }
+    if (vm.count("transpositions")) {
+        cfg_transpositions = true;
+    }
     if (vm.count("timemanage")) {
         auto tm = vm["timemanage"].as<std::string>();
         if (tm == "auto") {
@@ -620,7 +765,29 @@ static void initialize_network() {
 
 // Setup global objects after command line has been parsed
 void init_global_objects() {
-    thread_pool.initialize(cfg_num_threads);
+    auto cpus = std::vector<int>{};
+    if (cfg_numa) {
+        // Consecutive workers go to different nodes, so that any
+        // number of threads is balanced over the sockets.
+        const auto& nodes = SMP::get_numa_nodes();
+        for (auto i = size_t{0}; cpus.size() < SMP::get_num_cpus(); i++) {
+            auto added = false;
+            for (const auto& node : nodes) {
+                if (i < node.cpus.size()) {
+                    cpus.emplace_back(node.cpus[i]);
+                    added = true;
+                }
+            }
+            if (!added) {
+                break;
+            }
+        }
+    } else if (cfg_pin_threads) {
+        for (auto cpu = size_t{0}; cpu < SMP::get_num_cpus(); cpu++) {
+            cpus.emplace_back(static_cast<int>(cpu));
+        }
+    }
+    thread_pool.initialize(cfg_num_threads, cpus);
 
     // Use deterministic random numbers for hashing
     auto rng = std::make_unique<Random>(5489);
@@ -694,6 +861,7 @@ int main(int argc, char *argv[]) {
         } else {
             // eof or other error
             std::cout << std::endl;
+            GTP::s_network->nncache_save();
             break;
         }
 
@@ -0,0 +1,132 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+#include "MedianEstimator.h"
+
+#include <algorithm>
+#include <cassert>
+
+double MedianEstimator::desired_position(int i, std::uint32_t count) {
+    return 1.0 + (count - 1) * (i / double(MARKERS - 1));
+}
+
+void MedianEstimator::add(float value) {
+    if (m_count < MARKERS) {
+        // Keep the first values sorted, they become the markers.
+        auto it = std::upper_bound(begin(m_heights),
+                                   begin(m_heights) + m_count, value);
+        std::copy_backward(it, begin(m_heights) + m_count,
+                           begin(m_heights) + m_count + 1);
+        *it = value;
+        m_count++;
+        if (m_count == MARKERS) {
+            for (auto i = 0; i < MARKERS; i++) {
+                m_positions[i] = i + 1;
+            }
+        }
+        return;
+    }
+
+    // Find the cell holding the value, stretching the extremes if needed.
+    auto k = 0;
+    if (value < m_heights[0]) {
+        m_heights[0] = value;
+    } else if (value >= m_heights[MARKERS - 1]) {
+        m_heights[MARKERS - 1] = value;
+        k = MARKERS - 2;
+    } else {
+        while (value >= m_heights[k + 1]) {
+            k++;
+        }
+    }
+    for (auto i = k + 1; i < MARKERS; i++) {
+        m_positions[i]++;
+    }
+    m_count++;
+
+    // Move the inner markers toward their ideal positions.
+    for (auto i = 1; i < MARKERS - 1; i++) {
+        const auto delta = desired_position(i, m_count) - m_positions[i];
+        if ((delta >= 1.0 && m_positions[i + 1] - m_positions[i] > 1)
+            || (delta <= -1.0 && m_positions[i - 1] - m_positions[i] < -1)) {
+            const auto d = delta > 0.0 ? 1 : -1;
+            const auto height = parabolic(i, d);
+            if (m_heights[i - 1] < height && height < m_heights[i + 1]) {
+                m_heights[i] = height;
+            } else {
+                m_heights[i] = linear(i, d);
+            }
+            m_positions[i] += d;
+        }
+    }
+}
+
+float MedianEstimator::parabolic(int i, int d) const {
+    const auto& q = m_heights;
+    const auto& n = m_positions;
+    return q[i] + d / double(n[i + 1] - n[i - 1])
+        * ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / double(n[i + 1] - n[i])
+           + (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / double(n[i] - n[i - 1]));
+}
+
+float MedianEstimator::linear(int i, int d) const {
+    return m_heights[i] + d * (m_heights[i + d] - m_heights[i])
+        / double(m_positions[i + d] - m_positions[i]);
+}
+
+float MedianEstimator::get_median() const {
+    assert(m_count > 0);
+    if (m_count >= MARKERS) {
+        return m_heights[MARKERS / 2];
+    }
+    if (m_count % 2) {
+        return m_heights[m_count / 2];
+    }
+    return 0.5 * m_heights[m_count / 2] + 0.5 * m_heights[m_count / 2 - 1];
+}
+
+std::array<float, 5> MedianEstimator::get_quartiles() const {
+    static_assert(MARKERS == 5, "The markers are the quartiles");
+    assert(m_count > 0);
+    if (m_count >= MARKERS) {
+        return m_heights;
+    }
+    // Interpolate between the sorted values, as get_median does.
+    auto quartiles = std::array<float, 5>{};
+    for (auto i = 0; i < MARKERS; i++) {
+        const auto pos = desired_position(i, m_count) - 1.0;
+        const auto lo = static_cast<size_t>(pos);
+        const auto hi = std::min<size_t>(lo + 1, m_count - 1);
+        const auto frac = static_cast<float>(pos - lo);
+        quartiles[i] = (1.0f - frac) * m_heights[lo] + frac * m_heights[hi];
+    }
+    return quartiles;
+}
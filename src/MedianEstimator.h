@@ -0,0 +1,70 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef MEDIANESTIMATOR_H_INCLUDED
+#define MEDIANESTIMATOR_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Streaming estimate of the median of a sequence of values, with the P²
+// algorithm of Jain and Chlamtac: five markers track the minimum, the
+// quartiles, the median and the maximum, and are moved by piecewise
+// parabolic interpolation as values arrive.  Memory and time per value
+// are constant.  The median is exact (and computed as Utils::median does)
+// up to five values.
+class MedianEstimator {
+public:
+    void add(float value);
+    float get_median() const;
+    // Minimum, first quartile, median, third quartile and maximum.
+    std::array<float, 5> get_quartiles() const;
+    size_t size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+
+private:
+    static constexpr auto MARKERS = 5;
+
+    // Ideal position of marker i when count values were seen.
+    static double desired_position(int i, std::uint32_t count);
+    float parabolic(int i, int d) const;
+    float linear(int i, int d) const;
+
+    // Marker heights; the sorted values while m_count < MARKERS.
+    std::array<float, MARKERS> m_heights;
+    // Marker positions, 1-based ranks within the values seen.
+    std::array<std::int32_t, MARKERS> m_positions;
+    std::uint32_t m_count{0};
+};
+
+#endif
@@ -28,8 +28,16 @@
 */
 
 #include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <memory>
+#include <numeric>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 #include "NNCache.h"
 #include "Utils.h"
@@ -38,63 +46,568 @@
 
 const int NNCache::MAX_CACHE_COUNT;
 const int NNCache::MIN_CACHE_COUNT;
-const size_t NNCache::ENTRY_SIZE;
+const size_t NNCache::WAYS;
+const size_t NNCache::STATS_SLOTS;
+const size_t NNCache::MAX_POLICY_SIZE;
 
-NNCache::NNCache(int size) : m_size(size) {}
+// Snapshot files: magic, version, key, encoding, then the entries.
+static const std::array<char, 8> SNAPSHOT_MAGIC =
+    {'S', 'A', 'I', 'N', 'N', 'C', 'A', 'C'};
+constexpr auto SNAPSHOT_VERSION = std::uint32_t{1};
+
+// LOG8 code of p is 255 + round(log(p) * LOG8_SCALE), 0 means p = 0.
+constexpr auto LOG8_SCALE = 12.0f;
+
+static std::uint16_t float_to_half(const float f) {
+    std::uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const auto sign = static_cast<std::uint16_t>((x >> 16) & 0x8000);
+    const auto absx = x & 0x7fffffff;
+    if (absx >= 0x47800000) {
+        // Too large, infinity or NaN.
+        return sign | (absx > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+    if (absx < 0x38800000) {
+        // Subnormal, in units of 2^-24.
+        float absf;
+        std::memcpy(&absf, &absx, sizeof(absf));
+        return sign | static_cast<std::uint16_t>(std::lrint(absf * 16777216.0f));
+    }
+    // Rebias the exponent and round the mantissa to nearest even.
+    auto h = (absx - 0x38000000) >> 13;
+    const auto rem = absx & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+        h++;
+    }
+    return sign | static_cast<std::uint16_t>(h);
+}
+
+static float half_to_float(const std::uint16_t h) {
+    const auto sign = std::uint32_t{h & 0x8000u} << 16;
+    const auto exponent = (h >> 10) & 0x1f;
+    const auto mantissa = std::uint32_t{h & 0x3ffu};
+    if (exponent == 0) {
+        const auto absf = mantissa / 16777216.0f;
+        return sign ? -absf : absf;
+    }
+    auto x = sign | (mantissa << 13);
+    if (exponent == 0x1f) {
+        x |= 0x7f800000;
+    } else {
+        x |= static_cast<std::uint32_t>(exponent + 112) << 23;
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+static std::uint8_t float_to_log8(const float f) {
+    if (!(f > 0.0f)) {
+        return 0;
+    }
+    const auto code = 255 + std::lrint(std::log(f) * LOG8_SCALE);
+    return static_cast<std::uint8_t>(std::max(0L, std::min(255L, code)));
+}
+
+static float log8_to_float(const std::uint8_t code) {
+    static const auto table = []() {
+        auto table = std::array<float, 256>{};
+        for (auto i = size_t{1}; i < table.size(); i++) {
+            table[i] = std::exp((static_cast<float>(i) - 255.0f) / LOG8_SCALE);
+        }
+        return table;
+    }();
+    return table[code];
+}
+
+static size_t value_size(const NNCache::policy_format_t format) {
+    switch (format) {
+        case NNCache::policy_format_t::HALF:
+            return sizeof(std::uint16_t);
+        case NNCache::policy_format_t::LOG8:
+            return sizeof(std::uint8_t);
+        default:
+            return sizeof(float);
+    }
+}
+
+static void store_value(const NNCache::policy_format_t format,
+                        const float value, unsigned char* data) {
+    switch (format) {
+        case NNCache::policy_format_t::HALF: {
+            const auto h = float_to_half(value);
+            std::memcpy(data, &h, sizeof(h));
+            break;
+        }
+        case NNCache::policy_format_t::LOG8:
+            *data = float_to_log8(value);
+            break;
+        default:
+            std::memcpy(data, &value, sizeof(value));
+    }
+}
+
+static float load_value(const NNCache::policy_format_t format,
+                        const unsigned char* data) {
+    switch (format) {
+        case NNCache::policy_format_t::HALF: {
+            std::uint16_t h;
+            std::memcpy(&h, data, sizeof(h));
+            return half_to_float(h);
+        }
+        case NNCache::policy_format_t::LOG8:
+            return log8_to_float(*data);
+        default:
+            float value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+    }
+}
+
+NNCache::NNCache(int size, policy_format_t format, int topk) {
+    set_format(format, topk);
+    resize(size);
+}
+
+size_t NNCache::policy_size(const policy_format_t format, const int topk) {
+    if (topk <= 0 || topk >= NUM_INTERSECTIONS) {
+        return NUM_INTERSECTIONS * value_size(format);
+    }
+    // Residual probability, then the moves and their probabilities.
+    return sizeof(float)
+        + topk * (sizeof(std::uint16_t) + value_size(format));
+}
+
+size_t NNCache::entry_size(const policy_format_t format, const int topk) {
+    return sizeof(Entry)
+        + policy_words(policy_size(format, topk)) * sizeof(PolicyWord)
+        + sizeof(std::atomic<std::uint8_t>) / WAYS;
+}
+
+void NNCache::set_format(const policy_format_t format, const int topk) {
+    m_format = format;
+    m_topk = (topk >= NUM_INTERSECTIONS ? 0 : std::max(0, topk));
+    m_policy_size = policy_size(m_format, m_topk);
+    m_policy_words = policy_words(m_policy_size);
+
+    // Reallocate everything.
+    const auto size = m_size;
+    m_num_sets = 0;
+    m_size = 0;
+    m_entries.reset();
+    if (size > 0) {
+        resize(size);
+    }
+}
+
+void NNCache::encode_policy(const Netresult& result,
+                            unsigned char* data) const {
+    if (m_topk == 0) {
+        for (const auto p : result.policy) {
+            store_value(m_format, p, data);
+            data += value_size(m_format);
+        }
+        return;
+    }
+
+    std::array<std::uint16_t, NUM_INTERSECTIONS> moves;
+    std::iota(begin(moves), end(moves), 0);
+    std::nth_element(begin(moves), begin(moves) + m_topk, end(moves),
+        [&result](const std::uint16_t a, const std::uint16_t b) {
+            return result.policy[a] > result.policy[b];
+        });
+
+    auto residual = 0.0f;
+    for (auto i = static_cast<size_t>(m_topk); i < moves.size(); i++) {
+        residual += result.policy[moves[i]];
+    }
+    std::memcpy(data, &residual, sizeof(residual));
+    data += sizeof(residual);
+    std::memcpy(data, moves.data(), m_topk * sizeof(std::uint16_t));
+    data += m_topk * sizeof(std::uint16_t);
+    for (auto i = 0; i < m_topk; i++) {
+        store_value(m_format, result.policy[moves[i]], data);
+        data += value_size(m_format);
+    }
+}
+
+void NNCache::decode_policy(const unsigned char* data,
+                            Netresult& result) const {
+    if (m_topk == 0) {
+        for (auto& p : result.policy) {
+            p = load_value(m_format, data);
+            data += value_size(m_format);
+        }
+        return;
+    }
+
+    float residual;
+    std::memcpy(&residual, data, sizeof(residual));
+    data += sizeof(residual);
+    // Moves not kept share the residual evenly.
+    result.policy.fill(residual / (NUM_INTERSECTIONS - m_topk));
+    const auto values = data + m_topk * sizeof(std::uint16_t);
+    for (auto i = 0; i < m_topk; i++) {
+        std::uint16_t move;
+        std::memcpy(&move, data + i * sizeof(move), sizeof(move));
+        result.policy[move % NUM_INTERSECTIONS] =
+            load_value(m_format, values + i * value_size(m_format));
+    }
+}
+
+void NNCache::store_policy(const Entry* entry, const unsigned char* data) {
+    auto words = get_policy_data(entry);
+    for (auto i = size_t{0}; i < m_policy_words; i++) {
+        auto word = std::uint32_t{0};
+        const auto offset = i * sizeof(word);
+        std::memcpy(&word, data + offset,
+                    std::min(sizeof(word), m_policy_size - offset));
+        words[i].store(word, std::memory_order_relaxed);
+    }
+}
+
+void NNCache::load_policy(const Entry* entry, unsigned char* data) const {
+    const auto words = get_policy_data(entry);
+    for (auto i = size_t{0}; i < m_policy_words; i++) {
+        const auto word = words[i].load(std::memory_order_relaxed);
+        const auto offset = i * sizeof(word);
+        std::memcpy(data + offset, &word,
+                    std::min(sizeof(word), m_policy_size - offset));
+    }
+}
+
+NNCache::Stats& NNCache::thread_stats() {
+    static std::atomic<size_t> next_slot{0};
+    thread_local auto slot = next_slot++ % STATS_SLOTS;
+    return m_stats[slot];
+}
 
 bool NNCache::lookup(std::uint64_t hash, Netresult & result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    ++m_lookups;
+    auto& stats = thread_stats();
+    stats.lookups.fetch_add(1, std::memory_order_relaxed);
+
+    const auto set = get_set(hash);
+    for (auto way = size_t{0}; way < WAYS; way++) {
+        auto& entry = set[way];
+        if (entry.hash.load(std::memory_order_relaxed) != hash) {
+            continue;
+        }
+        const auto seq = entry.seq.load(std::memory_order_acquire);
+        if ((seq & 1) || entry.hash.load(std::memory_order_relaxed) != hash) {
+            return false;  // Being replaced.
+        }
+        result.policy_pass = entry.policy_pass.load(std::memory_order_relaxed);
+        result.value = entry.value.load(std::memory_order_relaxed);
+        result.alpha = entry.alpha.load(std::memory_order_relaxed);
+        result.beta = entry.beta.load(std::memory_order_relaxed);
+        result.is_sai = entry.is_sai.load(std::memory_order_relaxed);
+        PolicyBytes policy;
+        load_policy(&entry, policy.data());
+        // Pairs with the release fence of the writer: if we read any
+        // of its stores, we also see its odd sequence number below.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry.seq.load(std::memory_order_relaxed) != seq) {
+            return false;  // Replaced while we were copying it.
+        }
+        decode_policy(policy.data(), result);
 
-    auto iter = m_cache.find(hash);
-    if (iter == m_cache.end()) {
-        return false;  // Not found.
+        // Found it.
+        entry.referenced.store(true, std::memory_order_relaxed);
+        stats.hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
     }
+    return false;  // Not found.
+}
 
-    const auto& entry = iter->second;
+NNCache::Entry* NNCache::choose_victim(std::uint64_t hash) {
+    const auto set = get_set(hash);
+    for (auto way = size_t{0}; way < WAYS; way++) {
+        if (set[way].hash.load(std::memory_order_relaxed) == hash) {
+            return nullptr;  // Already in the cache.
+        }
+    }
 
-    // Found it.
-    ++m_hits;
-    result = entry->result;
-    return true;
+    // CLOCK replacement: the hand skips, and clears, the entries that
+    // were hit since it last passed. After a full turn every bit is
+    // clear, so this only gives up if other threads keep hitting.
+    auto& hand = m_clock_hands[(set - &m_entries[0]) / WAYS];
+    auto victim = &set[0];
+    for (auto step = size_t{0}; step < 2 * WAYS; step++) {
+        victim = &set[hand.fetch_add(1, std::memory_order_relaxed) % WAYS];
+        if (victim->hash.load(std::memory_order_relaxed) == 0
+            || !victim->referenced.exchange(false, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    return victim;
 }
 
 void NNCache::insert(std::uint64_t hash,
                      const Netresult& result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-
-    if (m_cache.find(hash) != m_cache.end()) {
-        return;  // Already in the cache.
+    if (hash == 0) {
+        return;  // Marks empty entries.
     }
 
-    m_cache.emplace(hash, std::make_unique<Entry>(result));
-    m_order.push_back(hash);
-    ++m_inserts;
-
-    // If the cache is too large, remove the oldest entry.
-    if (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+    const auto victim = choose_victim(hash);
+    if (victim == nullptr) {
+        return;
+    }
+    auto seq = victim->seq.load(std::memory_order_relaxed);
+    if ((seq & 1)
+        || !victim->seq.compare_exchange_strong(seq, seq + 1,
+                                                std::memory_order_relaxed)) {
+        return;  // Another thread is writing it, drop this result.
     }
+    // Keep the payload stores below from becoming visible before the
+    // odd sequence number.
+    std::atomic_thread_fence(std::memory_order_release);
+    victim->policy_pass.store(result.policy_pass, std::memory_order_relaxed);
+    victim->value.store(result.value, std::memory_order_relaxed);
+    victim->alpha.store(result.alpha, std::memory_order_relaxed);
+    victim->beta.store(result.beta, std::memory_order_relaxed);
+    victim->is_sai.store(result.is_sai, std::memory_order_relaxed);
+    PolicyBytes policy;
+    encode_policy(result, policy.data());
+    store_policy(victim, policy.data());
+    victim->hash.store(hash, std::memory_order_relaxed);
+    victim->referenced.store(false, std::memory_order_relaxed);
+    victim->seq.store(seq + 2, std::memory_order_release);
+
+    thread_stats().inserts.fetch_add(1, std::memory_order_relaxed);
 }
 
 void NNCache::resize(int size) {
-    m_size = size;
-    while (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+    const auto num_sets =
+        std::max(size_t{1}, (static_cast<size_t>(size) + WAYS - 1) / WAYS);
+    if (num_sets == m_num_sets) {
+        return;
+    }
+
+    auto old_entries = std::move(m_entries);
+    auto old_policy_data = std::move(m_policy_data);
+    const auto old_size = m_size;
+
+    m_num_sets = num_sets;
+    m_size = num_sets * WAYS;
+    m_entries.reset(new Entry[m_size]);
+    m_policy_data.reset(new PolicyWord[m_size * m_policy_words]);
+    m_clock_hands.reset(new std::atomic<std::uint8_t>[m_num_sets]());
+
+    // Move the entries over, the encoding doesn't change.
+    const auto copy = [](const std::atomic<float>& from,
+                         std::atomic<float>& to) {
+        to.store(from.load(std::memory_order_relaxed),
+                 std::memory_order_relaxed);
+    };
+    for (auto i = size_t{0}; i < old_size; i++) {
+        const auto& old_entry = old_entries[i];
+        const auto hash = old_entry.hash.load(std::memory_order_relaxed);
+        if (hash == 0) {
+            continue;
+        }
+        const auto entry = choose_victim(hash);
+        if (entry == nullptr) {
+            continue;
+        }
+        copy(old_entry.policy_pass, entry->policy_pass);
+        copy(old_entry.value, entry->value);
+        copy(old_entry.alpha, entry->alpha);
+        copy(old_entry.beta, entry->beta);
+        entry->is_sai.store(old_entry.is_sai.load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+        const auto old_words = &old_policy_data[i * m_policy_words];
+        const auto words = get_policy_data(entry);
+        for (auto w = size_t{0}; w < m_policy_words; w++) {
+            words[w].store(old_words[w].load(std::memory_order_relaxed),
+                           std::memory_order_relaxed);
+        }
+        entry->hash.store(hash, std::memory_order_relaxed);
     }
 }
 
 void NNCache::clear() {
-    m_cache.clear();
-    m_order.clear();
+    for (auto i = size_t{0}; i < m_size; i++) {
+        m_entries[i].hash.store(0, std::memory_order_relaxed);
+        m_entries[i].referenced.store(false, std::memory_order_relaxed);
+    }
+}
+
+bool NNCache::save(const std::string& filename, const std::string& key) {
+    // Write to a temporary file so that a crash doesn't leave
+    // a truncated snapshot behind.
+    const auto tmpname = filename + ".tmp";
+    auto out = std::ofstream{tmpname, std::ios::binary | std::ios::trunc};
+    if (!out) {
+        Utils::myprintf("Could not open %s for writing.\n", tmpname.c_str());
+        return false;
+    }
+    const auto write = [&out](const auto& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+
+    auto count = std::uint64_t{0};
+    for (auto i = size_t{0}; i < m_size; i++) {
+        count += (m_entries[i].hash.load(std::memory_order_relaxed) != 0);
+    }
+
+    out.write(SNAPSHOT_MAGIC.data(), SNAPSHOT_MAGIC.size());
+    write(SNAPSHOT_VERSION);
+    write(static_cast<std::uint32_t>(key.size()));
+    out.write(key.data(), key.size());
+    write(static_cast<std::uint32_t>(m_format));
+    write(static_cast<std::int32_t>(m_topk));
+    write(static_cast<std::uint64_t>(m_policy_size));
+    write(count);
+    for (auto i = size_t{0}; i < m_size; i++) {
+        const auto& entry = m_entries[i];
+        const auto hash = entry.hash.load(std::memory_order_relaxed);
+        if (hash == 0) {
+            continue;
+        }
+        write(hash);
+        write(entry.policy_pass.load(std::memory_order_relaxed));
+        write(entry.value.load(std::memory_order_relaxed));
+        write(entry.alpha.load(std::memory_order_relaxed));
+        write(entry.beta.load(std::memory_order_relaxed));
+        write(static_cast<std::uint8_t>(
+            entry.is_sai.load(std::memory_order_relaxed)));
+        PolicyBytes policy;
+        load_policy(&entry, policy.data());
+        out.write(reinterpret_cast<const char*>(policy.data()),
+                  m_policy_size);
+    }
+    out.close();
+    if (!out || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+        Utils::myprintf("Failed to write cache snapshot %s.\n",
+                        filename.c_str());
+        std::remove(tmpname.c_str());
+        return false;
+    }
+    Utils::myprintf("Saved %d cache entries to %s.\n",
+                    static_cast<int>(count), filename.c_str());
+    return true;
+}
+
+size_t NNCache::load(const std::string& filename, const std::string& key) {
+    namespace bip = boost::interprocess;
+
+    auto region = bip::mapped_region{};
+    try {
+        auto mapping = bip::file_mapping{filename.c_str(), bip::read_only};
+        region = bip::mapped_region{mapping, bip::read_only};
+    } catch (const bip::interprocess_exception&) {
+        // No snapshot yet.
+        return 0;
+    }
+    const auto data = static_cast<const unsigned char*>(region.get_address());
+    const auto file_size = region.get_size();
+
+    auto pos = size_t{0};
+    auto read_failed = false;
+    const auto read_bytes = [&](void* dst, const size_t len) {
+        if (read_failed || len > file_size - pos) {
+            read_failed = true;
+            return;
+        }
+        std::memcpy(dst, data + pos, len);
+        pos += len;
+    };
+    const auto read = [&](auto& value) {
+        read_bytes(&value, sizeof(value));
+    };
+
+    auto magic = std::array<char, 8>{};
+    auto version = std::uint32_t{0};
+    auto key_size = std::uint32_t{0};
+    read_bytes(magic.data(), magic.size());
+    read(version);
+    read(key_size);
+    if (read_failed || magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION
+        || key_size > file_size - pos) {
+        Utils::myprintf("%s is not a cache snapshot, ignored.\n",
+                        filename.c_str());
+        return 0;
+    }
+    auto file_key = std::string(key_size, '\0');
+    read_bytes(&file_key[0], key_size);
+
+    auto format = std::uint32_t{0};
+    auto topk = std::int32_t{0};
+    auto policy_size = std::uint64_t{0};
+    auto count = std::uint64_t{0};
+    read(format);
+    read(topk);
+    read(policy_size);
+    read(count);
+    if (read_failed) {
+        Utils::myprintf("Cache snapshot %s is truncated, ignored.\n",
+                        filename.c_str());
+        return 0;
+    }
+    if (file_key != key) {
+        Utils::myprintf("Cache snapshot %s is for another network or "
+                        "backend, ignored.\n", filename.c_str());
+        return 0;
+    }
+    if (format != static_cast<std::uint32_t>(m_format) || topk != m_topk
+        || policy_size != m_policy_size) {
+        Utils::myprintf("Cache snapshot %s uses another cache format, "
+                        "ignored.\n", filename.c_str());
+        return 0;
+    }
+
+    auto loaded = size_t{0};
+    for (auto i = std::uint64_t{0}; i < count; i++) {
+        auto hash = std::uint64_t{0};
+        auto is_sai = std::uint8_t{0};
+        auto policy_pass = 0.0f;
+        auto value = 0.0f;
+        auto alpha = 0.0f;
+        auto beta = 0.0f;
+        read(hash);
+        read(policy_pass);
+        read(value);
+        read(alpha);
+        read(beta);
+        read(is_sai);
+        const auto policy = data + pos;
+        pos += m_policy_size;
+        if (read_failed || pos > file_size) {
+            break;
+        }
+        const auto entry = (hash != 0 ? choose_victim(hash) : nullptr);
+        if (entry == nullptr) {
+            continue;
+        }
+        entry->policy_pass.store(policy_pass, std::memory_order_relaxed);
+        entry->value.store(value, std::memory_order_relaxed);
+        entry->alpha.store(alpha, std::memory_order_relaxed);
+        entry->beta.store(beta, std::memory_order_relaxed);
+        entry->is_sai.store(is_sai != 0, std::memory_order_relaxed);
+        store_policy(entry, policy);
+        entry->hash.store(hash, std::memory_order_relaxed);
+        loaded++;
+    }
+    Utils::myprintf("Loaded %d cache entries from %s.\n",
+                    static_cast<int>(loaded), filename.c_str());
+    return loaded;
+}
+
+std::pair<int, int> NNCache::hit_rate() const {
+    auto hits = 0;
+    auto lookups = 0;
+    for (const auto& stats : m_stats) {
+        hits += stats.hits.load(std::memory_order_relaxed);
+        lookups += stats.lookups.load(std::memory_order_relaxed);
+    }
+    return {hits, lookups};
 }
 
 void NNCache::set_size_from_playouts(int max_playouts) {
     // cache hits are generally from last several moves so setting cache
     // size based on playouts increases the hit rate while balancing memory
     // usage for low playout instances. 150'000 cache entries is ~208 MiB
+    // with FLOAT entries.
     constexpr auto num_cache_moves = 3;
     auto max_playouts_per_move =
         std::min(max_playouts,
@@ -105,12 +618,22 @@ void NNCache::set_size_from_playouts(int max_playouts) {
 }
 
 void NNCache::dump_stats() {
+    auto inserts = 0;
+    for (const auto& stats : m_stats) {
+        inserts += stats.inserts.load(std::memory_order_relaxed);
+    }
+    auto used = size_t{0};
+    for (auto i = size_t{0}; i < m_size; i++) {
+        used += (m_entries[i].hash.load(std::memory_order_relaxed) != 0);
+    }
+    const auto rate = hit_rate();
     Utils::myprintf(
-        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %u size\n",
-        m_hits, m_lookups, 100. * m_hits / (m_lookups + 1),
-        m_inserts, m_cache.size());
+        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %zu size\n",
+        rate.first, rate.second, 100. * rate.first / (rate.second + 1),
+        inserts, used);
 }
 
 size_t NNCache::get_estimated_size() {
-    return m_order.size() * NNCache::ENTRY_SIZE;
+    // The entries are allocated up front.
+    return m_size * get_entry_size();
 }
@@ -33,11 +33,17 @@
 #include "config.h"
 
 #include <array>
-#include <deque>
+#include <atomic>
+#include <cstdint>
 #include <memory>
-#include <mutex>
-#include <unordered_map>
-
+#include <string>
+
+// Fixed capacity, set associative cache of network evaluations.
+// Lookups and inserts don't take locks, so that search threads don't
+// serialize on the cache. Every entry is protected by a sequence lock:
+// a writer makes the sequence number odd while it updates the entry,
+// and a reader that sees it odd or changed after copying the result
+// treats the lookup as a miss.
 class NNCache {
 public:
 
@@ -47,6 +53,9 @@ public:
     // Minimum size of the cache in number of items.
     static constexpr int MIN_CACHE_COUNT = 6'000;
 
+    // Number of entries a position can be stored in.
+    static constexpr size_t WAYS = 8;
+
     struct Netresult {
         // 19x19 board positions
         std::array<float, NUM_INTERSECTIONS> policy;
@@ -70,17 +79,50 @@ public:
         }
     };
 
-    static constexpr size_t ENTRY_SIZE =
-          sizeof(Netresult)
-        + sizeof(std::uint64_t)
-        + sizeof(std::unique_ptr<Netresult>);
+    // How the policy of an entry is stored. Besides FLOAT the policy is
+    // lossy: HALF keeps ~3 significant digits, LOG8 stores log(p) in
+    // 8 bits, which keeps ~4% relative precision down to p ~ 1e-9.
+    enum class policy_format_t {
+        FLOAT, HALF, LOG8
+    };
+
+    // Bytes used by an entry. topk > 0 stores only the topk most likely
+    // moves and spreads the remaining probability over the other ones.
+    static size_t entry_size(policy_format_t format, int topk);
 
-    NNCache(int size = MAX_CACHE_COUNT);  // ~ 208MiB
+private:
+    // The policy of every entry is encoded in its own slice of
+    // m_policy_data, the rest of the result is kept here.
+    // Readers may copy an entry while it is written, so the payload is
+    // only accessed through relaxed atomics and ordered by the sequence
+    // lock fences.
+    struct Entry {
+        std::atomic<std::uint32_t> seq{0};
+        // CLOCK reference bit, set when the entry is hit.
+        std::atomic<bool> referenced{false};
+        std::atomic<bool> is_sai{false};
+        // 0 when the entry is empty.
+        std::atomic<std::uint64_t> hash{0};
+        std::atomic<float> policy_pass{0.0f};
+        std::atomic<float> value{0.0f};
+        std::atomic<float> alpha{0.0f};
+        std::atomic<float> beta{0.0f};
+    };
+    using PolicyWord = std::atomic<std::uint32_t>;
+
+public:
+    NNCache(int size = MAX_CACHE_COUNT,
+            policy_format_t format = policy_format_t::FLOAT,
+            int topk = 0);  // ~ 208MiB with FLOAT
+
+    // Change the encoding of the entries, this empties the cache.
+    void set_format(policy_format_t format, int topk);
 
     // Set a reasonable size gives max number of playouts
     void set_size_from_playouts(int max_playouts);
 
-    // Resize NNCache
+    // Resize NNCache, keeping what fits of its content. This and clear()
+    // must not be called while other threads use the cache.
     void resize(int size);
     void clear();
 
@@ -91,36 +133,87 @@ public:
     void insert(std::uint64_t hash,
                 const Netresult& result);
 
+    // Write the cached entries to a snapshot file, tagged with key.
+    bool save(const std::string& filename, const std::string& key);
+
+    // Insert the entries of a snapshot file, if it was saved with the
+    // same key and encoding. Returns the number of entries loaded.
+    // Like resize(), not safe while other threads use the cache.
+    size_t load(const std::string& filename, const std::string& key);
+
     // Return the hit rate ratio.
-    std::pair<int, int> hit_rate() const {
-        return {m_hits, m_lookups};
-    }
+    std::pair<int, int> hit_rate() const;
 
     void dump_stats();
 
     // Return the estimated memory consumption of the cache.
     size_t get_estimated_size();
-private:
-
-    std::mutex m_mutex;
 
-    size_t m_size;
+    size_t get_entry_size() const {
+        return entry_size(m_format, m_topk);
+    }
+    size_t get_capacity() const {
+        return m_size;
+    }
+    policy_format_t get_format() const {
+        return m_format;
+    }
+    int get_topk() const {
+        return m_topk;
+    }
+private:
+    Entry* get_set(std::uint64_t hash) {
+        return &m_entries[(hash % m_num_sets) * WAYS];
+    }
+    PolicyWord* get_policy_data(const Entry* entry) const {
+        return &m_policy_data[(entry - &m_entries[0]) * m_policy_words];
+    }
 
-    // Statistics
-    int m_hits{0};
-    int m_lookups{0};
-    int m_inserts{0};
+    // Largest encoded policy, topk just below NUM_INTERSECTIONS.
+    static constexpr size_t MAX_POLICY_SIZE =
+        sizeof(float)
+        + NUM_INTERSECTIONS * (sizeof(std::uint16_t) + sizeof(float));
+    using PolicyBytes = std::array<unsigned char, MAX_POLICY_SIZE>;
 
-    struct Entry {
-        Entry(const Netresult& r)
-            : result(r) {}
-        Netresult result;  // ~ 1.4KiB
+    static size_t policy_size(policy_format_t format, int topk);
+    static size_t policy_words(size_t policy_size) {
+        return (policy_size + sizeof(PolicyWord) - 1) / sizeof(PolicyWord);
+    }
+    void encode_policy(const Netresult& result, unsigned char* data) const;
+    void decode_policy(const unsigned char* data, Netresult& result) const;
+    // Copy an encoded policy in or out of the words of an entry.
+    void store_policy(const Entry* entry, const unsigned char* data);
+    void load_policy(const Entry* entry, unsigned char* data) const;
+    // Pick the entry to replace, nullptr if hash is already cached.
+    Entry* choose_victim(std::uint64_t hash);
+
+    // Statistics, each thread counts in its own slot to avoid
+    // bouncing a shared cache line.
+    // Padded rather than alignas(64), which would over-align Network
+    // and is not honoured by C++14 operator new.
+    struct StatsCounters {
+        std::atomic<int> hits{0};
+        std::atomic<int> lookups{0};
+        std::atomic<int> inserts{0};
     };
-
-    // Map from hash to {features, result}
-    std::unordered_map<std::uint64_t, std::unique_ptr<const Entry>> m_cache;
-    // Order entries were added to the map.
-    std::deque<size_t> m_order;
+    struct Stats : StatsCounters {
+        char padding[64 - sizeof(StatsCounters)];
+    };
+    static constexpr size_t STATS_SLOTS = 64;
+    Stats& thread_stats();
+
+    policy_format_t m_format;
+    int m_topk;
+    size_t m_policy_size;
+    size_t m_policy_words;
+
+    size_t m_size{0};
+    size_t m_num_sets{0};
+    std::unique_ptr<Entry[]> m_entries;
+    std::unique_ptr<PolicyWord[]> m_policy_data;
+    // CLOCK hand of each set
+    std::unique_ptr<std::atomic<std::uint8_t>[]> m_clock_hands;
+    std::array<Stats, STATS_SLOTS> m_stats;
 };
 
 #endif
@@ -34,13 +34,19 @@
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iterator>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <boost/utility.hpp>
 #include <boost/format.hpp>
 #include <boost/spirit/home/x3.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #ifndef USE_BLAS
 #include <Eigen/Dense>
 #endif
@@ -58,6 +64,8 @@
 
 #include "Network.h"
 #include "CPUPipe.h"
+#include "CPUPipeInt8.h"
+#include "CPUScheduler.h"
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
 #include "UCTNode.h"
@@ -69,6 +77,7 @@
 #include "GTP.h"
 #include "NNCache.h"
 #include "Random.h"
+#include "SHA256.h"
 #include "ThreadPool.h"
 #include "Timing.h"
 #include "Utils.h"
@@ -92,6 +101,9 @@ using ConstEigenMatrixMap =
 // Symmetry helper
 std::array<std::array<int, NUM_INTERSECTIONS>,
                   Network::NUM_SYMMETRIES> symmetry_nn_idx_table;
+// Inverse of the above: where a board intersection goes in the input
+std::array<std::array<int, NUM_INTERSECTIONS>,
+                  Network::NUM_SYMMETRIES> symmetry_board_idx_table;
 
 float Network::benchmark_time(int centiseconds) {
     const auto cpus = cfg_num_threads;
@@ -559,7 +571,373 @@ int Network::load_v1_network(std::istream& wtfile, int format_version) {
 
     return 0;
 }
+void Network::prepare_weights() {
+    auto weight_index = size_t{0};
+    // Input convolution
+    // Winograd transform convolution weights
+    m_fwd_weights->m_conv_weights[weight_index] =
+        winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index],
+                             m_channels, m_input_planes);
+    weight_index++;
+
+    // Residual block convolutions
+    for (auto i = size_t{0}; i < m_residual_blocks * 2; i++) {
+        m_fwd_weights->m_conv_weights[weight_index] =
+            winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index],
+                                 m_channels, m_channels);
+        weight_index++;
+    }
+
+    // Biases are not calculated and are typically zero but some networks might
+    // still have non-zero biases.
+    // Move biases to batchnorm means to make the output match without having
+    // to separately add the biases.
+    auto bias_size = m_fwd_weights->m_conv_biases.size();
+    for (auto i = size_t{0}; i < bias_size; i++) {
+        auto means_size = m_fwd_weights->m_batchnorm_means[i].size();
+        for (auto j = size_t{0}; j < means_size; j++) {
+            m_fwd_weights->m_batchnorm_means[i][j] -= m_fwd_weights->m_conv_biases[i][j];
+            m_fwd_weights->m_conv_biases[i][j] = 0.0f;
+        }
+    }
+
+    for (auto i = size_t{0}; i < m_bn_val_w1.size(); i++) {
+        m_bn_val_w1[i] -= m_fwd_weights->m_conv_val_b[i];
+        m_fwd_weights->m_conv_val_b[i] = 0.0f;
+    }
+
+    for (auto i = size_t{0}; i < m_bn_vbe_w1.size(); i++) {
+        m_bn_vbe_w1[i] -= m_fwd_weights->m_conv_vbe_b[i];
+        m_fwd_weights->m_conv_vbe_b[i] = 0.0f;
+    }
+
+    for (auto i = size_t{0}; i < m_bn_pol_w1.size(); i++) {
+        m_bn_pol_w1[i] -= m_fwd_weights->m_conv_pol_b[i];
+        m_fwd_weights->m_conv_pol_b[i] = 0.0f;
+    }
+}
+
+// Binary weights file, version 2. All values are little endian.
+//
+//   char[8]     magic "SAIBINWT"
+//   uint32      version
+//   uint32      board size
+//   uint32      number of header fields, then the fields (see
+//               binary_header_fields)
+//   uint64      number of tensors, then for each tensor its offset from
+//               the start of the file and its number of floats
+//   float[]     the tensors, each starting at a multiple of 64 bytes
+//
+// The tensors are stored as prepare_weights() leaves them, so loading
+// the network is a copy out of the mapped file, without parsing or
+// transforming anything. Every tensor length is checked against the
+// one implied by the header before anything is copied.
+static constexpr auto BINARY_WEIGHTS_MAGIC =
+    std::array<char, 8>{{'S', 'A', 'I', 'B', 'I', 'N', 'W', 'T'}};
+static constexpr auto BINARY_WEIGHTS_VERSION = std::uint32_t{2};
+static constexpr auto BINARY_WEIGHTS_ALIGNMENT = std::uint64_t{64};
+// Tensors after the residual tower, see weight_tensors().
+static constexpr auto BINARY_WEIGHTS_HEAD_TENSORS = std::uint64_t{26};
+
+std::vector<std::uint32_t> Network::binary_header_fields() {
+    return {
+        std::uint32_t(m_residual_blocks),
+        std::uint32_t(m_channels),
+        std::uint32_t(m_input_moves),
+        std::uint32_t(m_input_planes),
+        std::uint32_t(m_policy_outputs),
+        std::uint32_t(m_komipolicy_chans),
+        std::uint32_t(m_val_outputs),
+        std::uint32_t(m_vbe_outputs),
+        std::uint32_t(m_val_chans),
+        std::uint32_t(m_vbe_chans),
+        std::uint32_t(m_value_head_rets),
+        std::uint32_t(m_value_head_type),
+        std::uint32_t(m_adv_features),
+        std::uint32_t(m_chainlibs_features),
+        std::uint32_t(m_chainsize_features),
+        std::uint32_t(m_komi_policy),
+        std::uint32_t(m_include_color),
+        std::uint32_t(m_value_head_not_stm),
+    };
+}
+
+void Network::set_binary_header_fields(const std::vector<std::uint32_t>& fields) {
+    auto it = begin(fields);
+    for (auto size : {&m_residual_blocks, &m_channels, &m_input_moves,
+                      &m_input_planes, &m_policy_outputs, &m_komipolicy_chans,
+                      &m_val_outputs, &m_vbe_outputs, &m_val_chans,
+                      &m_vbe_chans, &m_value_head_rets}) {
+        *size = *it++;
+    }
+    m_value_head_type = *it++;
+    for (auto flag : {&m_adv_features, &m_chainlibs_features,
+                      &m_chainsize_features, &m_komi_policy,
+                      &m_include_color, &m_value_head_not_stm}) {
+        *flag = (*it++ != 0);
+    }
+}
+
+std::vector<std::vector<float>*> Network::weight_tensors() {
+    auto tensors = std::vector<std::vector<float>*>{};
+    for (auto layers : {&m_fwd_weights->m_conv_weights,
+                        &m_fwd_weights->m_conv_biases,
+                        &m_fwd_weights->m_batchnorm_means,
+                        &m_fwd_weights->m_batchnorm_stddevs}) {
+        for (auto& tensor : *layers) {
+            tensors.emplace_back(&tensor);
+        }
+    }
+    for (auto tensor : {&m_fwd_weights->m_conv_pol_w, &m_fwd_weights->m_conv_pol_b,
+                        &m_bn_pol_w1, &m_bn_pol_w2,
+                        &m_kp1_pol_w, &m_kp1_pol_b, &m_kp2_pol_w, &m_kp2_pol_b,
+                        &m_ip_pol_w, &m_ip_pol_b,
+                        &m_fwd_weights->m_conv_val_w, &m_fwd_weights->m_conv_val_b,
+                        &m_bn_val_w1, &m_bn_val_w2,
+                        &m_ip1_val_w, &m_ip1_val_b, &m_ip2_val_w, &m_ip2_val_b,
+                        &m_fwd_weights->m_conv_vbe_w, &m_fwd_weights->m_conv_vbe_b,
+                        &m_bn_vbe_w1, &m_bn_vbe_w2,
+                        &m_ip1_vbe_w, &m_ip1_vbe_b, &m_ip2_vbe_w, &m_ip2_vbe_b}) {
+        tensors.emplace_back(tensor);
+    }
+    return tensors;
+}
+
+std::vector<std::uint64_t> Network::binary_tensor_sizes() {
+    const auto channels = std::uint64_t{m_channels};
+    const auto num_layers = 1 + 2 * std::uint64_t{m_residual_blocks};
+    const auto komipolicy_chans =
+        std::uint64_t{m_komi_policy ? m_komipolicy_chans : 0};
+    // The last value layer has a single output unless the second head
+    // is folded into it.
+    const auto val_rets = std::uint64_t{
+        m_value_head_type == SINGLE || m_value_head_type == DOUBLE_I
+        ? m_value_head_rets : 1};
+    const auto has_vbe_head = (m_value_head_type == DOUBLE_V
+                               || m_value_head_type == DOUBLE_Y
+                               || m_value_head_type == DOUBLE_T);
+    // Type Y shares the convolution of the alpha head.
+    const auto vbe_ip1_inputs = std::uint64_t{
+        m_value_head_type == DOUBLE_Y ? m_val_outputs : m_vbe_outputs};
+    const auto vbe_ip2_inputs = std::uint64_t{
+        m_value_head_type == DOUBLE_T ? m_val_chans : m_vbe_chans};
+
+    auto sizes = std::vector<std::uint64_t>{};
+    sizes.emplace_back(WINOGRAD_TILE * channels * m_input_planes);
+    for (auto i = std::uint64_t{1}; i < num_layers; i++) {
+        sizes.emplace_back(WINOGRAD_TILE * channels * channels);
+    }
+    // Biases, batchnorm means and stddevs.
+    sizes.insert(end(sizes), 3 * num_layers, channels);
+    for (auto size : {
+            channels * m_policy_outputs, std::uint64_t{m_policy_outputs},
+            std::uint64_t{m_policy_outputs}, std::uint64_t{m_policy_outputs},
+            (NUM_INTERSECTIONS * std::uint64_t{m_policy_outputs} + 1)
+                * komipolicy_chans,
+            komipolicy_chans, komipolicy_chans * komipolicy_chans,
+            komipolicy_chans,
+            (NUM_INTERSECTIONS * std::uint64_t{m_policy_outputs}
+                + komipolicy_chans) * POTENTIAL_MOVES,
+            std::uint64_t{POTENTIAL_MOVES},
+            channels * m_val_outputs, std::uint64_t{m_val_outputs},
+            std::uint64_t{m_val_outputs}, std::uint64_t{m_val_outputs},
+            std::uint64_t{m_val_chans} * m_val_outputs * NUM_INTERSECTIONS,
+            std::uint64_t{m_val_chans}, m_val_chans * val_rets, val_rets,
+            channels * m_vbe_outputs, std::uint64_t{m_vbe_outputs},
+            std::uint64_t{m_vbe_outputs}, std::uint64_t{m_vbe_outputs},
+            std::uint64_t{m_vbe_chans} * vbe_ip1_inputs * NUM_INTERSECTIONS,
+            std::uint64_t{m_vbe_chans},
+            has_vbe_head ? vbe_ip2_inputs : 0,
+            std::uint64_t{has_vbe_head ? 1u : 0u}}) {
+        sizes.emplace_back(size);
+    }
+    return sizes;
+}
+
+static bool is_binary_weights_file(const std::string& filename) {
+    auto file = std::ifstream{filename, std::ios::binary};
+    auto magic = std::array<char, 8>{};
+    return file.read(magic.data(), magic.size()) && magic == BINARY_WEIGHTS_MAGIC;
+}
+
+int Network::load_binary_network(const std::string& filename) {
+    namespace bip = boost::interprocess;
+
+    auto region = bip::mapped_region{};
+    try {
+        auto mapping = bip::file_mapping{filename.c_str(), bip::read_only};
+        region = bip::mapped_region{mapping, bip::read_only};
+    } catch (const bip::interprocess_exception& e) {
+        myprintf("Could not map weights file: %s (%s)\n",
+                 filename.c_str(), e.what());
+        return 1;
+    }
+    const auto data = static_cast<const char*>(region.get_address());
+    const auto file_size = region.get_size();
+
+    auto pos = BINARY_WEIGHTS_MAGIC.size();
+    auto read_failed = false;
+    const auto read = [&](auto& value) {
+        if (pos + sizeof(value) > file_size) {
+            read_failed = true;
+            return;
+        }
+        std::memcpy(&value, data + pos, sizeof(value));
+        pos += sizeof(value);
+    };
+
+    auto version = std::uint32_t{0};
+    read(version);
+    if (read_failed || version != BINARY_WEIGHTS_VERSION) {
+        myprintf("Binary weights file is the wrong version, "
+                 "convert the network again.\n");
+        return 1;
+    }
+
+    auto board_size = std::uint32_t{0};
+    read(board_size);
+    if (read_failed) {
+        myprintf("\nFailed to parse binary weights file header.\n");
+        return 1;
+    }
+    if (board_size != BOARD_SIZE) {
+        myprintf("\nGiven network is for %ux%u, but this version "
+                 "of SAI was compiled for %dx%d board!\n",
+                 board_size, board_size, BOARD_SIZE, BOARD_SIZE);
+        return 1;
+    }
+
+    auto num_fields = std::uint32_t{0};
+    read(num_fields);
+    if (read_failed || num_fields != binary_header_fields().size()) {
+        myprintf("\nFailed to parse binary weights file header.\n");
+        return 1;
+    }
+    auto fields = std::vector<std::uint32_t>(num_fields);
+    for (auto& field : fields) {
+        read(field);
+    }
+    if (read_failed) {
+        myprintf("\nFailed to parse binary weights file header.\n");
+        return 1;
+    }
+    set_binary_header_fields(fields);
+
+    // Check the tensor count before sizing anything from the header.
+    const auto num_layers = 1 + 2 * std::uint64_t{m_residual_blocks};
+    auto num_tensors = std::uint64_t{0};
+    read(num_tensors);
+    if (read_failed
+        || num_tensors != 4 * num_layers + BINARY_WEIGHTS_HEAD_TENSORS) {
+        myprintf("\nFailed to parse binary weights file header.\n");
+        return 1;
+    }
+    m_fwd_weights->m_conv_weights.resize(num_layers);
+    m_fwd_weights->m_conv_biases.resize(num_layers);
+    m_fwd_weights->m_batchnorm_means.resize(num_layers);
+    m_fwd_weights->m_batchnorm_stddevs.resize(num_layers);
+
+    const auto tensors = weight_tensors();
+    const auto sizes = binary_tensor_sizes();
+    assert(tensors.size() == num_tensors && sizes.size() == num_tensors);
+    for (auto i = size_t{0}; i < tensors.size(); i++) {
+        auto offset = std::uint64_t{0};
+        auto count = std::uint64_t{0};
+        read(offset);
+        read(count);
+        if (read_failed
+            || offset % BINARY_WEIGHTS_ALIGNMENT != 0
+            || offset > file_size
+            || count > (file_size - offset) / sizeof(float)) {
+            myprintf("\nFailed to parse binary weights file: "
+                     "truncated or corrupted.\n");
+            return 1;
+        }
+        if (count != sizes[i]) {
+            myprintf("\nFailed to parse binary weights file: tensor %d "
+                     "has %llu values, the header implies %llu.\n",
+                     static_cast<int>(i),
+                     static_cast<unsigned long long>(count),
+                     static_cast<unsigned long long>(sizes[i]));
+            return 1;
+        }
+        const auto first = reinterpret_cast<const float*>(data + offset);
+        tensors[i]->assign(first, first + count);
+    }
+
+    myprintf("Binary weights file: %d blocks, %d channels, %d input planes.\n",
+             m_residual_blocks, m_channels, m_input_planes);
+    return 0;
+}
+
+int Network::save_binary_network(const std::string& filename) {
+    auto out = std::ofstream{filename, std::ios::binary | std::ios::trunc};
+    if (!out) {
+        myprintf("Could not open %s for writing.\n", filename.c_str());
+        return 1;
+    }
+    const auto write = [&](const auto& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    const auto align = [](const std::uint64_t pos) {
+        return (pos + BINARY_WEIGHTS_ALIGNMENT - 1)
+            / BINARY_WEIGHTS_ALIGNMENT * BINARY_WEIGHTS_ALIGNMENT;
+    };
+
+    out.write(BINARY_WEIGHTS_MAGIC.data(), BINARY_WEIGHTS_MAGIC.size());
+    write(BINARY_WEIGHTS_VERSION);
+    write(static_cast<std::uint32_t>(BOARD_SIZE));
+    const auto fields = binary_header_fields();
+    write(static_cast<std::uint32_t>(fields.size()));
+    for (const auto& field : fields) {
+        write(field);
+    }
+
+    const auto tensors = weight_tensors();
+    write(static_cast<std::uint64_t>(tensors.size()));
+    auto offset = align(BINARY_WEIGHTS_MAGIC.size()
+                        + 3 * sizeof(std::uint32_t)
+                        + fields.size() * sizeof(std::uint32_t)
+                        + sizeof(std::uint64_t)
+                        + tensors.size() * 2 * sizeof(std::uint64_t));
+    for (const auto tensor : tensors) {
+        write(offset);
+        write(static_cast<std::uint64_t>(tensor->size()));
+        offset = align(offset + tensor->size() * sizeof(float));
+    }
+    for (const auto tensor : tensors) {
+        const auto padding = align(out.tellp()) - out.tellp();
+        for (auto i = std::uint64_t{0}; i < padding; i++) {
+            out.put(0);
+        }
+        out.write(reinterpret_cast<const char*>(tensor->data()),
+                  tensor->size() * sizeof(float));
+    }
+
+    if (!out) {
+        myprintf("Error writing %s.\n", filename.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+int Network::convert_weights_file(const std::string& infile,
+                                  const std::string& outfile) {
+    auto network = std::make_unique<Network>();
+    network->m_fwd_weights = std::make_shared<ForwardPipeWeights>();
+    if (network->load_network_file(infile)
+        || network->save_binary_network(outfile)) {
+        return 1;
+    }
+    myprintf("Wrote binary weights file %s.\n", outfile.c_str());
+    return 0;
+}
+
 int Network::load_network_file(const std::string& filename) {
+    if (is_binary_weights_file(filename)) {
+        return load_binary_network(filename);
+    }
+
     // gzopen supports both gz and non-gz files, will decompress
     // or just read directly as needed.
     auto gzhandle = gzopen(filename.c_str(), "rb");
@@ -639,12 +1017,35 @@ int Network::load_network_file(const std::string& filename) {
                     myprintf(")");
             }
             myprintf(".\n");
-            return load_v1_network(buffer, format_version);
+            if (load_v1_network(buffer, format_version)) {
+                return 1;
+            }
+            prepare_weights();
+            return 0;
         }
     }
     return 1;
 }
 
+static std::unique_ptr<ForwardPipe> make_cpu_pipe() {
+    auto pipe = std::unique_ptr<CPUPipe>{};
+    if (cfg_cpu_precision == cpu_precision_t::INT8) {
+        myprintf("Using int8 quantized CPU residual tower.\n");
+        pipe = std::make_unique<CPUPipeInt8>();
+    } else {
+        pipe = std::make_unique<CPUPipe>();
+    }
+    // With a batch size larger than one, evaluations requested by
+    // different search threads are coalesced and computed together.
+    if (cfg_batch_size > 1) {
+        myprintf("Initializing CPU-only evaluation (batch size %d).\n",
+                 cfg_batch_size);
+        return std::make_unique<CPUScheduler>(std::move(pipe));
+    }
+    myprintf("Initializing CPU-only evaluation.\n");
+    return pipe;
+}
+
 std::unique_ptr<ForwardPipe>&& Network::init_net(int channels,
     std::unique_ptr<ForwardPipe>&& pipe) {
 
@@ -756,6 +1157,7 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
 
     // Make a guess at a good size as long as the user doesn't
     // explicitly set a maximum memory usage.
+    m_nncache.set_format(cfg_nncache_format, cfg_nncache_topk);
     if (cfg_use_nncache) {
         m_nncache.set_size_from_playouts(playouts);
     } else {
@@ -771,6 +1173,7 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
                 (newvtx.second * BOARD_SIZE) + newvtx.first;
             assert(symmetry_nn_idx_table[s][v] >= 0
                    && symmetry_nn_idx_table[s][v] < NUM_INTERSECTIONS);
+            symmetry_board_idx_table[s][symmetry_nn_idx_table[s][v]] = v;
         }
     }
 
@@ -780,54 +1183,9 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
     }
     m_value_head_sai = (m_value_head_type != SINGLE);
 
-    auto weight_index = size_t{0};
-    // Input convolution
-    // Winograd transform convolution weights
-    m_fwd_weights->m_conv_weights[weight_index] =
-        winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index],
-                             m_channels, m_input_planes);
-    weight_index++;
-
-    // Residual block convolutions
-    for (auto i = size_t{0}; i < m_residual_blocks * 2; i++) {
-        m_fwd_weights->m_conv_weights[weight_index] =
-            winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index],
-                                 m_channels, m_channels);
-        weight_index++;
-    }
-
-    // Biases are not calculated and are typically zero but some networks might
-    // still have non-zero biases.
-    // Move biases to batchnorm means to make the output match without having
-    // to separately add the biases.
-    auto bias_size = m_fwd_weights->m_conv_biases.size();
-    for (auto i = size_t{0}; i < bias_size; i++) {
-        auto means_size = m_fwd_weights->m_batchnorm_means[i].size();
-        for (auto j = size_t{0}; j < means_size; j++) {
-            m_fwd_weights->m_batchnorm_means[i][j] -= m_fwd_weights->m_conv_biases[i][j];
-            m_fwd_weights->m_conv_biases[i][j] = 0.0f;
-        }
-    }
-
-    for (auto i = size_t{0}; i < m_bn_val_w1.size(); i++) {
-        m_bn_val_w1[i] -= m_fwd_weights->m_conv_val_b[i];
-        m_fwd_weights->m_conv_val_b[i] = 0.0f;
-    }
-
-    for (auto i = size_t{0}; i < m_bn_vbe_w1.size(); i++) {
-        m_bn_vbe_w1[i] -= m_fwd_weights->m_conv_vbe_b[i];
-        m_fwd_weights->m_conv_vbe_b[i] = 0.0f;
-    }
-
-    for (auto i = size_t{0}; i < m_bn_pol_w1.size(); i++) {
-        m_bn_pol_w1[i] -= m_fwd_weights->m_conv_pol_b[i];
-        m_fwd_weights->m_conv_pol_b[i] = 0.0f;
-    }
-
 #ifdef USE_OPENCL
     if (cfg_cpu_only) {
-        myprintf("Initializing CPU-only evaluation.\n");
-        m_forward = init_net(m_channels, std::make_unique<CPUPipe>());
+        m_forward = init_net(m_channels, make_cpu_pipe());
     } else {
 #ifdef USE_OPENCL_SELFCHECK
         // initialize CPU reference first, so that we can self-check
@@ -846,22 +1204,55 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
     }
 
 #else //!USE_OPENCL
-    myprintf("Initializing CPU-only evaluation.\n");
-    m_forward = init_net(m_channels, std::make_unique<CPUPipe>());
+    m_forward = init_net(m_channels, make_cpu_pipe());
 #endif
+    // The single precision CPUPipe is the reference the int8 one is
+    // checked against.
+    if (cfg_cpu_only && cfg_cpu_selfcheck
+        && cfg_cpu_precision != cpu_precision_t::SINGLE) {
+        m_forward_cpu = init_net(m_channels, std::make_unique<CPUPipe>());
+        m_cpu_selfcheck = true;
+    }
+
+    // The outputs, and so the cache snapshots, also depend on the
+    // backend and its precision.
+    if (!cfg_nncache_file.empty()) {
+        m_nncache_key = "sha256:" + SHA256::sha256_file(weightsfile)
+            + " softmax_temp:" + std::to_string(cfg_softmax_temp)
+            + " backend:" + get_backend_name();
+    }
 
     // Need to estimate size before clearing up the pipe.
     get_estimated_size();
     m_fwd_weights.reset();
 }
 
+std::string Network::get_backend_name() const {
+#ifdef USE_OPENCL
+    if (!cfg_cpu_only) {
+#ifdef USE_HALF
+        using HalfScheduler = OpenCLScheduler<half_float::half>;
+        if (dynamic_cast<HalfScheduler*>(m_forward.get()) != nullptr) {
+            return "opencl-half";
+        }
+#endif
+        return "opencl-single";
+    }
+#endif
+    if (cfg_cpu_precision == cpu_precision_t::INT8) {
+        return "cpu-int8";
+    }
+    return "cpu-single";
+}
+
 template<bool ReLU>
-std::vector<float> innerproduct(const std::vector<float>& input,
-                                const std::vector<float>& weights,
-                                const std::vector<float>& biases) {
+void innerproduct(const std::vector<float>& input,
+                  const std::vector<float>& weights,
+                  const std::vector<float>& biases,
+                  std::vector<float>& output) {
     const auto inputs = input.size();
     const auto outputs = biases.size();
-    std::vector<float> output(outputs);
+    output.resize(outputs);
     assert(inputs*outputs == weights.size());
 #ifdef USE_BLAS
     cblas_sgemv(CblasRowMajor, CblasNoTrans,
@@ -887,8 +1278,6 @@ std::vector<float> innerproduct(const std::vector<float>& input,
         }
         output[o] = val;
     }
-
-    return output;
 }
 
 template <size_t spatial_size>
@@ -919,7 +1308,6 @@ void batchnorm(const size_t channels,
     }
 }
 
-#ifdef USE_OPENCL_SELFCHECK
 void Network::compare_net_outputs(const Netresult& data,
                                   const Netresult& ref) {
     // Calculates L2-norm between data and ref.
@@ -935,21 +1323,34 @@ void Network::compare_net_outputs(const Netresult& data,
     const auto diff_winrate = data.value - ref.value;
     error += diff_pass * diff_pass;
     error += diff_winrate * diff_winrate;
+    if (ref.is_sai) {
+        // value is constant for SAI nets. alpha is in points, so weigh
+        // it by how much it moves the winrate of an even game, and
+        // compare beta relatively.
+        const auto diff_alpha = 0.25f * ref.beta * (data.alpha - ref.alpha);
+        const auto diff_beta = std::log(data.beta / ref.beta);
+        error += diff_alpha * diff_alpha;
+        error += diff_beta * diff_beta;
+    }
 
     error = std::sqrt(error);
 
     if (error > max_error || std::isnan(error)) {
+        if (cfg_cpu_only) {
+            printf("Error in int8 CPU calculation: the quantized network is "
+                   "too inaccurate, use --cpu-precision single.\n");
+            throw std::runtime_error("CPU int8 self-check mismatch.");
+        }
         printf("Error in OpenCL calculation: Update your device's OpenCL drivers "
                "or reduce the amount of games played simultaneously.\n");
         throw std::runtime_error("OpenCL self-check mismatch.");
     }
 }
-#endif
 
-std::vector<float> softmax(const std::vector<float>& input,
-                           const float temperature = 1.0f) {
-    auto output = std::vector<float>{};
-    output.reserve(input.size());
+void softmax(const std::vector<float>& input,
+             std::vector<float>& output,
+             const float temperature = 1.0f) {
+    output.clear();
 
     const auto alpha = *std::max_element(cbegin(input), cend(input));
     auto denom = 0.0f;
@@ -963,8 +1364,6 @@ std::vector<float> softmax(const std::vector<float>& input,
     for (auto& out : output) {
         out /= denom;
     }
-
-    return output;
 }
 
 std::pair<float,float> sigmoid(float alpha, float beta, float bonus) {
@@ -987,10 +1386,9 @@ bool Network::probe_cache(const GameState* const state,
         return true;
     }
     // If we are not generating a self-play game, try to find
-    // symmetries if we are in the early opening.
-    if (!cfg_noise && !cfg_random_cnt
-        && state->get_movenum()
-           < (state->get_timecontrol().opening_moves(BOARD_SIZE) / 2)) {
+    // symmetries.  The symmetric hashes are kept up to date by the
+    // board, so this is cheap enough for the whole game.
+    if (!cfg_noise && !cfg_random_cnt) {
         for (auto sym = 0; sym < Network::NUM_SYMMETRIES; ++sym) {
             if (sym == Network::IDENTITY_SYMMETRY) {
                 continue;
@@ -1053,20 +1451,18 @@ Network::Netresult Network::get_output(const GameState* const state,
         assert(symmetry == -1);
         const auto rand_sym = Random::get_Rng().randfix<NUM_SYMMETRIES>();
         result = get_output_internal(state, rand_sym);
-#ifdef USE_OPENCL_SELFCHECK
         // Both implementations are available, self-check the OpenCL driver by
         // running both with a probability of 1/2000.
         // selfcheck is done here because this is the only place NN
         // evaluation is done on actual gameplay.
+        // With --cpu-selfcheck every int8 evaluation is checked.
         if (m_forward_cpu != nullptr
-            && (force_selfcheck || Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0)
+            && (force_selfcheck || m_cpu_selfcheck
+                || Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0)
         ) {
             auto result_ref = get_output_internal(state, rand_sym, true);
             compare_net_outputs(result, result_ref);
         }
-#else
-        (void)force_selfcheck;
-#endif
     }
 
     // v2 format (ELF Open Go) returns black value, not stm
@@ -1088,6 +1484,100 @@ Network::Netresult Network::get_output(const GameState* const state,
     return result;
 }
 
+std::vector<Network::Netresult> Network::get_outputs(
+    const std::vector<const GameState*>& states,
+    const bool read_cache, const bool write_cache) {
+    auto results = std::vector<Netresult>(states.size());
+    auto pending = std::vector<size_t>{};
+    // Several paths of a prefetch can end on the same position, which is
+    // evaluated once: (index in states, index in pending)
+    auto copies = std::vector<std::pair<size_t, size_t>>{};
+    for (auto i = size_t{0}; i < states.size(); i++) {
+        if (states[i]->board.get_boardsize() != BOARD_SIZE) {
+            continue;
+        }
+        if (read_cache && probe_cache(states[i], results[i])) {
+            continue;
+        }
+        const auto hash = states[i]->board.get_hash();
+        const auto same = std::find_if(
+            begin(pending), end(pending),
+            [&](size_t j) { return states[j]->board.get_hash() == hash; });
+        if (same != end(pending)) {
+            copies.emplace_back(i, same - begin(pending));
+            continue;
+        }
+        pending.emplace_back(i);
+    }
+    if (pending.empty()) {
+        return results;
+    }
+
+    const auto include_color = (0 == m_input_planes % 2);
+    auto& context = output_context();
+    auto& inputs = context.batch_input;
+    auto& policies = context.batch_policy;
+    auto& vals = context.batch_val;
+    auto& vbes = context.batch_vbe;
+    inputs.resize(pending.size());
+    policies.resize(pending.size());
+    vals.resize(pending.size());
+    vbes.resize(pending.size());
+
+    auto symmetries = std::vector<int>(pending.size());
+    for (auto k = size_t{0}; k < pending.size(); k++) {
+        symmetries[k] = Random::get_Rng().randfix<NUM_SYMMETRIES>();
+        gather_features(states[pending[k]], symmetries[k], inputs[k],
+                        m_input_moves, m_adv_features, m_chainlibs_features,
+                        m_chainsize_features, include_color);
+        policies[k].resize(m_policy_outputs * NUM_INTERSECTIONS);
+        vals[k].resize(m_val_outputs * NUM_INTERSECTIONS);
+        vbes[k].resize(m_vbe_outputs * NUM_INTERSECTIONS);
+    }
+
+    // All the positions are queued at once, so that the scheduler can
+    // put them in the same batch.
+    m_forward->forward_multiple(inputs, policies, vals, vbes);
+
+    for (auto k = size_t{0}; k < pending.size(); k++) {
+        const auto state = states[pending[k]];
+        auto& result = results[pending[k]];
+        std::swap(context.policy_data, policies[k]);
+        std::swap(context.val_data, vals[k]);
+        std::swap(context.vbe_data, vbes[k]);
+        result = process_output(state, symmetries[k], context);
+        // Same self-check as get_output() with RANDOM_SYMMETRY
+        if (m_forward_cpu != nullptr
+            && (m_cpu_selfcheck
+                || Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0)
+        ) {
+            auto result_ref = get_output_internal(state, symmetries[k], true);
+            compare_net_outputs(result, result_ref);
+        }
+
+        if (m_value_head_not_stm) {
+            if (state->board.get_to_move() == FastBoard::WHITE) {
+                result.value = 1.0f - result.value;
+            }
+        }
+
+        if (write_cache) {
+            m_nncache.insert(state->board.get_hash(), result);
+        }
+    }
+    for (const auto& copy : copies) {
+        results[copy.first] = results[pending[copy.second]];
+    }
+
+    return results;
+}
+
+Network::OutputContext& Network::output_context() {
+    // Each thread reuses its own buffers for all the evaluations
+    static thread_local OutputContext context;
+    return context;
+}
+
 Network::Netresult Network::get_output_internal(
     const GameState* const state, const int symmetry, bool selfcheck) {
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
@@ -1098,23 +1588,34 @@ Network::Netresult Network::get_output_internal(
     // color of the current player is encoded in the last two planes
     const auto include_color = (0 == m_input_planes % 2);
 
+    auto& context = output_context();
+    auto& input_data = context.input_data;
+    auto& policy_data = context.policy_data;
+    auto& val_data = context.val_data;
+    auto& vbe_data = context.vbe_data;
+
     //    myprintf("get_output_internal() -> m_chainlibs_features=%d\n", m_chainlibs_features);
-    const auto input_data = gather_features(state, symmetry, m_input_moves,
-                                            m_adv_features, m_chainlibs_features,
-                                            m_chainsize_features, include_color);
-    std::vector<float> policy_data(m_policy_outputs * width * height);
-    std::vector<float> val_data(m_val_outputs * width * height);
-    std::vector<float> vbe_data(m_vbe_outputs * width * height);
-#ifdef USE_OPENCL_SELFCHECK
+    gather_features(state, symmetry, input_data, m_input_moves,
+                    m_adv_features, m_chainlibs_features,
+                    m_chainsize_features, include_color);
+    policy_data.resize(m_policy_outputs * width * height);
+    val_data.resize(m_val_outputs * width * height);
+    vbe_data.resize(m_vbe_outputs * width * height);
     if (selfcheck) {
         m_forward_cpu->forward(input_data, policy_data, val_data, vbe_data);
     } else {
         m_forward->forward(input_data, policy_data, val_data, vbe_data);
     }
-#else
-    m_forward->forward(input_data, policy_data, val_data, vbe_data);
-    (void) selfcheck;
-#endif
+
+    return process_output(state, symmetry, context);
+}
+
+Network::Netresult Network::process_output(const GameState* const state,
+                                           const int symmetry,
+                                           OutputContext& context) {
+    auto& policy_data = context.policy_data;
+    auto& val_data = context.val_data;
+    auto& vbe_data = context.vbe_data;
 
     // Get the moves
     batchnorm<NUM_INTERSECTIONS>(m_policy_outputs, policy_data,
@@ -1124,29 +1625,26 @@ Network::Netresult Network::get_output_internal(
         float komi = state->get_komi();
         komi *= ( state->get_to_move() == FastBoard::BLACK ? -1.0 : 1.0 );
         policy_data.push_back(komi);
-        const auto kp1 =
-            innerproduct<true>(policy_data, m_kp1_pol_w, m_kp1_pol_b);
-        const auto kp2 =
-            innerproduct<true>(kp1, m_kp2_pol_w, m_kp2_pol_b);
+        innerproduct<true>(policy_data, m_kp1_pol_w, m_kp1_pol_b, context.kp1);
+        innerproduct<true>(context.kp1, m_kp2_pol_w, m_kp2_pol_b, context.kp2);
         policy_data.pop_back();
-        for (auto & i : kp2) {
+        for (auto & i : context.kp2) {
             policy_data.push_back(i);
         }
     }
 
-    const auto policy_out =
-        innerproduct<false>(
-            policy_data, m_ip_pol_w, m_ip_pol_b);
-    const auto outputs = softmax(policy_out, cfg_softmax_temp);
+    auto& policy_out = context.policy_out;
+    auto& outputs = context.outputs;
+    innerproduct<false>(policy_data, m_ip_pol_w, m_ip_pol_b, policy_out);
+    softmax(policy_out, outputs, cfg_softmax_temp);
 
     // Now get the value
     batchnorm<NUM_INTERSECTIONS>(m_val_outputs, val_data,
         m_bn_val_w1.data(), m_bn_val_w2.data());
-    const auto val_channels =
-        innerproduct<true>(
-            val_data, m_ip1_val_w, m_ip1_val_b);
-    const auto val_output =
-        innerproduct<false>(val_channels, m_ip2_val_w, m_ip2_val_b);
+    auto& val_channels = context.val_channels;
+    auto& val_output = context.val_output;
+    innerproduct<true>(val_data, m_ip1_val_w, m_ip1_val_b, val_channels);
+    innerproduct<false>(val_channels, m_ip2_val_w, m_ip2_val_b, val_output);
 
     Netresult result;
 
@@ -1154,28 +1652,28 @@ Network::Netresult Network::get_output_internal(
         // If double head value, also get beta
         batchnorm<NUM_INTERSECTIONS>(m_vbe_outputs, vbe_data,
                     m_bn_vbe_w1.data(), m_bn_vbe_w2.data());
-        const auto vbe_channels =
-            innerproduct<true>(vbe_data, m_ip1_vbe_w, m_ip1_vbe_b);
-        const auto vbe_output =
-            innerproduct<false>(vbe_channels, m_ip2_vbe_w, m_ip2_vbe_b);
+        auto& vbe_channels = context.vbe_channels;
+        auto& vbe_output = context.vbe_output;
+        innerproduct<true>(vbe_data, m_ip1_vbe_w, m_ip1_vbe_b, vbe_channels);
+        innerproduct<false>(vbe_channels, m_ip2_vbe_w, m_ip2_vbe_b, vbe_output);
 
         result.value = 0.5f;
         result.alpha = val_output[0];
         result.beta = std::exp(vbe_output[0]) * 10.0f / NUM_INTERSECTIONS;
         result.is_sai = true;
     } else if (m_value_head_type==DOUBLE_Y) {
-        const auto vbe_channels =
-            innerproduct<true>(val_data, m_ip1_vbe_w, m_ip1_vbe_b);
-        const auto vbe_output =
-            innerproduct<false>(vbe_channels, m_ip2_vbe_w, m_ip2_vbe_b);
+        auto& vbe_channels = context.vbe_channels;
+        auto& vbe_output = context.vbe_output;
+        innerproduct<true>(val_data, m_ip1_vbe_w, m_ip1_vbe_b, vbe_channels);
+        innerproduct<false>(vbe_channels, m_ip2_vbe_w, m_ip2_vbe_b, vbe_output);
 
         result.value = 0.5f;
         result.alpha = val_output[0];
         result.beta = std::exp(vbe_output[0]) * 10.0f / NUM_INTERSECTIONS;
         result.is_sai = true;
     } else if (m_value_head_type==DOUBLE_T) {
-        const auto vbe_output =
-            innerproduct<false>(val_channels, m_ip2_vbe_w, m_ip2_vbe_b);
+        auto& vbe_output = context.vbe_output;
+        innerproduct<false>(val_channels, m_ip2_vbe_w, m_ip2_vbe_b, vbe_output);
         result.value = 0.5f;
         result.alpha = val_output[0];
         result.beta = std::exp(vbe_output[0]) * 10.0f / NUM_INTERSECTIONS;
@@ -1210,6 +1708,14 @@ Network::Netresult_extended Network::get_extended(const FastState& state, const
     const auto winrate = sigmoid(alpha,  beta, state.board.black_to_move() ? -komi : komi);
     const auto alpkt = (state.board.black_to_move() ? alpha : -alpha) - komi;
 
+    const auto pi = sigmoid(alpkt, beta, 0.0f);
+    const auto agent = get_agent_eval(alpkt, beta);
+
+    return { winrate.first, alpkt, pi.first,
+             agent.eval_bonus, agent.eval_base, agent.agent_eval };
+}
+
+Network::AgentEval Network::get_agent_eval(const float alpkt, const float beta) {
     const auto pi = sigmoid(alpkt, beta, 0.0f);
     // if pi is near to 1, this is much more precise than 1-pi
     //    const auto one_m_pi = sigmoid(-alpkt, beta, 0.0f);
@@ -1230,7 +1736,19 @@ Network::Netresult_extended Network::get_extended(const FastState& state, const
 
     const auto agent_eval = Utils::sigmoid_interval_avg(alpkt, beta, eval_base, eval_bonus);
 
-    return { winrate.first, alpkt, pi.first, eval_bonus, eval_base, agent_eval };
+    return { eval_bonus, eval_base, agent_eval };
+}
+
+std::vector<float> Network::get_komi_winrates(const float alpkt,
+                                              const float beta,
+                                              const float komi,
+                                              const std::vector<float>& komis) {
+    auto winrates = std::vector<float>(komis.size());
+    for (auto i = size_t{0}; i < komis.size(); i++) {
+        // alpkt is black's lead once komi is paid
+        winrates[i] = sigmoid(alpkt, beta, komi - komis[i]).first;
+    }
+    return winrates;
 }
 
 
@@ -1321,16 +1839,13 @@ void Network::fill_input_plane_pair(const FullBoard& board,
                                     std::vector<float>::iterator black,
                                     std::vector<float>::iterator white,
                                     const int symmetry) {
-    for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        const auto x = sym_idx % BOARD_SIZE;
-        const auto y = sym_idx / BOARD_SIZE;
-        const auto color = board.get_state(x, y);
-        if (color == FastBoard::BLACK) {
-            black[idx] = float(true);
-        } else if (color == FastBoard::WHITE) {
-            white[idx] = float(true);
-        }
+    // The planes are already zeroed, only visit the stones.
+    const auto& board_idx = symmetry_board_idx_table[symmetry];
+    for (const auto color : {FastBoard::BLACK, FastBoard::WHITE}) {
+        const auto plane = (color == FastBoard::BLACK ? black : white);
+        board.get_stone_bits(color).for_each([&](const int idx) {
+            plane[board_idx[idx]] = float(true);
+        });
     }
 }
 
@@ -1338,16 +1853,16 @@ void Network::fill_input_plane_advfeat(std::shared_ptr<const KoState> const stat
                                        std::vector<float>::iterator legal,
                                        std::vector<float>::iterator atari,
                                        const int symmetry) {
-    for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        const auto x = sym_idx % BOARD_SIZE;
-        const auto y = sym_idx / BOARD_SIZE;
-        const auto vertex = state->board.get_vertex(x,y);
-        const auto tomove = state->get_to_move();
-        const auto is_legal = state->is_move_legal(tomove, vertex);
-        legal[idx] = !is_legal;
-        atari[idx] = is_legal && (1 == state->board.liberties_to_capture(vertex));
-    }
+    // The legal plane marks the illegal moves, the atari one is zeroed.
+    std::fill(legal, legal + NUM_INTERSECTIONS, float(true));
+    const auto& board_idx = symmetry_board_idx_table[symmetry];
+    const auto tomove = state->get_to_move();
+    state->get_legal_bits(tomove).for_each([&](const int idx) {
+        const auto vertex = state->board.get_vertex(idx);
+        legal[board_idx[idx]] = float(false);
+        atari[board_idx[idx]] =
+            float(1 == state->board.liberties_to_capture(vertex));
+    });
 }
 
 void Network::fill_input_plane_chainlibsfeat(std::shared_ptr<const KoState> const state,
@@ -1401,6 +1916,20 @@ std::vector<float> Network::gather_features(const GameState* const state,
                                             const bool chainlibs_features,
                                             const bool chainsize_features,
                                             const bool include_color) {
+    auto input_data = std::vector<float>{};
+    gather_features(state, symmetry, input_data, input_moves, adv_features,
+                    chainlibs_features, chainsize_features, include_color);
+    return input_data;
+}
+
+void Network::gather_features(const GameState* const state,
+                              const int symmetry,
+                              std::vector<float>& input_data,
+                              const int input_moves,
+                              const bool adv_features,
+                              const bool chainlibs_features,
+                              const bool chainsize_features,
+                              const bool include_color) {
     //    myprintf("gather_features() sym=%d, moves=%d, adv_f=%d, ch_lib_f=%d, incl_col=%d\n",
     //             symmetry, input_moves, adv_features, chainlibs_features, include_color);
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
@@ -1428,7 +1957,7 @@ std::vector<float> Network::gather_features(const GameState* const state,
     const auto input_planes = moves_planes + (include_color ? 2 : 1);
     //    myprintf("input_planes=%d\n", input_planes);
 
-    auto input_data = std::vector<float>(input_planes * NUM_INTERSECTIONS);
+    input_data.assign(input_planes * NUM_INTERSECTIONS, 0.0f);
 
     const auto current_it = begin(input_data);
     const auto opponent_it = current_it + plane_block;
@@ -1458,30 +1987,29 @@ std::vector<float> Network::gather_features(const GameState* const state,
     const auto moves = std::min<size_t>(state->get_movenum() + 1, input_moves);
     // Go back in time, fill history boards
     for (auto h = size_t{0}; h < moves; h++) {
+        const auto past_state = state->get_past_state(h);
         // collect white, black occupation planes
-        fill_input_plane_pair(state->get_past_state(h)->board,
+        fill_input_plane_pair(past_state->board,
                               black_it + h * NUM_INTERSECTIONS,
                               white_it + h * NUM_INTERSECTIONS,
                               symmetry);
         if (adv_features) {
-            fill_input_plane_advfeat(state->get_past_state(h),
+            fill_input_plane_advfeat(past_state,
                                      legal_it + h * NUM_INTERSECTIONS,
                                      atari_it + h * NUM_INTERSECTIONS,
                                      symmetry);
         }
         if (chainlibs_features) {
-            fill_input_plane_chainlibsfeat(state->get_past_state(h),
+            fill_input_plane_chainlibsfeat(past_state,
                                            chainlibs_it + h * NUM_INTERSECTIONS,
                                            symmetry);
         }
         if (chainsize_features) {
-            fill_input_plane_chainsizefeat(state->get_past_state(h),
+            fill_input_plane_chainsizefeat(past_state,
                                            chainsize_it + h * NUM_INTERSECTIONS,
                                            symmetry);
         }
     }
-
-    return input_data;
 }
 
 std::pair<int, int> Network::get_symmetry(const std::pair<int, int>& vertex,
@@ -1559,6 +2087,18 @@ size_t Network::get_estimated_cache_size() {
     return m_nncache.get_estimated_size();
 }
 
+size_t Network::get_cache_entry_size() const {
+    return m_nncache.get_entry_size();
+}
+
+size_t Network::get_cache_capacity() const {
+    return m_nncache.get_capacity();
+}
+
+std::vector<std::uint64_t> Network::get_batch_histogram() {
+    return m_forward->get_batch_histogram();
+}
+
 void Network::nncache_resize(int max_count) {
     return m_nncache.resize(max_count);
 }
@@ -1566,3 +2106,15 @@ void Network::nncache_resize(int max_count) {
 void Network::nncache_clear() {
     m_nncache.clear();
 }
+
+void Network::nncache_load() {
+    if (!cfg_nncache_file.empty()) {
+        m_nncache.load(cfg_nncache_file, m_nncache_key);
+    }
+}
+
+void Network::nncache_save() {
+    if (!cfg_nncache_file.empty()) {
+        m_nncache.save(cfg_nncache_file, m_nncache_key);
+    }
+}
@@ -35,6 +35,7 @@
 
 #include <deque>
 #include <array>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
@@ -52,9 +53,6 @@
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
 #endif
-#ifdef USE_OPENCL_SELFCHECK
-#include "SMP.h"
-#endif
 
 // Winograd filter transformation changes 3x3 filters to M + 3 - 1
 constexpr auto WINOGRAD_M = 4;
@@ -94,6 +92,13 @@ class Network
         float eval_base;
         float agent_eval;
     };
+    // Agent evaluation of a position, from its net alpkt and beta and the
+    // current cfg_lambda and cfg_mu
+    struct AgentEval {
+        float eval_bonus;
+        float eval_base;
+        float agent_eval;
+    };
 
     Netresult get_output(const GameState *const state,
                          const Ensemble ensemble,
@@ -101,6 +106,11 @@ class Network
                          const bool read_cache = true,
                          const bool write_cache = true,
                          const bool force_selfcheck = false);
+    // Evaluates several positions with random symmetries, queueing the
+    // cache misses together so that they can share a batch.
+    std::vector<Netresult> get_outputs(const std::vector<const GameState*>& states,
+                                       const bool read_cache = true,
+                                       const bool write_cache = true);
 
     static constexpr unsigned short int SINGLE = 1;
     static constexpr unsigned short int DOUBLE_V = 2;
@@ -117,12 +127,24 @@ class Network
 
     void initialize(int playouts, const std::string &weightsfile);
 
+    // Converts a weights file to the binary format, which loads
+    // without parsing or transforming the weights.
+    static int convert_weights_file(const std::string &infile,
+                                    const std::string &outfile);
+
     float benchmark_time(int centiseconds);
     void benchmark(const GameState *const state,
                    const int iterations = 1600);
     static void show_heatmap(const FastState *const state,
                              const Netresult &netres, const bool topmoves);
     static Netresult_extended get_extended(const FastState &, const Netresult &result);
+    static AgentEval get_agent_eval(float alpkt, float beta);
+    // Winrates for black at each of komis, of a position whose alpkt is
+    // alpkt with komi komi.  The SAI value head gives the whole curve
+    // from one evaluation.
+    static std::vector<float> get_komi_winrates(float alpkt, float beta,
+                                                float komi,
+                                                const std::vector<float>& komis);
     static std::vector<float> gather_features(const GameState *const state,
                                               const int symmetry,
                                               const int input_moves = DEFAULT_INPUT_MOVES,
@@ -130,14 +152,30 @@ class Network
                                               const bool chainlibs_features = false,
                                               const bool chainsize_features = false,
                                               const bool include_color = false);
+    // Same as above, but fills the given buffer instead of allocating
+    static void gather_features(const GameState *const state,
+                                const int symmetry,
+                                std::vector<float>& input_data,
+                                const int input_moves = DEFAULT_INPUT_MOVES,
+                                const bool adv_features = false,
+                                const bool chainlibs_features = false,
+                                const bool chainsize_features = false,
+                                const bool include_color = false);
     static std::pair<int, int> get_symmetry(const std::pair<int, int> &vertex,
                                             const int symmetry,
                                             const int board_size = BOARD_SIZE);
 
     size_t get_estimated_size();
     size_t get_estimated_cache_size();
+    size_t get_cache_entry_size() const;
+    size_t get_cache_capacity() const;
+    // Batches run by the forward pipe since startup, by batch size.
+    std::vector<std::uint64_t> get_batch_histogram();
     void nncache_resize(int max_count);
     void nncache_clear();
+    // Warm start the cache from cfg_nncache_file, and save it there.
+    void nncache_load();
+    void nncache_save();
 
     int m_value_head_type = SINGLE;
     bool m_value_head_sai; // was is_multi_komi_net
@@ -159,8 +197,42 @@ class Network
     size_t m_value_head_rets = size_t{1};
 
   private:
+    // Scratch buffers of get_output_internal(). Each thread keeps its
+    // own, so that once they have grown to the size needed by the
+    // network evaluating a position doesn't allocate memory.
+    struct OutputContext {
+        std::vector<float> input_data;
+        std::vector<float> policy_data;
+        std::vector<float> val_data;
+        std::vector<float> vbe_data;
+        std::vector<float> kp1;
+        std::vector<float> kp2;
+        std::vector<float> policy_out;
+        std::vector<float> outputs;
+        std::vector<float> val_channels;
+        std::vector<float> val_output;
+        std::vector<float> vbe_channels;
+        std::vector<float> vbe_output;
+        // Buffers of get_outputs(), one per position
+        std::vector<std::vector<float>> batch_input;
+        std::vector<std::vector<float>> batch_policy;
+        std::vector<std::vector<float>> batch_val;
+        std::vector<std::vector<float>> batch_vbe;
+    };
+
     int load_v1_network(std::istream &wtfile, int format_version);
     int load_network_file(const std::string &filename);
+    void prepare_weights();
+
+    // Binary weights files, see Network.cpp for the layout
+    std::vector<std::uint32_t> binary_header_fields();
+    void set_binary_header_fields(const std::vector<std::uint32_t> &fields);
+    std::vector<std::vector<float>*> weight_tensors();
+    // Number of floats of each of weight_tensors(), as implied by the
+    // header fields.
+    std::vector<std::uint64_t> binary_tensor_sizes();
+    int load_binary_network(const std::string &filename);
+    int save_binary_network(const std::string &filename);
 
     static std::vector<float> winograd_transform_f(const std::vector<float> &f,
                                                    const int outputs, const int channels);
@@ -184,6 +256,9 @@ class Network
                                std::vector<float> &M, const int C, const int K);
     Netresult get_output_internal(const GameState *const state,
                                   const int symmetry, bool selfcheck = false);
+    Netresult process_output(const GameState *const state,
+                             const int symmetry, OutputContext &context);
+    static OutputContext &output_context();
     static void fill_input_plane_pair(const FullBoard &board,
                                       std::vector<float>::iterator black,
                                       std::vector<float>::iterator white,
@@ -205,13 +280,19 @@ class Network
 #ifdef USE_HALF
     void select_precision(int channels);
 #endif
+    // The pipe and precision the outputs are computed with.
+    std::string get_backend_name() const;
     std::unique_ptr<ForwardPipe> m_forward;
-#ifdef USE_OPENCL_SELFCHECK
     void compare_net_outputs(const Netresult &data, const Netresult &ref);
     std::unique_ptr<ForwardPipe> m_forward_cpu;
-#endif
-
-    NNCache m_nncache;
+    // m_forward_cpu is the reference of the int8 CPU pipe, checked
+    // on every evaluation rather than at random.
+    bool m_cpu_selfcheck{false};
+
+    // Sized in initialize(), don't preallocate the maximum here.
+    NNCache m_nncache{NNCache::MIN_CACHE_COUNT};
+    // Cache snapshots are only valid for the same network outputs.
+    std::string m_nncache_key;
 
     size_t estimated_size{0};
 
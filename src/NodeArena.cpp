@@ -0,0 +1,172 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "NodeArena.h"
+#include "GTP.h"
+#include "Utils.h"
+
+constexpr int NodeArena::INTERLEAVED;
+
+std::atomic<size_t> NodeArena::s_total_slab_bytes{0};
+
+static char* alloc_slab() {
+    void* p = nullptr;
+#ifdef _WIN32
+    p = _aligned_malloc(NodeArena::SLAB_SIZE, NodeArena::SLAB_SIZE);
+#else
+    if (posix_memalign(&p, NodeArena::SLAB_SIZE, NodeArena::SLAB_SIZE) != 0) {
+        p = nullptr;
+    }
+#endif
+    if (p == nullptr) {
+        Utils::myprintf("Out of memory allocating the search tree.\n");
+        exit(EXIT_FAILURE);
+    }
+    return static_cast<char*>(p);
+}
+
+static void free_slab(char* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+NodeArena::~NodeArena() {
+    clear();
+}
+
+size_t NodeArena::thread_slot() {
+    static std::atomic<size_t> next_slot{0};
+    thread_local auto slot = next_slot++ % SLOTS;
+    return slot;
+}
+
+char* NodeArena::new_slab(const bool interleaved) {
+    auto slab = alloc_slab();
+    auto header = reinterpret_cast<SlabHeader*>(slab);
+    header->arena = this;
+    if (interleaved) {
+        header->numa_node = INTERLEAVED;
+        SMP::interleave_memory(slab, SLAB_SIZE);
+    } else {
+        header->numa_node = SMP::get_numa_node();
+        if (cfg_numa) {
+            // The memory may come back from a slab freed by a thread of
+            // another node, first touch isn't enough.
+            SMP::bind_memory(slab, SLAB_SIZE, header->numa_node);
+        }
+    }
+
+    s_total_slab_bytes.fetch_add(SLAB_SIZE, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_slabs.emplace_back(slab);
+    return slab;
+}
+
+void* NodeArena::allocate(size_t bytes) {
+    return allocate(m_slots[thread_slot()], bytes, false);
+}
+
+void* NodeArena::allocate_interleaved(size_t bytes) {
+    return allocate(m_interleaved, bytes, true);
+}
+
+void* NodeArena::allocate(SlotState& slot, size_t bytes,
+                          const bool interleaved) {
+    constexpr auto header_size = round_size(sizeof(SlabHeader));
+    bytes = round_size(bytes);
+    assert(bytes <= SLAB_SIZE - header_size);
+
+    SMP::Lock lock(slot.mutex);
+    if (slot.cur == nullptr
+        || static_cast<size_t>(slot.end - slot.cur) < bytes) {
+        auto slab = new_slab(interleaved);
+        slot.cur = slab + header_size;
+        slot.end = slab + SLAB_SIZE;
+    }
+    auto p = slot.cur;
+    slot.cur += bytes;
+    slot.used += bytes;
+    return p;
+}
+
+void NodeArena::start_generation() {
+    // Only called between searches, with no thread allocating.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto retire = [this](SlotState& slot) {
+        m_generation_bytes += slot.used;
+        slot.cur = slot.end = nullptr;
+        slot.used = 0;
+    };
+    for (auto& slot : m_slots) {
+        retire(slot);
+    }
+    retire(m_interleaved);
+    m_old_slabs.insert(end(m_old_slabs), begin(m_slabs), end(m_slabs));
+    m_slabs.clear();
+    m_old_bytes += m_generation_bytes;
+    m_generation_bytes = 0;
+}
+
+void NodeArena::release_previous_generations() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto slab : m_old_slabs) {
+        free_slab(slab);
+    }
+    s_total_slab_bytes -= m_old_slabs.size() * SLAB_SIZE;
+    m_old_slabs.clear();
+    m_old_bytes = 0;
+}
+
+void NodeArena::clear() {
+    start_generation();
+    release_previous_generations();
+}
+
+size_t NodeArena::get_allocated() const {
+    auto bytes = m_generation_bytes + m_old_bytes + m_interleaved.used;
+    for (const auto& slot : m_slots) {
+        bytes += slot.used;
+    }
+    return bytes;
+}
+
+size_t NodeArena::get_total_slab_bytes() {
+    return s_total_slab_bytes.load();
+}
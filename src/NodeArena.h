@@ -0,0 +1,259 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef NODEARENA_H_INCLUDED
+#define NODEARENA_H_INCLUDED
+
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "SMP.h"
+
+// Slab allocator for the search tree.  Every search owns one arena, and
+// all its UCTNodes and children arrays are carved out of fixed size slabs
+// by per-thread bump pointers.  Nothing is ever freed individually: when
+// the root advances, the subtree we keep is copied into a new generation
+// of slabs and the previous generations are released in one go, without
+// walking the discarded nodes.
+class NodeArena {
+public:
+    // Slabs are aligned to their size, so the arena owning any object
+    // can be found from its address.
+    static constexpr size_t SLAB_SIZE = 256 * 1024;
+    static constexpr size_t ALIGNMENT = alignof(std::max_align_t);
+
+    NodeArena() = default;
+    ~NodeArena();
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    void* allocate(size_t bytes);
+    // Memory spread over all the NUMA nodes, for data every thread
+    // reads.  It comes from slabs of its own, so that the interleaving
+    // policy doesn't apply to any other object.
+    void* allocate_interleaved(size_t bytes);
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Objects allocated from now on go to a new generation of slabs.
+    void start_generation();
+    // Free the slabs of all the generations before the current one.
+    void release_previous_generations();
+    void clear();
+
+    // Bytes handed out by this arena, including the objects that are
+    // no longer reachable but still wait for their generation to go.
+    size_t get_allocated() const;
+
+    // Bytes of the slabs held by all the arenas, including the parts
+    // not handed out yet.  This is what the tree memory limit counts.
+    static size_t get_total_slab_bytes();
+
+    static NodeArena& owner(const void* p) {
+        auto base = reinterpret_cast<std::uintptr_t>(p) & ~(SLAB_SIZE - 1);
+        auto header = reinterpret_cast<const SlabHeader*>(base);
+        assert(header->arena != nullptr);
+        return *header->arena;
+    }
+
+    // NUMA node of the thread that allocated the slab holding p.  With
+    // cfg_numa the slab is also placed on that node.  INTERLEAVED for
+    // the memory of allocate_interleaved().
+    static constexpr int INTERLEAVED = -1;
+    static int numa_node(const void* p) {
+        auto base = reinterpret_cast<std::uintptr_t>(p) & ~(SLAB_SIZE - 1);
+        return reinterpret_cast<const SlabHeader*>(base)->numa_node;
+    }
+
+    static constexpr size_t round_size(size_t bytes) {
+        return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+private:
+    struct SlabHeader {
+        NodeArena* arena;
+        int numa_node;
+    };
+
+    // Threads hash to a slot and bump allocate from its slab. There are
+    // more slots than search threads in practice, so the spinlock is
+    // nearly never contended.
+    static constexpr size_t SLOTS = 64;
+    struct SlotState {
+        SMP::Mutex mutex;
+        char* cur{nullptr};
+        char* end{nullptr};
+        size_t used{0};
+    };
+    // Padded rather than alignas(64): the arena lives inside UCTSearch,
+    // and C++14 operator new does not honour extended alignment.
+    static constexpr size_t CACHE_LINE = 64;
+    struct Slot : SlotState {
+        char padding[CACHE_LINE - sizeof(SlotState)];
+    };
+
+    static size_t thread_slot();
+    void* allocate(SlotState& slot, size_t bytes, bool interleaved);
+    char* new_slab(bool interleaved);
+
+    std::array<Slot, SLOTS> m_slots;
+    SlotState m_interleaved;
+    std::mutex m_mutex;
+    std::vector<char*> m_slabs;
+    std::vector<char*> m_old_slabs;
+    size_t m_generation_bytes{0};
+    size_t m_old_bytes{0};
+
+    static std::atomic<size_t> s_total_slab_bytes;
+};
+
+// Minimal std::vector replacement for the children of a UCTNode.  The
+// storage comes from the arena holding the vector itself, and is given
+// back only when the whole generation is released.
+template <typename T>
+class ArenaVector {
+public:
+    using iterator = T*;
+    using const_iterator = const T*;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    ArenaVector() = default;
+    ~ArenaVector() {
+        clear();
+    }
+    ArenaVector(const ArenaVector&) = delete;
+    ArenaVector& operator=(const ArenaVector&) = delete;
+
+    void reserve(size_t n) {
+        if (n <= m_capacity) {
+            return;
+        }
+        auto& arena = NodeArena::owner(this);
+        move_storage(arena.allocate(n * sizeof(T)), n);
+    }
+
+    // Moves the elements to storage for n of them, which must come
+    // from the arena holding the vector.
+    void move_storage(void* storage, size_t n) {
+        assert(n >= m_size);
+        auto data = static_cast<T*>(storage);
+        for (auto i = size_t{0}; i < m_size; i++) {
+            new (&data[i]) T(std::move(m_data[i]));
+            m_data[i].~T();
+        }
+        m_data = data;
+        m_capacity = static_cast<std::uint32_t>(n);
+    }
+
+    template <typename... Args>
+    void emplace_back(Args&&... args) {
+        if (m_size == m_capacity) {
+            reserve(m_capacity ? 2 * m_capacity : 1);
+        }
+        new (&m_data[m_size]) T(std::forward<Args>(args)...);
+        m_size++;
+    }
+
+    void push_back(const T& value) {
+        emplace_back(value);
+    }
+
+    iterator erase(iterator first, iterator last) {
+        auto new_end = std::move(last, end(), first);
+        for (auto it = new_end; it != end(); ++it) {
+            it->~T();
+        }
+        m_size = static_cast<std::uint32_t>(new_end - begin());
+        return first;
+    }
+
+    void clear() {
+        erase(begin(), end());
+    }
+
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_capacity; }
+    bool empty() const { return m_size == 0; }
+
+    T& operator[](size_t i) { return m_data[i]; }
+    const T& operator[](size_t i) const { return m_data[i]; }
+    T& front() { return m_data[0]; }
+    const T& front() const { return m_data[0]; }
+
+    iterator begin() { return m_data; }
+    iterator end() { return m_data + m_size; }
+    const_iterator begin() const { return m_data; }
+    const_iterator end() const { return m_data + m_size; }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+private:
+    T* m_data{nullptr};
+    std::uint32_t m_size{0};
+    std::uint32_t m_capacity{0};
+};
+
+// Found by argument dependent lookup like their std:: counterparts are
+// for std::vector, so begin(m_children) keeps working.
+template <typename T>
+T* begin(ArenaVector<T>& v) { return v.begin(); }
+template <typename T>
+T* end(ArenaVector<T>& v) { return v.end(); }
+template <typename T>
+const T* begin(const ArenaVector<T>& v) { return v.begin(); }
+template <typename T>
+const T* end(const ArenaVector<T>& v) { return v.end(); }
+template <typename T>
+std::reverse_iterator<T*> rbegin(ArenaVector<T>& v) { return v.rbegin(); }
+template <typename T>
+std::reverse_iterator<T*> rend(ArenaVector<T>& v) { return v.rend(); }
+
+#endif
@@ -32,8 +32,6 @@
 
 #ifdef USE_OPENCL
 
-#include <tuple>
-
 #include "GTP.h"
 #include "Random.h"
 #include "Network.h"
@@ -90,7 +88,8 @@ static std::vector<T> zeropad_U(const std::vector<float>& U,
 }
 
 template <typename net_t>
-OpenCLScheduler<net_t>::OpenCLScheduler() {
+OpenCLScheduler<net_t>::OpenCLScheduler()
+    : BatchScheduler(cfg_batch_size, cfg_batch_latency) {
     // multi-gpu?
     auto gpus = cfg_gpus;
 
@@ -118,16 +117,17 @@ void OpenCLScheduler<net_t>::initialize(const int channels) {
     // Launch the worker threads.  Minimum 1 worker per GPU, but use enough threads
     // so that we can at least concurrently schedule something to the GPU.
     auto num_worker_threads = cfg_num_threads / cfg_batch_size / (m_opencl.size() + 1) + 1;
-    auto gnum = 0;
+    auto gnum = size_t{0};
     for (auto & opencl : m_opencl) {
         opencl->initialize(channels, cfg_batch_size);
 
         for (auto i = unsigned{0}; i < num_worker_threads; i++) {
-            auto t = std::thread(&OpenCLScheduler<net_t>::batch_worker, this, gnum);
-            m_worker_threads.push_back(std::move(t));
+            m_worker_gpu.emplace_back(gnum);
         }
         gnum++;
     }
+    m_contexts.resize(m_worker_gpu.size());
+    start_workers(m_worker_gpu.size());
 
     // Exit immediately after tuning.  We should exit here because we skipped
     // initializing rest of the kernels due to some NVIDIA drivers crashing.
@@ -138,14 +138,7 @@ void OpenCLScheduler<net_t>::initialize(const int channels) {
 
 template <typename net_t>
 OpenCLScheduler<net_t>::~OpenCLScheduler() {
-    {
-        std::unique_lock<std::mutex> lk(m_mutex);
-        m_running = false;
-    }
-    m_cv.notify_all();
-    for (auto & x : m_worker_threads) {
-        x.join();
-    }
+    stop_workers();
 }
 
 template<typename net_t>
@@ -270,167 +263,15 @@ void OpenCLScheduler<net_t>::push_weights(
 }
 
 template <typename net_t>
-void OpenCLScheduler<net_t>::forward(const std::vector<float>& input,
-                                     std::vector<float>& output_pol,
-                                     std::vector<float>& output_val,
-                                     std::vector<float>& output_vbe) {
-    auto entry = std::make_shared<ForwardQueueEntry>(input, output_pol, output_val, output_vbe);
-    std::unique_lock<std::mutex> lk(entry->mutex);
-    {
-        std::unique_lock<std::mutex> lk(m_mutex);
-        m_forward_queue.push_back(entry);
-
-        if (m_single_eval_in_progress.load()) {
-            m_waittime += 2;
-        }
-    }
-    m_cv.notify_one();
-    entry->cv.wait(lk);
-}
-
-#ifndef NDEBUG
-struct batch_stats_t batch_stats;
-#endif
-
-template <typename net_t>
-void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
-    OpenCLContext context;
-
-    // batch scheduling heuristic.
-    // Returns the batch picked up from the queue (m_forward_queue)
-    // 1) Wait for m_waittime milliseconds for full batch
-    // 2) if we don't have a full batch then just do a single eval
-    //
-    // The purpose of m_waittime is to prevent the system from deadlocking
-    // because we were waiting for a job too long, while the job is never
-    // going to come due to a control dependency (e.g., evals stuck on a
-    // critical path).  To do so:
-    //
-    // 1) if we couldn't form a batch after waiting m_waittime ms, it means
-    // that we hit the critical path and should do scalar evals.
-    // Wait 1ms shorter next time.
-    //
-    // 2) if we picked up a single eval, but were getting additional evals
-    // while that single eval was being processed, it means that we made
-    // the wrong decision.  Wait 2ms longer next time.
-
-    auto pickup_task = [this] () {
-        std::list<std::shared_ptr<ForwardQueueEntry>> inputs;
-        size_t count = 0;
-
-        std::unique_lock<std::mutex> lk(m_mutex);
-        while (true) {
-            if (!m_running) return inputs;
-
-            count = m_forward_queue.size();
-            if (count >= cfg_batch_size) {
-                count = cfg_batch_size;
-                break;
-            }
-
-            bool timeout = !m_cv.wait_for(
-                lk,
-                std::chrono::milliseconds(m_waittime),
-                [this] () {
-                    return !m_running || m_forward_queue.size() >= cfg_batch_size;
-                }
-            );
-
-            if (!m_forward_queue.empty()) {
-                if (timeout && m_single_eval_in_progress.exchange(true) == false) {
-                    // Waited long enough but couldn't form a batch.
-                    // Check if there is any other single eval in progress, and if not,
-                    // do one from this thread.
-                    if (m_waittime > 1) {
-                        m_waittime--;
-                    }
-                    count = 1;
-                    break;
-                }
-            }
-        }
-        // Move 'count' evals from shared queue to local list.
-        auto end = begin(m_forward_queue);
-        std::advance(end, count);
-        std::move(begin(m_forward_queue), end, std::back_inserter(inputs));
-        m_forward_queue.erase(begin(m_forward_queue), end);
-
-        return inputs;
-    };
-
-    auto batch_input = std::vector<float>();
-    auto batch_output_pol = std::vector<float>();
-    auto batch_output_val = std::vector<float>();
-    auto batch_output_vbe = std::vector<float>();
-
-    while (true) {
-        auto inputs = pickup_task();
-        auto count = inputs.size();
-
-    size_t input_planes;
-    size_t policy_outputs;
-    size_t val_outputs;
-    size_t vbe_outputs;
-
-    std::tie(input_planes, policy_outputs, val_outputs, vbe_outputs)
-        = m_networks[gnum]->get_output_sizes();
-
-    const auto in_size = input_planes * NUM_INTERSECTIONS;
-    const auto out_pol_size = policy_outputs * NUM_INTERSECTIONS;
-    const auto out_val_size = val_outputs * NUM_INTERSECTIONS;
-    const auto out_vbe_size = vbe_outputs * NUM_INTERSECTIONS;
-
-        if (!m_running) {
-            return;
-        }
-
-#ifndef NDEBUG
-        if (count == 1) {
-            batch_stats.single_evals++;
-        } else {
-            batch_stats.batch_evals++;
-        }
-#endif
-
-        // prepare input for forward() call
-        batch_input.resize(in_size * count);
-        batch_output_pol.resize(out_pol_size * count);
-        batch_output_val.resize(out_val_size * count);
-        batch_output_vbe.resize(out_vbe_size * count);
-
-        auto index = size_t{0};
-        for (auto & x : inputs) {
-            std::unique_lock<std::mutex> lk(x->mutex);
-            std::copy(begin(x->in), end(x->in), begin(batch_input) + in_size * index);
-            index++;
-        }
-
-        // run the NN evaluation
-        m_networks[gnum]->forward(
-            batch_input, batch_output_pol, batch_output_val, batch_output_vbe, context, count);
-
-        // Get output and copy back
-        index = 0;
-        for (auto & x : inputs) {
-            std::copy(begin(batch_output_pol) + out_pol_size * index,
-                      begin(batch_output_pol) + out_pol_size * (index + 1),
-                      begin(x->out_p));
-            std::copy(begin(batch_output_val) + out_val_size * index,
-                      begin(batch_output_val) + out_val_size * (index + 1),
-                      begin(x->out_va));
-            if (out_vbe_size > 0) {
-                std::copy(begin(batch_output_vbe) + out_vbe_size * index,
-                          begin(batch_output_vbe) + out_vbe_size * (index + 1),
-                          begin(x->out_vb));
-            }
-            x->cv.notify_all();
-            index++;
-        }
-
-        if (count == 1) {
-            m_single_eval_in_progress = false;
-        }
-    }
+void OpenCLScheduler<net_t>::forward_batch(const size_t buffer,
+                                           const std::vector<float>& input,
+                                           std::vector<float>& output_pol,
+                                           std::vector<float>& output_val,
+                                           std::vector<float>& output_vbe,
+                                           const size_t batch_size) {
+    const auto worker = buffer / PIPELINE_DEPTH;
+    m_networks[m_worker_gpu[worker]]->forward(
+        input, output_pol, output_val, output_vbe, m_contexts[worker], batch_size);
 }
 
 template class OpenCLScheduler<float>;
@@ -148,6 +148,15 @@ void SHA256::final(unsigned char *digest)
     }
 }
 
+static std::string digest_to_hex(const unsigned char *digest)
+{
+    char buf[2*SHA256::DIGEST_SIZE+1];
+    buf[2*SHA256::DIGEST_SIZE] = 0;
+    for (unsigned int i = 0; i < SHA256::DIGEST_SIZE; i++)
+        sprintf(buf+i*2, "%02x", digest[i]);
+    return std::string(buf);
+}
+
 std::string SHA256::sha256(const std::string & input)
 {
     unsigned char digest[SHA256::DIGEST_SIZE];
@@ -158,9 +167,22 @@ std::string SHA256::sha256(const std::string & input)
     ctx.update( (unsigned char*)input.c_str(), input.length());
     ctx.final(digest);
 
-    char buf[2*SHA256::DIGEST_SIZE+1];
-    buf[2*SHA256::DIGEST_SIZE] = 0;
-    for (unsigned int i = 0; i < SHA256::DIGEST_SIZE; i++)
-        sprintf(buf+i*2, "%02x", digest[i]);
-    return std::string(buf);
+    return digest_to_hex(digest);
+}
+
+std::string SHA256::sha256_file(const std::string & filename)
+{
+    unsigned char digest[SHA256::DIGEST_SIZE];
+    memset(digest,0,SHA256::DIGEST_SIZE);
+
+    SHA256 ctx = SHA256();
+    ctx.init();
+    std::ifstream file(filename, std::ios::binary);
+    char buf[64 * 1024];
+    while (file.read(buf, sizeof(buf)) || file.gcount() > 0) {
+        ctx.update((unsigned char*)buf, file.gcount());
+    }
+    ctx.final(digest);
+
+    return digest_to_hex(digest);
 }
@@ -43,6 +43,8 @@ protected:
     static const unsigned int SHA224_256_BLOCK_SIZE = (512/8);
 public:
     static std::string sha256(const std::string & input);
+    // Digest of the contents of a file, read in chunks.
+    static std::string sha256_file(const std::string & filename);
     void init();
     void update(const unsigned char *message, unsigned int len);
     void final(unsigned char *digest);
@@ -31,7 +31,18 @@
 #include "SMP.h"
 
 #include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <thread>
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 SMP::Mutex::Mutex() {
     m_lock = false;
@@ -77,3 +88,153 @@ SMP::Lock::~Lock() {
 size_t SMP::get_num_cpus() {
     return std::thread::hardware_concurrency();
 }
+
+bool SMP::set_thread_affinity(const int cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+#ifdef __linux__
+// Parses a sysfs cpu list such as "0-3,8-11".
+static std::vector<int> parse_cpulist(const std::string& list) {
+    auto cpus = std::vector<int>{};
+    auto ranges = std::istringstream{list};
+    auto range = std::string{};
+    while (std::getline(ranges, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        const auto dash = range.find('-');
+        const auto first = std::stoi(range.substr(0, dash));
+        const auto last = dash == std::string::npos ?
+            first : std::stoi(range.substr(dash + 1));
+        for (auto cpu = first; cpu <= last; cpu++) {
+            cpus.emplace_back(cpu);
+        }
+    }
+    return cpus;
+}
+#endif
+
+static std::vector<SMP::NumaNode> find_numa_nodes() {
+    auto nodes = std::vector<SMP::NumaNode>{};
+#ifdef __linux__
+    // Node ids can have holes, look further than the last one found.
+    constexpr auto MAX_NODES = 64;
+    for (auto id = 0; id < MAX_NODES; id++) {
+        auto file = std::ifstream{"/sys/devices/system/node/node"
+                                  + std::to_string(id) + "/cpulist"};
+        auto list = std::string{};
+        if (!file || !std::getline(file, list)) {
+            continue;
+        }
+        auto cpus = parse_cpulist(list);
+        if (!cpus.empty()) {
+            nodes.emplace_back(SMP::NumaNode{id, std::move(cpus)});
+        }
+    }
+#endif
+    if (nodes.empty()) {
+        auto cpus = std::vector<int>{};
+        for (auto cpu = size_t{0}; cpu < SMP::get_num_cpus(); cpu++) {
+            cpus.emplace_back(static_cast<int>(cpu));
+        }
+        nodes.emplace_back(SMP::NumaNode{0, std::move(cpus)});
+    }
+    return nodes;
+}
+
+const std::vector<SMP::NumaNode>& SMP::get_numa_nodes() {
+    static const auto nodes = find_numa_nodes();
+    return nodes;
+}
+
+int SMP::get_numa_node() {
+#ifdef __linux__
+    static const auto node_of_cpu = [] {
+        auto table = std::vector<int>{};
+        for (const auto& node : get_numa_nodes()) {
+            for (const auto cpu : node.cpus) {
+                if (static_cast<size_t>(cpu) >= table.size()) {
+                    table.resize(cpu + 1, 0);
+                }
+                table[cpu] = node.id;
+            }
+        }
+        return table;
+    }();
+    const auto cpu = sched_getcpu();
+    if (cpu >= 0 && static_cast<size_t>(cpu) < node_of_cpu.size()) {
+        return node_of_cpu[cpu];
+    }
+#endif
+    return 0;
+}
+
+#ifdef __linux__
+static bool set_memory_policy(void* p, size_t bytes, int mode,
+                              const std::vector<int>& node_ids) {
+    constexpr auto BITS = 8 * sizeof(unsigned long);
+    auto mask = std::vector<unsigned long>(1);
+    for (const auto id : node_ids) {
+        if (static_cast<size_t>(id) >= mask.size() * BITS) {
+            mask.resize(id / BITS + 1);
+        }
+        mask[id / BITS] |= 1UL << (id % BITS);
+    }
+    // mbind works on whole pages. Only the pages entirely inside the
+    // range are changed: the others are shared with neighbouring
+    // allocations, whose placement must not change with ours.
+    const auto page = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto first = (reinterpret_cast<std::uintptr_t>(p)
+                        + page - 1) & ~(page - 1);
+    const auto last = (reinterpret_cast<std::uintptr_t>(p) + bytes)
+                      & ~(page - 1);
+    if (last <= first) {
+        return false;
+    }
+    return syscall(SYS_mbind, first, last - first, mode, mask.data(),
+                   mask.size() * BITS + 1, MPOL_MF_MOVE) == 0;
+}
+#endif
+
+bool SMP::bind_memory(void* p, size_t bytes, int node) {
+#ifdef __linux__
+    if (get_numa_nodes().size() < 2) {
+        return false;
+    }
+    return set_memory_policy(p, bytes, MPOL_PREFERRED, {node});
+#else
+    (void)p;
+    (void)bytes;
+    (void)node;
+    return false;
+#endif
+}
+
+bool SMP::interleave_memory(void* p, size_t bytes) {
+#ifdef __linux__
+    if (get_numa_nodes().size() < 2) {
+        return false;
+    }
+    auto ids = std::vector<int>{};
+    for (const auto& node : get_numa_nodes()) {
+        ids.emplace_back(node.id);
+    }
+    return set_memory_policy(p, bytes, MPOL_INTERLEAVE, ids);
+#else
+    (void)p;
+    (void)bytes;
+    return false;
+#endif
+}
@@ -35,9 +35,28 @@
 
 #include <cstddef>
 #include <atomic>
+#include <vector>
 
 namespace SMP {
     size_t get_num_cpus();
+    // Pins the calling thread to a logical cpu.  Returns false if that
+    // isn't possible or not supported on this platform.
+    bool set_thread_affinity(int cpu);
+
+    struct NumaNode {
+        int id;
+        std::vector<int> cpus;
+    };
+    // The NUMA nodes that have cpus.  Without NUMA information a single
+    // node 0 holds all the cpus.
+    const std::vector<NumaNode>& get_numa_nodes();
+    // Node of the cpu the calling thread is running on.
+    int get_numa_node();
+    // Moves the pages inside [p, p + bytes) to a node, or spreads them
+    // over all the nodes.  Pages only partly in the range are left alone.
+    // They return false where not supported or no page is inside.
+    bool bind_memory(void* p, size_t bytes, int node);
+    bool interleave_memory(void* p, size_t bytes);
 
     class Mutex {
     public:
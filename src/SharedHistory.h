@@ -0,0 +1,143 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef SHAREDHISTORY_H_INCLUDED
+#define SHAREDHISTORY_H_INCLUDED
+
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Append-only sequence whose copies share their common prefix.
+// The elements are kept in immutable chunks of CHUNK elements, linked
+// from the newest to the oldest, plus a tail of less than CHUNK
+// elements owned by each copy. Copying or appending costs O(CHUNK)
+// whatever the length, and recent elements are found quickly.
+template <typename T>
+class SharedHistory {
+public:
+    static constexpr size_t CHUNK = 16;
+
+    size_t size() const {
+        return m_frozen + m_tail_size;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const T& operator[](const size_t i) const {
+        assert(i < size());
+        if (i >= m_frozen) {
+            return m_tail[i - m_frozen];
+        }
+        auto chunk = m_chunks.get();
+        while (chunk->start > i) {
+            chunk = chunk->prev.get();
+        }
+        return chunk->items[i - chunk->start];
+    }
+
+    const T& back() const {
+        return (*this)[size() - 1];
+    }
+
+    void push_back(const T& value) {
+        m_tail[m_tail_size++] = value;
+        if (m_tail_size == CHUNK) {
+            auto chunk = std::make_shared<Chunk>();
+            chunk->prev = std::move(m_chunks);
+            chunk->start = m_frozen;
+            std::move(begin(m_tail), end(m_tail), begin(chunk->items));
+            m_chunks = std::move(chunk);
+            m_frozen += CHUNK;
+            m_tail_size = 0;
+        }
+    }
+
+    // Drop the elements from position n on.
+    void truncate(const size_t n) {
+        while (n < m_frozen) {
+            // Take the newest chunk back as the tail.
+            const auto chunk = m_chunks;
+            std::copy(begin(chunk->items), end(chunk->items), begin(m_tail));
+            m_frozen = chunk->start;
+            m_chunks = chunk->prev;
+            m_tail_size = CHUNK;
+        }
+        for (auto i = n - m_frozen; i < m_tail_size; i++) {
+            m_tail[i] = T{};
+        }
+        if (n < size()) {
+            m_tail_size = n - m_frozen;
+        }
+    }
+
+    void clear() {
+        m_chunks.reset();
+        m_frozen = 0;
+        m_tail.fill(T{});
+        m_tail_size = 0;
+    }
+
+    std::vector<T> to_vector() const {
+        auto out = std::vector<T>(size());
+        for (auto chunk = m_chunks.get(); chunk != nullptr;
+             chunk = chunk->prev.get()) {
+            std::copy(begin(chunk->items), end(chunk->items),
+                      begin(out) + chunk->start);
+        }
+        std::copy(begin(m_tail), begin(m_tail) + m_tail_size,
+                  begin(out) + m_frozen);
+        return out;
+    }
+
+private:
+    struct Chunk {
+        std::shared_ptr<const Chunk> prev;
+        size_t start;
+        std::array<T, CHUNK> items;
+    };
+
+    std::shared_ptr<const Chunk> m_chunks;
+    size_t m_frozen{0};
+    std::array<T, CHUNK> m_tail{};
+    size_t m_tail_size{0};
+};
+
+template <typename T>
+constexpr size_t SharedHistory<T>::CHUNK;
+
+#endif
@@ -26,63 +26,294 @@
     distribution.
 */
 
-#include <cstddef>
-#include <vector>
-#include <thread>
-#include <queue>
-#include <mutex>
+#include <atomic>
+#include <cassert>
 #include <condition_variable>
-#include <memory>
-#include <future>
+#include <cstddef>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "SMP.h"
 
 namespace Utils {
 
+// A void() callable.  Callables of up to INLINE_SIZE bytes, such as the
+// search workers, are stored in place, so that queueing them doesn't
+// allocate.  Larger ones are moved to the heap.
+class Task {
+public:
+    static constexpr std::size_t INLINE_SIZE = 48;
+
+    Task() = default;
+    template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) {
+        using Fn = typename std::decay<F>::type;
+        emplace(std::forward<F>(f), fits_inline<Fn>{});
+    }
+    Task(Task&& other) noexcept {
+        move_from(other);
+    }
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        reset();
+    }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+    void operator()() { m_ops->invoke(m_storage); }
+
+private:
+    struct Ops {
+        void (*invoke)(void*);
+        // Move constructs into the second storage and destroys the first
+        void (*move)(void*, void*);
+        void (*destroy)(void*);
+    };
+
+    template<class Fn>
+    using fits_inline = std::integral_constant<bool,
+        sizeof(Fn) <= INLINE_SIZE
+        && alignof(Fn) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible<Fn>::value>;
+
+    template<class Fn>
+    static const Ops* inline_ops() {
+        static const Ops ops{
+            [](void* p) { (*static_cast<Fn*>(p))(); },
+            [](void* from, void* to) {
+                new (to) Fn(std::move(*static_cast<Fn*>(from)));
+                static_cast<Fn*>(from)->~Fn();
+            },
+            [](void* p) { static_cast<Fn*>(p)->~Fn(); }
+        };
+        return &ops;
+    }
+
+    template<class Fn>
+    static const Ops* heap_ops() {
+        static const Ops ops{
+            [](void* p) { (**static_cast<Fn**>(p))(); },
+            [](void* from, void* to) {
+                *static_cast<Fn**>(to) = *static_cast<Fn**>(from);
+            },
+            [](void* p) { delete *static_cast<Fn**>(p); }
+        };
+        return &ops;
+    }
+
+    template<class F>
+    void emplace(F&& f, std::true_type) {
+        using Fn = typename std::decay<F>::type;
+        new (m_storage) Fn(std::forward<F>(f));
+        m_ops = inline_ops<Fn>();
+    }
+
+    template<class F>
+    void emplace(F&& f, std::false_type) {
+        using Fn = typename std::decay<F>::type;
+        *reinterpret_cast<Fn**>(m_storage) = new Fn(std::forward<F>(f));
+        m_ops = heap_ops<Fn>();
+    }
+
+    void move_from(Task& other) {
+        m_ops = other.m_ops;
+        if (m_ops) {
+            m_ops->move(other.m_storage, m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+    const Ops* m_ops{nullptr};
+};
+
+// Every worker has its own deque of tasks.  A worker takes the newest
+// task of its own deque and, when that is empty, steals the oldest task
+// of the others.  Tasks added by a worker go to its own deque, those
+// added by any other thread are dealt round robin.
 class ThreadPool {
 public:
     ThreadPool() = default;
     ~ThreadPool();
 
     // create worker threads.  This version has no initializers.
-    void initialize(std::size_t);
+    // If cpus is not empty, worker i is pinned to cpus[i % cpus.size()].
+    void initialize(std::size_t threads, const std::vector<int>& cpus = {});
 
     // add an extra thread.  The thread calls initializer() before doing anything,
     // so that the user can initialize per-thread data structures before doing work.
-    void add_thread(std::function<void()> initializer);
+    // If cpu is not negative, the thread is pinned to that logical cpu.
+    // All the threads must be added before the first task.
+    void add_thread(std::function<void()> initializer, int cpu = -1);
+    void add_task(Task task);
     template<class F, class... Args>
     auto add_task(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
+
+    // Index of the calling thread among the workers of this pool, or -1.
+    int get_worker_index() const;
 private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    struct CurrentWorker {
+        const ThreadPool* pool{nullptr};
+        int index{-1};
+    };
+    static CurrentWorker& current_worker();
+
+    void worker_loop(std::size_t index);
+    bool reserve_task();
+    Task take_task(std::size_t index);
+
     std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+    // Allocated before the threads start, one per thread.
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::atomic<std::size_t> m_next_queue{0};
 
+    // Tasks queued and not yet reserved by a worker.
+    std::atomic<int> m_queued{0};
+    // Workers waiting on m_condvar for m_queued to grow.
+    std::atomic<int> m_sleeping{0};
     std::mutex m_mutex;
     std::condition_variable m_condvar;
     bool m_exit{false};
 };
 
-inline void ThreadPool::add_thread(std::function<void()> initializer) {
-    m_threads.emplace_back([this, initializer] {
-        initializer();
-        for (;;) {
-            std::function<void()> task;
-            {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                m_condvar.wait(lock, [this]{ return m_exit || !m_tasks.empty(); });
-                if (m_exit && m_tasks.empty()) {
+inline ThreadPool::CurrentWorker& ThreadPool::current_worker() {
+    static thread_local CurrentWorker worker;
+    return worker;
+}
+
+inline int ThreadPool::get_worker_index() const {
+    const auto& worker = current_worker();
+    return worker.pool == this ? worker.index : -1;
+}
+
+inline bool ThreadPool::reserve_task() {
+    auto queued = m_queued.load();
+    while (queued > 0) {
+        if (m_queued.compare_exchange_weak(queued, queued - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline Task ThreadPool::take_task(const std::size_t index) {
+    // A task was reserved, so one is queued somewhere: it may only be
+    // late to show up in its deque, after its reservation was counted.
+    for (;;) {
+        {
+            auto& own = *m_queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                auto task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return task;
+            }
+        }
+        for (auto i = std::size_t{1}; i < m_queues.size(); i++) {
+            auto& victim = *m_queues[(index + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                auto task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return task;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+inline void ThreadPool::worker_loop(const std::size_t index) {
+    for (;;) {
+        if (!reserve_task()) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_sleeping++;
+            m_condvar.wait(lock, [this]{ return m_exit || m_queued > 0; });
+            m_sleeping--;
+            if (!reserve_task()) {
+                if (m_exit) {
                     return;
                 }
-                task = std::move(m_tasks.front());
-                m_tasks.pop();
+                continue;
             }
-            task();
         }
+        auto task = take_task(index);
+        task();
+    }
+}
+
+inline void ThreadPool::add_thread(std::function<void()> initializer,
+                                   const int cpu) {
+    const auto index = m_threads.size();
+    m_queues.emplace_back(std::make_unique<WorkerQueue>());
+    m_threads.emplace_back([this, initializer, index, cpu] {
+        if (cpu >= 0) {
+            SMP::set_thread_affinity(cpu);
+        }
+        auto& worker = current_worker();
+        worker.pool = this;
+        worker.index = static_cast<int>(index);
+        initializer();
+        worker_loop(index);
     });
 }
 
-inline void ThreadPool::initialize(size_t threads) {
+inline void ThreadPool::initialize(const std::size_t threads,
+                                   const std::vector<int>& cpus) {
+    // All the deques must exist before any worker looks for work.
+    m_queues.reserve(m_queues.size() + threads);
+    m_threads.reserve(m_threads.size() + threads);
     for (size_t i = 0; i < threads; i++) {
-        add_thread([](){} /* null function */);
+        const auto cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        add_thread([](){} /* null function */, cpu);
+    }
+}
+
+inline void ThreadPool::add_task(Task task) {
+    assert(!m_queues.empty());
+    auto index = get_worker_index();
+    if (index < 0) {
+        index = static_cast<int>(m_next_queue++ % m_queues.size());
+    }
+    {
+        auto& queue = *m_queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.emplace_back(std::move(task));
+    }
+    m_queued++;
+    if (m_sleeping > 0) {
+        // Taking the mutex orders the wakeup after the check of a
+        // worker about to sleep.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_condvar.notify_one();
     }
 }
 
@@ -96,11 +327,7 @@ auto ThreadPool::add_task(F&& f, Args&&... args)
     );
 
     std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_tasks.emplace([task](){(*task)();});
-    }
-    m_condvar.notify_one();
+    add_task(Task([task](){(*task)();}));
     return res;
 }
 
@@ -115,23 +342,63 @@ inline ThreadPool::~ThreadPool() {
     }
 }
 
+// Runs tasks on a pool and waits for all of them.  Completion is
+// tracked with a counter instead of a future per task, so adding
+// the search workers doesn't allocate.
 class ThreadGroup {
 public:
     ThreadGroup(ThreadPool & pool) : m_pool(pool) {}
+    ~ThreadGroup() {
+        // The tasks refer to the group, they must not outlive it.
+        wait();
+    }
     template<class F, class... Args>
     void add_task(F&& f, Args&&... args) {
-        m_taskresults.emplace_back(
-            m_pool.add_task(std::forward<F>(f), std::forward<Args>(args)...)
-        );
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending++;
+        }
+        m_pool.add_task(Task(
+            [this, fn = std::bind(std::forward<F>(f),
+                                  std::forward<Args>(args)...)]() mutable {
+                try {
+                    fn();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (!m_exception) {
+                        m_exception = std::current_exception();
+                    }
+                }
+                finish();
+            }
+        ));
     }
+    // Rethrows the first exception thrown by a task.
     void wait_all() {
-        for (auto && result : m_taskresults) {
-            result.get();
+        wait();
+        if (m_exception) {
+            auto exception = m_exception;
+            m_exception = nullptr;
+            std::rethrow_exception(exception);
         }
     }
 private:
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condvar.wait(lock, [this]{ return m_pending == 0; });
+    }
+    void finish() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_pending == 0) {
+            m_condvar.notify_all();
+        }
+    }
+
     ThreadPool & m_pool;
-    std::vector<std::future<void>> m_taskresults;
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    int m_pending{0};
+    std::exception_ptr m_exception;
 };
 
 }
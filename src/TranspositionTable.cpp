@@ -0,0 +1,124 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+#include "TranspositionTable.h"
+
+TranspositionTable::TranspositionTable() : m_buckets(BUCKETS) {
+    clear();
+}
+
+std::atomic<TranspositionEntry*>&
+    TranspositionTable::bucket(std::uint64_t hash) {
+    // The low bits of Zobrist hashes are as good as any.
+    return m_buckets[hash & (BUCKETS - 1)];
+}
+
+TranspositionEntry* TranspositionTable::find_or_insert(NodeArena& arena,
+                                                       std::uint64_t hash) {
+    auto& head = bucket(hash);
+    auto created = static_cast<TranspositionEntry*>(nullptr);
+    auto first = head.load();
+    while (true) {
+        for (auto entry = first; entry != nullptr; entry = entry->next) {
+            if (entry->hash == hash) {
+                // If another thread inserted it meanwhile, the entry we
+                // made is left unused in the arena.
+                return entry;
+            }
+        }
+        if (created == nullptr) {
+            created = arena.create<TranspositionEntry>();
+            created->hash = hash;
+        }
+        created->next = first;
+        // On failure first is the new head, look for the hash again.
+        if (head.compare_exchange_weak(first, created)) {
+            return created;
+        }
+    }
+}
+
+void TranspositionTable::insert(TranspositionEntry* entry) {
+    auto& head = bucket(entry->hash);
+    entry->next = head.load();
+    while (!head.compare_exchange_weak(entry->next, entry)) {}
+}
+
+TranspositionEntry* TranspositionTable::relocate(
+    const TranspositionEntry& entry, NodeArena& arena) {
+
+    if (entry.relocated != nullptr) {
+        return entry.relocated;
+    }
+    auto copy = arena.create<TranspositionEntry>();
+    copy->hash = entry.hash;
+    copy->visits = entry.visits.load();
+    copy->blackevals = entry.blackevals.load();
+    if (const auto eval = entry.eval.load()) {
+        auto eval_copy = arena.create<SharedEval>();
+        eval_copy->net_eval = eval->net_eval;
+        eval_copy->net_alpkt = eval->net_alpkt;
+        eval_copy->net_beta = eval->net_beta;
+        eval_copy->eval_bonus = eval->eval_bonus;
+        eval_copy->eval_base = eval->eval_base;
+        eval_copy->agent_eval = eval->agent_eval;
+        eval_copy->nodelist.reserve(eval->nodelist.size());
+        for (const auto& node : eval->nodelist) {
+            eval_copy->nodelist.push_back(node);
+        }
+        copy->eval = eval_copy;
+    }
+    insert(copy);
+    entry.relocated = copy;
+    return copy;
+}
+
+void TranspositionTable::clear() {
+    for (auto& head : m_buckets) {
+        head = nullptr;
+    }
+}
+
+void TranspositionTable::refresh_agent_evals() {
+    for (auto& head : m_buckets) {
+        for (auto entry = head.load(); entry != nullptr; entry = entry->next) {
+            entry->visits = 0;
+            entry->blackevals = 0.0;
+            if (const auto eval = entry->eval.load()) {
+                const auto agent = Network::get_agent_eval(eval->net_alpkt,
+                                                           eval->net_beta);
+                eval->eval_bonus = agent.eval_bonus;
+                eval->eval_base = agent.eval_base;
+                eval->agent_eval = agent.agent_eval;
+            }
+        }
+    }
+}
@@ -0,0 +1,104 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef TRANSPOSITIONTABLE_H_INCLUDED
+#define TRANSPOSITIONTABLE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Network.h"
+#include "NodeArena.h"
+
+// Network evaluation of a position, as UCTNode::create_children derives
+// it.  Written once by the first node expanding the position and
+// read-only afterwards, except between searches by
+// TranspositionTable::refresh_agent_evals.
+struct SharedEval {
+    float net_eval;
+    float net_alpkt;
+    float net_beta;
+    float eval_bonus;
+    float eval_base;
+    float agent_eval;
+    // normalized priors of the legal moves, before any pruning
+    ArenaVector<Network::PolicyVertexPair> nodelist;
+};
+
+// One position of the search tree, shared by all the nodes reaching it
+// through different move orders.
+struct TranspositionEntry {
+    std::uint64_t hash;
+    TranspositionEntry* next{nullptr};
+    // statistics of all the nodes of the position, from black's point
+    // of view, as UCTNode::update accumulates them
+    std::atomic<int> visits{0};
+    std::atomic<double> blackevals{0.0};
+    std::atomic<SharedEval*> eval{nullptr};
+    // copy made by TranspositionTable::relocate
+    mutable TranspositionEntry* relocated{nullptr};
+};
+
+// Concurrent hash table of the positions of one search tree, keyed by
+// FullBoard::get_hash(), which covers the stones, the side to move,
+// the prisoners, the ko point and the passes.  Superko depends on the
+// whole history and is still checked on each path by the search.
+// Entries are allocated from the NodeArena of the tree, so they share
+// its memory limit and are released with it.
+class TranspositionTable {
+public:
+    TranspositionTable();
+
+    TranspositionEntry* find_or_insert(NodeArena& arena, std::uint64_t hash);
+    // Copy an entry of a previous generation of the arena into the
+    // current one, once, and index the copy.  Only to be called after
+    // clear(), between searches.
+    TranspositionEntry* relocate(const TranspositionEntry& entry,
+                                 NodeArena& arena);
+    void clear();
+    // Clears the statistics of the entries and recomputes their agent
+    // evaluations, before UCTNode::refresh_agent_evals backs them up
+    // again.  Only between searches.
+    void refresh_agent_evals();
+
+private:
+    static constexpr auto BUCKETS = size_t{1} << 20;
+
+    void insert(TranspositionEntry* entry);
+    std::atomic<TranspositionEntry*>& bucket(std::uint64_t hash);
+
+    std::vector<std::atomic<TranspositionEntry*>> m_buckets;
+};
+
+#endif
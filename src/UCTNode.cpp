@@ -34,6 +34,7 @@
 #include <cstdio>
 #include <cstdint>
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <functional>
 #include <iterator>
@@ -54,11 +55,96 @@
 
 using namespace Utils;
 
-UCTNode::UCTNode(int vertex, float policy) : m_move(vertex), m_policy(policy) {
+constexpr int UCTNode::MAX_VIRTUAL_LOSS_COUNT;
+
+size_t ChildStats::get_bytes(size_t capacity) {
+    // Arrays sorted by decreasing alignment, so that each one starts
+    // aligned after the previous.
+    return NodeArena::round_size(sizeof(ChildStats))
+        + capacity * (sizeof(std::atomic<double>) + sizeof(std::atomic<int>)
+                      + sizeof(std::atomic<int>) + sizeof(float)
+                      + sizeof(std::atomic<std::int16_t>)
+                      + sizeof(std::int16_t) + sizeof(std::atomic<Status>)
+                      + sizeof(std::atomic<ExpandState>));
+}
+
+ChildStats* ChildStats::create(NodeArena& arena, size_t capacity,
+                              const bool interleaved) {
+    const auto bytes = get_bytes(capacity);
+    auto p = static_cast<char*>(interleaved
+                                ? arena.allocate_interleaved(bytes)
+                                : arena.allocate(bytes));
+    auto stats = new (p) ChildStats;
+    p += NodeArena::round_size(sizeof(ChildStats));
+
+    auto take = [&p, capacity](auto*& array) {
+        using T = std::remove_reference_t<decltype(*array)>;
+        array = reinterpret_cast<T*>(p);
+        for (auto i = size_t{0}; i < capacity; i++) {
+            new (&array[i]) T();
+        }
+        p += capacity * sizeof(T);
+    };
+    stats->capacity = capacity;
+    take(stats->blackevals);
+    take(stats->visits);
+    take(stats->forced);
+    take(stats->policy);
+    take(stats->virtual_loss);
+    take(stats->move);
+    take(stats->status);
+    take(stats->expand_state);
+    return stats;
+}
+
+void ChildStats::init_slot(size_t i, int vertex, float prior) {
+    assert(i < capacity);
+    blackevals[i] = 0.0;
+    visits[i] = 0;
+    forced[i] = 0;
+    policy[i] = prior;
+    virtual_loss[i] = 0;
+    move[i] = static_cast<std::int16_t>(vertex);
+    status[i] = ACTIVE;
+    expand_state[i] = ExpandState::INITIAL;
+}
+
+void ChildStats::copy_slot(size_t i, const ChildStats& from, size_t j) {
+    set_slot(i, from.get_slot(j));
+}
+
+ChildStats::Slot ChildStats::get_slot(size_t i) const {
+    assert(i < capacity);
+    return Slot{blackevals[i].load(), visits[i].load(), forced[i].load(),
+                policy[i], virtual_loss[i].load(), move[i],
+                status[i].load(), expand_state[i].load()};
+}
+
+void ChildStats::set_slot(size_t i, const Slot& slot) {
+    assert(i < capacity);
+    blackevals[i] = slot.blackevals;
+    visits[i] = slot.visits;
+    forced[i] = slot.forced;
+    policy[i] = slot.policy;
+    virtual_loss[i] = slot.virtual_loss;
+    move[i] = slot.move;
+    status[i] = slot.status;
+    expand_state[i] = slot.expand_state;
+}
+
+UCTNode::UCTNode(ChildStats* stats, size_t slot)
+    : m_move(stats->move[slot]), m_slot(static_cast<std::uint16_t>(slot)),
+      m_stats(stats) {
+}
+
+UCTNode* UCTNode::create_root(NodeArena& arena) {
+    auto stats = ChildStats::create(arena, 1);
+    stats->init_slot(0, FastBoard::PASS, 0.0f);
+    return arena.create<UCTNode>(stats, 0);
 }
 
 bool UCTNode::first_visit() const {
-    return m_visits == 0;
+    return m_stats->visits[m_slot] == 0;
 }
 
 bool UCTNode::create_children(Network & network,
@@ -67,7 +153,8 @@ bool UCTNode::create_children(Network & network,
                                           float& value,
                               float& alpkt,
                                           float& beta,
-                              float min_psa_ratio) {
+                              float min_psa_ratio,
+                              TranspositionEntry* transposition) {
 
     // no successors in final state
     if (state.get_passes() >= 2) {
@@ -85,6 +172,29 @@ bool UCTNode::create_children(Network & network,
         return false;
     }
 
+    if (transposition != nullptr) {
+        m_transposition = transposition;
+        if (const auto shared = transposition->eval.load()) {
+            // Reached before through another move order: reuse its
+            // evaluation instead of asking the network again.
+            m_net_eval = shared->net_eval;
+            m_net_alpkt = shared->net_alpkt;
+            m_net_beta = shared->net_beta;
+            m_eval_bonus = shared->eval_bonus;
+            m_eval_base = shared->eval_base;
+            m_agent_eval = shared->agent_eval;
+            value = m_net_eval;
+            alpkt = m_net_alpkt;
+            beta = m_net_beta;
+
+            auto nodelist = std::vector<Network::PolicyVertexPair>(
+                begin(shared->nodelist), end(shared->nodelist));
+            link_nodelist(nodecount, nodelist, min_psa_ratio);
+            expand_done();
+            return true;
+        }
+    }
+
     const auto raw_netlist =
         network.get_output(&state,
                            Network::Ensemble::RANDOM_SYMMETRY,
@@ -138,10 +248,13 @@ bool UCTNode::create_children(Network & network,
     std::array<bool, NUM_INTERSECTIONS> taken_already{};
     auto unif_law = std::uniform_real_distribution<float>{0.0, 1.0};
 
+    // The network works on full size boards, so the bits are indexed
+    // like the policy.
+    assert(state.board.get_boardsize() == BOARD_SIZE);
     auto legal_sum = 0.0f;
-    for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
+    state.get_legal_bits(to_move).for_each([&](const int i) {
         const auto vertex = state.board.get_vertex(i);
-        if (state.is_move_legal(to_move, vertex) && !taken_already[i]) {
+        if (!taken_already[i]) {
             auto taken_policy = 0.0f;
             auto max_u = 0.0f;
             auto chosen_vertex = vertex;
@@ -170,7 +283,7 @@ bool UCTNode::create_children(Network & network,
             nodelist.emplace_back(warm_policy, chosen_vertex);
             legal_sum += warm_policy;
         }
-    }
+    });
 
     // Always try passes if we're not trying to be clever.
     auto allow_pass = cfg_dumbpass;
@@ -210,11 +323,34 @@ bool UCTNode::create_children(Network & network,
         }
     }
 
+    if (transposition != nullptr) {
+        publish_eval(*transposition, nodelist);
+    }
     link_nodelist(nodecount, nodelist, min_psa_ratio);
     expand_done();
     return true;
 }
 
+void UCTNode::publish_eval(
+    TranspositionEntry& transposition,
+    const std::vector<Network::PolicyVertexPair>& nodelist) {
+
+    auto shared = NodeArena::owner(this).create<SharedEval>();
+    shared->net_eval = m_net_eval;
+    shared->net_alpkt = m_net_alpkt;
+    shared->net_beta = m_net_beta;
+    shared->eval_bonus = m_eval_bonus;
+    shared->eval_base = m_eval_base;
+    shared->agent_eval = m_agent_eval;
+    shared->nodelist.reserve(nodelist.size());
+    for (const auto& node : nodelist) {
+        shared->nodelist.push_back(node);
+    }
+    // If another node published first, keep its evaluation.
+    auto expected = static_cast<SharedEval*>(nullptr);
+    transposition.eval.compare_exchange_strong(expected, shared);
+}
+
 void UCTNode::link_nodelist(std::atomic<int>& nodecount,
                             std::vector<Network::PolicyVertexPair>& nodelist,
                             float min_psa_ratio) {
@@ -249,31 +385,143 @@ void UCTNode::link_nodelist(std::atomic<int>& nodecount,
             ++nodecount;
         }
     }
+    sync_child_stats();
 
     m_min_psa_ratio_children = skipped_children ? min_psa_ratio : 0.0f;
 }
 
-const std::vector<UCTNodePointer>& UCTNode::get_children() const {
+// Rebuild m_child_stats after m_children was extended or reordered.
+// Only unvisited children can be uninflated, so their slots start
+// from scratch.  Not thread safe: only called while expanding the
+// node, or on the root between searches.
+void UCTNode::sync_child_stats() {
+    if (m_child_stats != nullptr
+        && m_child_stats->capacity == m_children.capacity()) {
+        // Only sorted, which dump_stats() and friends do to every node
+        // they print: permute the slots in place rather than leave a
+        // block behind in the arena each time.
+        auto slots = std::vector<ChildStats::Slot>(m_children.size());
+        for (auto i = size_t{0}; i < m_children.size(); i++) {
+            const auto& child = m_children[i];
+            if (child.is_inflated()) {
+                assert(child->m_stats == m_child_stats);
+                slots[i] = m_child_stats->get_slot(child->m_slot);
+            }
+        }
+        for (auto i = size_t{0}; i < m_children.size(); i++) {
+            const auto& child = m_children[i];
+            if (child.is_inflated()) {
+                m_child_stats->set_slot(i, slots[i]);
+                child->m_slot = static_cast<std::uint16_t>(i);
+            } else {
+                m_child_stats->init_slot(i, child.get_move(),
+                                         child.get_policy());
+            }
+        }
+        return;
+    }
+
+    auto stats = ChildStats::create(NodeArena::owner(this),
+                                    m_children.capacity());
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        const auto& child = m_children[i];
+        if (child.is_inflated()) {
+            stats->copy_slot(i, *child->m_stats, child->m_slot);
+            child->m_stats = stats;
+            child->m_slot = static_cast<std::uint16_t>(i);
+        } else {
+            stats->init_slot(i, child.get_move(), child.get_policy());
+        }
+    }
+    m_child_stats = stats;
+}
+
+UCTNode* UCTNode::inflate_child(const UCTNodePointer& child) const {
+    const auto slot = static_cast<size_t>(&child - m_children.begin());
+    assert(slot < m_children.size());
+    child.inflate(m_child_stats, slot);
+    return child.get();
+}
+
+const ArenaVector<UCTNodePointer>& UCTNode::get_children() const {
     return m_children;
 }
 
+const ChildStats* UCTNode::get_child_stats() const {
+    return m_child_stats;
+}
+
 
 int UCTNode::get_move() const {
     return m_move;
 }
 
-void UCTNode::virtual_loss() {
-    m_virtual_loss += VIRTUAL_LOSS_COUNT;
+void UCTNode::virtual_loss(const int count) {
+    m_stats->virtual_loss[m_slot] += count;
+}
+
+void UCTNode::virtual_loss_undo(const int count) {
+    m_stats->virtual_loss[m_slot] -= count;
 }
 
-void UCTNode::virtual_loss_undo() {
-    m_virtual_loss -= VIRTUAL_LOSS_COUNT;
+void UCTNode::add_collision() {
+    m_collisions++;
+}
+
+int UCTNode::get_collisions() const {
+    return m_collisions;
+}
+
+void UCTNode::refresh_agent_evals() {
+    auto path = std::vector<UCTNode*>{};
+    refresh_agent_evals(path);
+}
+
+void UCTNode::refresh_agent_evals(std::vector<UCTNode*>& path) {
+    // Simulations that ended on this node rather than below it: they
+    // are replayed with its net values, as play_simulation backed them
+    // up, so that every node keeps its visits.  With cfg_restrict_tt
+    // this is approximate: play_simulation may have backed up a second
+    // pass with the net values of the first pass above it, which is not
+    // recorded, while the replay always uses those of the second pass.
+    auto own_visits = get_visits();
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        own_visits -= m_child_stats->visits[i];
+    }
+    m_stats->visits[m_slot] = 0;
+    m_stats->blackevals[m_slot] = 0.0;
+    m_squared_eval_diff = 1e-4f;
+
+    if (has_children()) {
+        const auto agent = Network::get_agent_eval(m_net_alpkt, m_net_beta);
+        m_eval_bonus = agent.eval_bonus;
+        m_eval_base = agent.eval_base;
+        m_agent_eval = agent.agent_eval;
+    }
+
+    path.push_back(this);
+    for (auto k = 0; k < own_visits; k++) {
+        for (const auto node : path) {
+            node->update(Utils::sigmoid_interval_avg(
+                             m_net_alpkt, m_net_beta,
+                             node->m_eval_base_father,
+                             node->m_eval_bonus_father));
+        }
+    }
+    for (const auto& child : m_children) {
+        if (child.is_inflated()) {
+            child->set_eval_bonus_father(m_eval_bonus);
+            child->set_eval_base_father(m_eval_base);
+            child->refresh_agent_evals(path);
+        }
+    }
+    path.pop_back();
 }
 
 void UCTNode::clear_visits() {
-    m_visits = 0;
-    m_forced = 0;
-    m_blackevals = 0;
+    m_stats->visits[m_slot] = 0;
+    m_stats->forced[m_slot] = 0;
+    m_stats->blackevals[m_slot] = 0;
     m_alpkt_median = 0;
 }
 
@@ -287,23 +535,27 @@ void UCTNode::clear_children_visits() {
 
 void UCTNode::update(float eval, bool forced) {
     // Cache values to avoid race conditions.
-    auto old_eval = static_cast<float>(m_blackevals);
-    auto old_visits = static_cast<int>(m_visits);
+    auto old_eval = static_cast<float>(m_stats->blackevals[m_slot]);
+    auto old_visits = static_cast<int>(m_stats->visits[m_slot]);
     auto old_delta = old_visits > 0 ? eval - old_eval / old_visits : 0.0f;
-    m_visits++;
+    m_stats->visits[m_slot]++;
     accumulate_eval(eval);
     auto new_delta = eval - (old_eval + eval) / (old_visits + 1);
     // Welford's online algorithm for calculating variance.
     auto delta = old_delta * new_delta;
     atomic_add(m_squared_eval_diff, delta);
     if (forced) {
-        m_forced++;
+        m_stats->forced[m_slot]++;
+    }
+    if (const auto transposition = m_transposition.load()) {
+        transposition->visits++;
+        atomic_add(transposition->blackevals, double(eval));
     }
 }
 
 void UCTNode::update_alpkt_median(float new_value) {
     // Cache values to avoid race conditions.
-    const auto new_visits = static_cast<int>(m_visits);
+    const auto new_visits = static_cast<int>(m_stats->visits[m_slot]);
     assert (new_visits > 0);
     if (new_visits == 1) {
         m_alpkt_median = new_value;
@@ -327,14 +579,14 @@ bool UCTNode::expandable(const float min_psa_ratio) const {
     if (m_min_psa_ratio_children == 0.0f) {
         // If we figured out that we are fully expandable
         // it is impossible that we stay in INITIAL state.
-        assert(m_expand_state.load() != ExpandState::INITIAL);
+        assert(m_stats->expand_state[m_slot].load() != ExpandState::INITIAL);
     }
 #endif
     return min_psa_ratio < m_min_psa_ratio_children;
 }
 
 float UCTNode::get_policy() const {
-    return m_policy;
+    return m_stats->policy[m_slot];
 }
 
 float UCTNode::get_eval_bonus() const {
@@ -384,7 +636,7 @@ void UCTNode::set_values(float value, float alpkt, float beta) {
 }
 
 void UCTNode::set_policy(float policy) {
-    m_policy = policy;
+    m_stats->policy[m_slot] = policy;
 }
 
 #ifdef USE_EVALCMD
@@ -393,7 +645,7 @@ void UCTNode::set_progid(int id) {
     m_progid.push_back(id);
 }
 
-std::vector<int>& UCTNode::get_progid() {
+ArenaVector<int>& UCTNode::get_progid() {
     return m_progid;
 }
 #endif
@@ -414,18 +666,19 @@ bool UCTNode::low_visits_child(UCTNode* const child) const {
 }
 
 float UCTNode::get_eval_variance(float default_var) const {
-    return m_visits > 1 ? m_squared_eval_diff / (m_visits - 1) : default_var;
+    const auto visits = get_visits();
+    return visits > 1 ? m_squared_eval_diff / (visits - 1) : default_var;
 }
 
 int UCTNode::get_visits() const {
-    return m_visits;
+    return m_stats->visits[m_slot];
 }
 
 int UCTNode::get_denom() const {
     if (cfg_laddercode) {
-        return 1 + m_visits - m_forced;
+        return 1 + m_stats->visits[m_slot] - m_stats->forced[m_slot];
     } else {
-        return 1 + m_visits;
+        return 1 + m_stats->visits[m_slot];
     }
 }
 
@@ -475,7 +728,7 @@ float UCTNode::get_eval(int tomove) const {
     // Due to the use of atomic updates and virtual losses, it is
     // possible for the visit count to change underneath us. Make sure
     // to return a consistent result to the caller by caching the values.
-    return get_raw_eval(tomove, m_virtual_loss);
+    return get_raw_eval(tomove, m_stats->virtual_loss[m_slot]);
 }
 
 float UCTNode::get_net_eval(int tomove) const {
@@ -493,11 +746,11 @@ float UCTNode::get_agent_eval(int tomove) const {
 }
 
 double UCTNode::get_blackevals() const {
-    return m_blackevals;
+    return m_stats->blackevals[m_slot];
 }
 
 void UCTNode::accumulate_eval(float eval) {
-    atomic_add(m_blackevals, double(eval));
+    atomic_add(m_stats->blackevals[m_slot], double(eval));
 }
 
 UCTNode* UCTNode::uct_select_child(const GameState & currstate, bool is_root,
@@ -506,6 +759,19 @@ UCTNode* UCTNode::uct_select_child(const GameState & currstate, bool is_root,
                                    bool nopass) {
     wait_expanded();
 
+    // The statistics are gathered once from the child arrays, so that
+    // the PUCT values and their maximum are computed by straight loops
+    // over local arrays.
+    const auto n = m_children.size();
+    assert(n <= POTENTIAL_MOVES);
+    const auto& stats = *m_child_stats;
+    std::array<int, POTENTIAL_MOVES> visits;
+    std::array<float, POTENTIAL_MOVES> q;
+    std::array<float, POTENTIAL_MOVES> psa;
+    std::array<int, POTENTIAL_MOVES> denom;
+    std::array<double, POTENTIAL_MOVES> value;
+    std::array<bool, POTENTIAL_MOVES> expanding;
+
     // Count parentvisits manually to avoid issues with transpositions.
     auto total_visited_policy = 0.0f;
     auto parentvisits = size_t{0};
@@ -516,15 +782,43 @@ UCTNode* UCTNode::uct_select_child(const GameState & currstate, bool is_root,
     const auto color = currstate.get_to_move();
     auto max_eval = get_agent_eval(color);
 
-    for (const auto& child : m_children) {
-        if (child.valid()) {
-            parentvisits += child.get_visits();
-            if (child.get_visits() > 0) {
-                const auto child_eval = child.get_eval(color);
-                max_eval = std::max (max_eval, child_eval);
-                total_visited_policy += child.get_policy();
+    const auto transpositions = cfg_transpositions;
+    for (auto i = size_t{0}; i < n; i++) {
+        visits[i] = stats.visits[i];
+        if (visits[i] == 0) {
+            continue;
+        }
+        // Same as get_eval(color) on the child.
+        const auto virtual_loss = int{stats.virtual_loss[i]};
+        auto blackeval = stats.blackevals[i].load();
+        auto eval_visits = visits[i];
+        if (transpositions) {
+            // The position may have been searched more through other
+            // move orders, then its value is better known there.  The
+            // visits of this child still drive the exploration term.
+            const auto transposition = m_children[i]->m_transposition.load();
+            if (transposition != nullptr) {
+                const auto shared_visits = transposition->visits.load();
+                if (shared_visits > eval_visits) {
+                    eval_visits = shared_visits;
+                    blackeval = transposition->blackevals;
+                }
             }
         }
+        if (color == FastBoard::WHITE) {
+            blackeval += static_cast<double>(virtual_loss);
+        }
+        auto eval = static_cast<float>(
+            blackeval / double(eval_visits + virtual_loss));
+        if (color == FastBoard::WHITE) {
+            eval = 1.0f - eval;
+        }
+        q[i] = eval;
+        if (stats.status[i] != ChildStats::INVALID) {
+            parentvisits += visits[i];
+            max_eval = std::max(max_eval, eval);
+            total_visited_policy += stats.policy[i];
+        }
     }
 
     const auto numerator = std::sqrt(double(parentvisits) *
@@ -532,84 +826,98 @@ UCTNode* UCTNode::uct_select_child(const GameState & currstate, bool is_root,
     const auto fpu_reduction = (is_root ? cfg_fpu_root_reduction : cfg_fpu_reduction) * std::sqrt(total_visited_policy);
     // Estimated eval for unknown nodes = original parent NN eval - reduction
     const auto fpu_eval = cfg_fpuzero ? 0.0f : std::max(0.0f, max_eval - fpu_reduction);
+    const auto passes = currstate.get_passes();
 
-    auto best = static_cast<UCTNodePointer*>(nullptr);
-    auto best_value = std::numeric_limits<double>::lowest();
-
-#ifndef NDEBUG
-    auto b_psa = 0.0f;
-    auto b_q = 0.0f;
-    auto b_denom = 0.0f;
-#endif
+    for (auto i = size_t{0}; i < n; i++) {
+        expanding[i] =
+            stats.expand_state[i].load() == ExpandState::EXPANDING;
+        if (expanding[i]) {
+            // Someone else is expanding this node, never select it
+            // if we can avoid so, because we'd block on it.
+            q[i] = -1.0f - fpu_reduction; // why not simply 'continue'?
+        } else if (visits[i] == 0) {
+            q[i] = fpu_eval;
+        }
+        psa[i] = stats.policy[i];
 
-    for (auto& child : m_children) {
-        if (!child.active()) {
-            continue;
+        if (stats.move[i] == FastBoard::PASS) {
+            if (nopass) {
+                psa[i] = 0.0;
+                q[i] -= 0.05; // is this correct?
+            }
+            if (passes >= 1) {
+                psa[i] += 0.2;
+            }
         }
 
-        if( !move_list.empty() &&
-            std::find( begin(move_list), end(move_list),
-                       child.get_move() ) == end(move_list) ) {
-          continue;
+        denom[i] = 1 + visits[i];
+        if (cfg_laddercode) {
+            denom[i] -= stats.forced[i];
         }
+    }
 
-        const auto visits = child.get_visits();
+    for (auto i = size_t{0}; i < n; i++) {
+        value[i] = q[i] + cfg_puct * psa[i] * (numerator / denom[i]);
+    }
 
+    for (auto i = size_t{0}; i < n; i++) {
+        if (stats.status[i] != ChildStats::ACTIVE) {
+            value[i] = std::numeric_limits<double>::lowest();
+        }
         // If max_visits is specified, then stop choosing nodes that
         // already have enough visits. This guarantees that
         // exploration is wide enough and not too deep when doing fast
         // roll-outs in the endgame exploration.
-        if (max_visits > 0 && visits >= max_visits) {
-            continue;
-        }
-
-        auto winrate = fpu_eval;
-        if (child.is_inflated() &&
-            child->m_expand_state.load() == ExpandState::EXPANDING) {
-            // Someone else is expanding this node, never select it
-            // if we can avoid so, because we'd block on it.
-            winrate = -1.0f - fpu_reduction; // why not simply 'continue'?
-        } else if (visits > 0) {
-            winrate = child.get_eval(color);
+        if (max_visits > 0 && visits[i] >= max_visits) {
+            value[i] = std::numeric_limits<double>::lowest();
         }
-        auto psa = child.get_policy();
-
-        if (nopass && child.get_move() == FastBoard::PASS) {
-            psa = 0.0;
-            winrate -= 0.05; // is this correct?
+    }
+    if (!move_list.empty()) {
+        for (auto i = size_t{0}; i < n; i++) {
+            if (std::find(begin(move_list), end(move_list),
+                          stats.move[i]) == end(move_list)) {
+                value[i] = std::numeric_limits<double>::lowest();
+            }
         }
+    }
 
-        if (currstate.get_passes() >= 1 &&
-            child.get_move() == FastBoard::PASS) {
-            psa += 0.2;
+    if (cfg_collision_aware) {
+        // Rule out the children being expanded by other threads, unless
+        // there is nothing else to choose: reaching them would only
+        // collide with the evaluation already in flight.
+        auto alternatives = false;
+        for (auto i = size_t{0}; i < n; i++) {
+            alternatives |= !expanding[i]
+                && value[i] > std::numeric_limits<double>::lowest();
         }
-
-        const auto denom = child.get_denom();
-        const auto puct = cfg_puct * psa * (numerator / denom);
-
-        auto value = winrate + puct;
-        assert(value > std::numeric_limits<double>::lowest());
-
-        if (value > best_value) {
-            best_value = value;
-            best = &child;
-#ifndef NDEBUG
-            b_psa = psa;
-            b_q = winrate;
-            b_denom = denom;
-#endif
+        if (alternatives) {
+            for (auto i = size_t{0}; i < n; i++) {
+                if (expanding[i]) {
+                    value[i] = std::numeric_limits<double>::lowest();
+                }
+            }
         }
     }
 
-    assert(best != nullptr);
-    if(best->get_visits() == 0) {
-        best->inflate();
-        best->get()->set_values(m_net_eval, m_net_alpkt, m_net_beta);
+    auto best_value = std::numeric_limits<double>::lowest();
+    for (auto i = size_t{0}; i < n; i++) {
+        best_value = std::max(best_value, value[i]);
+    }
+    assert(best_value > std::numeric_limits<double>::lowest());
+    // The first child reaching the maximum, as the strict comparison
+    // of a sequential scan would pick.
+    const auto best_index = static_cast<size_t>(
+        std::find(begin(value), begin(value) + n, best_value) - begin(value));
+    assert(best_index < n);
+
+    auto best = inflate_child(m_children[best_index]);
+    if (best->get_visits() == 0) {
+        best->set_values(m_net_eval, m_net_alpkt, m_net_beta);
     }
 #ifndef NDEBUG
-    best->get()->set_urgency(best_value, b_psa, b_q,
-                             b_denom, numerator);
-    // if (best->get()->get_move() == FastBoard::PASS) {
+    best->set_urgency(best_value, psa[best_index], q[best_index],
+                      denom[best_index], numerator);
+    // if (best->get_move() == FastBoard::PASS) {
     //   const auto score = ( color == FastBoard::BLACK ? 1.0 : -1.0 ) *
     //             currstate.final_score();
     //   myprintf("\nUCT selected PASS. Passes %d, color %d, score %f, winrate %f, visits %d\n",
@@ -617,10 +925,10 @@ UCTNode* UCTNode::uct_select_child(const GameState & currstate, bool is_root,
     //         color,
     //         score,
     //         Utils::winner(score),
-    //         best->get()->get_visits());
+    //         best->get_visits());
     //    }
 #endif
-    return best->get();
+    return best;
 }
 
 class NodeComp : public std::binary_function<UCTNodePointer&,
@@ -673,6 +981,7 @@ private:
 
 void UCTNode::sort_children(int color, float lcb_min_visits) {
     std::stable_sort(rbegin(m_children), rend(m_children), NodeComp(color, lcb_min_visits));
+    sync_child_stats();
 }
 
 class NodeCompByPolicy : public std::binary_function<UCTNodePointer&,
@@ -686,6 +995,7 @@ public:
 
 void UCTNode::sort_children_by_policy() {
     std::stable_sort(rbegin(m_children), rend(m_children), NodeCompByPolicy());
+    sync_child_stats();
 }
 
 UCTNode& UCTNode::get_best_root_child(int color) {
@@ -700,16 +1010,14 @@ UCTNode& UCTNode::get_best_root_child(int color) {
 
     auto ret = std::max_element(begin(m_children), end(m_children),
                                 NodeComp(color, cfg_lcb_min_visit_ratio * max_visits));
-    ret->inflate();
-
-    return *(ret->get());
+    return *inflate_child(*ret);
 }
 
 size_t UCTNode::count_nodes_and_clear_expand_state() {
     auto nodecount = size_t{0};
     nodecount += m_children.size();
     if (expandable()) {
-        m_expand_state = ExpandState::INITIAL;
+        m_stats->expand_state[m_slot] = ExpandState::INITIAL;
     }
     for (auto& child : m_children) {
         if (child.is_inflated()) {
@@ -719,22 +1027,115 @@ size_t UCTNode::count_nodes_and_clear_expand_state() {
     return nodecount;
 }
 
+size_t UCTNode::get_tree_bytes() const {
+    auto bytes = NodeArena::round_size(sizeof(UCTNode));
+    if (m_child_stats) {
+        bytes += NodeArena::round_size(
+            m_children.capacity() * sizeof(UCTNodePointer));
+        bytes += NodeArena::round_size(
+            ChildStats::get_bytes(m_child_stats->capacity));
+    }
+    if (auto stats = m_subtree_stats.load()) {
+        bytes += NodeArena::round_size(sizeof(SubtreeStats));
+        if (stats->pending) {
+            bytes += NodeArena::round_size(sizeof(SubtreeSamples));
+        }
+    }
+    for (const auto& child : m_children) {
+        if (child.is_inflated()) {
+            bytes += child->get_tree_bytes();
+        }
+    }
+    return bytes;
+}
+
+// Copy this node and its subtree into arena. Only to be called
+// between searches, when no thread is touching the tree.
+UCTNode* UCTNode::relocate(NodeArena& arena,
+                           TranspositionTable* transpositions) const {
+    auto stats = ChildStats::create(arena, 1);
+    return relocate(arena, transpositions, stats, 0);
+}
+
+UCTNode* UCTNode::relocate(NodeArena& arena,
+                           TranspositionTable* transpositions,
+                           ChildStats* stats, size_t slot) const {
+    stats->copy_slot(slot, *m_stats, m_slot);
+    auto node = arena.create<UCTNode>(stats, slot);
+    node->m_net_eval = m_net_eval;
+    node->m_net_alpkt = m_net_alpkt;
+    node->m_net_beta = m_net_beta;
+    node->m_eval_bonus = m_eval_bonus;
+    node->m_eval_base = m_eval_base;
+    node->m_eval_base_father = m_eval_base_father;
+    node->m_eval_bonus_father = m_eval_bonus_father;
+#ifdef USE_EVALCMD
+    node->m_progid.reserve(m_progid.size());
+    for (auto id : m_progid) {
+        node->m_progid.push_back(id);
+    }
+#endif
+#ifndef NDEBUG
+    node->m_last_urgency = m_last_urgency;
+#endif
+    node->m_agent_eval = m_agent_eval;
+    node->m_squared_eval_diff = m_squared_eval_diff.load();
+    node->m_alpkt_median = m_alpkt_median.load();
+    // The queued samples are added, but the copy doesn't queue them
+    // until it is prepared as the root.
+    if (auto stats = flush_subtree_stats()) {
+        auto copy = arena.create<SubtreeStats>();
+        copy->alpkt = stats->alpkt;
+        copy->tt_alpkt = stats->tt_alpkt;
+        copy->beta = stats->beta;
+        copy->eval_sum = stats->eval_sum;
+        node->m_subtree_stats = copy;
+    }
+    const auto transposition = m_transposition.load();
+    if (transposition != nullptr && transpositions != nullptr) {
+        node->m_transposition =
+            transpositions->relocate(*transposition, arena);
+    }
+    node->m_collisions = m_collisions.load();
+    node->m_min_psa_ratio_children = m_min_psa_ratio_children.load();
+
+    if (!m_child_stats) {
+        return node;
+    }
+    auto child_stats = ChildStats::create(arena, m_children.size());
+    node->m_children.reserve(m_children.size());
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        const auto& child = m_children[i];
+        if (child.is_inflated()) {
+            node->m_children.emplace_back(
+                child->relocate(arena, transpositions, child_stats, i));
+        } else {
+            child_stats->copy_slot(i, *m_child_stats, i);
+            node->m_children.emplace_back(child.get_move(),
+                                          child.get_policy());
+        }
+    }
+    node->m_child_stats = child_stats;
+    return node;
+}
+
 void UCTNode::invalidate() {
-    m_status = INVALID;
+    m_stats->status[m_slot] = ChildStats::INVALID;
 }
 
 void UCTNode::set_active(const bool active) {
     if (valid()) {
-        m_status = active ? ACTIVE : PRUNED;
+        m_stats->status[m_slot] =
+            active ? ChildStats::ACTIVE : ChildStats::PRUNED;
     }
 }
 
 bool UCTNode::valid() const {
-    return m_status != INVALID;
+    return m_stats->status[m_slot] != ChildStats::INVALID;
 }
 
 bool UCTNode::active() const {
-    return m_status == ACTIVE;
+    return m_stats->status[m_slot] == ChildStats::ACTIVE;
 }
 
 UCTNode* UCTNode::select_child(int move) {
@@ -743,85 +1144,164 @@ UCTNode* UCTNode::select_child(int move) {
     for (auto& child : m_children) {
         if (child.get_move() == move) {
             selected = &child;
-            selected->inflate();
-            return selected->get();
+            return inflate_child(*selected);
         }
     }
     return nullptr;
 }
 
-void UCTNode::get_subtree_alpkts(std::vector<float> & vector,
-                                 int passes,
-                                 bool is_tromptaylor_scoring) const {
-    auto children_visits = 0;
-
-    // check and correct: 'passes' doesn't do anything here.
+void UCTNode::update_subtree_stats(const UCTNode& leaf, bool new_leaf) {
+    // A node is not part of its own subtree statistics, but the later
+    // visits ending on it are.
+    if (&leaf != this || !new_leaf) {
+        add_subtree_sample(leaf, new_leaf);
+    }
+}
 
-    vector.emplace_back(get_net_alpkt());
-    for (auto& child : m_children) {
-        const auto child_visits = child.get_visits();
-        if (child_visits > 0) {
-            const auto pass = (child.get_move() == FastBoard::PASS) ? 1 : 0;
-            child->get_subtree_alpkts(vector, ++passes * pass,
-                                      is_tromptaylor_scoring);
-                       children_visits += child_visits;
-        }
+void SubtreeStats::add(const SubtreeSamples::Sample& sample) {
+    if (sample.new_node) {
+        alpkt.add(sample.alpkt);
+        beta.add(sample.beta);
+        eval_sum += sample.eval;
     }
+    tt_alpkt.add(sample.alpkt);
+}
 
-    const auto missing_nodes = get_visits() - children_visits - 1;
-    if (missing_nodes > 0 && is_tromptaylor_scoring) {
-        // check: this seems to happen only on second pass node, where
-        // get_net_alpkt() would return a meningless value
+static size_t subtree_samples_slot() {
+    static std::atomic<size_t> next_slot{0};
+    thread_local auto slot = next_slot++ % SubtreeSamples::SLOTS;
+    return slot;
+}
 
-        const std::vector<float> rep(missing_nodes, get_net_alpkt());
-        vector.insert(vector.end(), std::begin(rep), std::end(rep));
+SubtreeStats* UCTNode::get_or_create_subtree_stats() {
+    auto stats = m_subtree_stats.load();
+    if (stats == nullptr) {
+        auto created = NodeArena::owner(this).create<SubtreeStats>();
+        // On failure another thread won the race and stats is its block.
+        if (m_subtree_stats.compare_exchange_strong(stats, created)) {
+            stats = created;
+        }
     }
+    return stats;
+}
 
-    return;
+void UCTNode::batch_subtree_stats() {
+    auto stats = get_or_create_subtree_stats();
+    if (stats->pending == nullptr) {
+        stats->pending = NodeArena::owner(this).create<SubtreeSamples>();
+    }
 }
 
-float UCTNode::estimate_alpkt(int passes,
-                              bool is_tromptaylor_scoring) const {
-    std::vector<float> subtree_alpkts;
+SubtreeStats* UCTNode::flush_subtree_stats() const {
+    const auto stats = m_subtree_stats.load();
+    if (stats == nullptr || stats->pending == nullptr) {
+        return stats;
+    }
+    for (auto& slot : stats->pending->slots) {
+        LOCK(slot.mutex, slot_lock);
+        if (slot.size > 0) {
+            LOCK(stats->mutex, lock);
+            for (auto i = size_t{0}; i < slot.size; i++) {
+                stats->add(slot.samples[i]);
+            }
+            slot.size = 0;
+        }
+    }
+    return stats;
+}
 
-    get_subtree_alpkts(subtree_alpkts, passes, is_tromptaylor_scoring);
+void UCTNode::add_subtree_sample(const UCTNode& node, bool new_node) {
+    const auto stats = get_or_create_subtree_stats();
+    const auto sample = SubtreeSamples::Sample{
+        node.get_net_alpkt(), node.get_net_beta(), node.get_net_eval(),
+        new_node};
+
+    if (const auto pending = stats->pending) {
+        auto& slot = pending->slots[subtree_samples_slot()];
+        LOCK(slot.mutex, slot_lock);
+        slot.samples[slot.size++] = sample;
+        if (slot.size == SubtreeSamples::BATCH) {
+            LOCK(stats->mutex, lock);
+            for (const auto& queued : slot.samples) {
+                stats->add(queued);
+            }
+            slot.size = 0;
+        }
+        return;
+    }
 
-    return Utils::median(subtree_alpkts);
+    LOCK(stats->mutex, lock);
+    stats->add(sample);
 }
 
-void UCTNode::get_subtree_betas(std::vector<float> & vector) const {
-    vector.emplace_back(get_net_beta());
+// Feed the statistics of ancestor with this node and its subtree, as
+// the search would have done one simulation at a time.
+void UCTNode::add_subtree_samples(UCTNode& ancestor) const {
+    auto children_visits = 0;
     for (auto& child : m_children) {
-        if (child.get_visits() > 0) {
-            child->get_subtree_betas(vector);
+        const auto child_visits = child.get_visits();
+        if (child_visits > 0) {
+            child->add_subtree_samples(ancestor);
+            children_visits += child_visits;
         }
     }
+
+    if (this != &ancestor) {
+        ancestor.add_subtree_sample(*this, true);
+    }
+    const auto later_visits = get_visits() - children_visits - 1;
+    for (auto i = 0; i < later_visits; i++) {
+        ancestor.add_subtree_sample(*this, false);
+    }
 }
 
-float UCTNode::get_beta_median() const {
-    std::vector<float> subtree_betas;
+// Only needed when visited children are removed, not thread safe.
+void UCTNode::rebuild_subtree_stats() {
+    m_subtree_stats = nullptr;
+    add_subtree_samples(*this);
+}
 
-    get_subtree_betas(subtree_betas);
+float UCTNode::estimate_alpkt(int /*passes*/,
+                              bool is_tromptaylor_scoring) const {
+    // check and correct: 'passes' doesn't do anything here.
 
-    return Utils::median(subtree_betas);
+    auto alpkts = MedianEstimator{};
+    if (auto stats = flush_subtree_stats()) {
+        LOCK(stats->mutex, lock);
+        alpkts = is_tromptaylor_scoring ? stats->tt_alpkt : stats->alpkt;
+    }
+    alpkts.add(get_net_alpkt());
+    return alpkts.get_median();
 }
 
-void UCTNode::az_sum_recursion(float& sum, size_t& n) const {
-    sum += get_net_eval();
-    n++;
-    for (auto& child : m_children) {
-        if (child.get_visits() > 0) {
-            child->az_sum_recursion(sum, n);
-        }
+std::array<float, 5> UCTNode::get_alpkt_quartiles() const {
+    auto alpkts = MedianEstimator{};
+    if (auto stats = flush_subtree_stats()) {
+        LOCK(stats->mutex, lock);
+        alpkts = stats->alpkt;
     }
+    alpkts.add(get_net_alpkt());
+    return alpkts.get_quartiles();
 }
 
-float UCTNode::get_azwinrate_avg() const {
-    auto sum = 0.0f;
-    auto n = size_t{0};
-
-    az_sum_recursion(sum, n);
+float UCTNode::get_beta_median() const {
+    auto betas = MedianEstimator{};
+    if (auto stats = flush_subtree_stats()) {
+        LOCK(stats->mutex, lock);
+        betas = stats->beta;
+    }
+    betas.add(get_net_beta());
+    return betas.get_median();
+}
 
+float UCTNode::get_azwinrate_avg() const {
+    auto sum = double{get_net_eval()};
+    auto n = size_t{1};
+    if (auto stats = flush_subtree_stats()) {
+        LOCK(stats->mutex, lock);
+        sum += stats->eval_sum;
+        n += stats->alpkt.size();
+    }
     return static_cast<float>(sum / double(n));
 }
 
@@ -837,26 +1317,28 @@ UCTStats UCTNode::get_uct_stats() const {
 bool UCTNode::acquire_expanding() {
     auto expected = ExpandState::INITIAL;
     auto newval = ExpandState::EXPANDING;
-    return m_expand_state.compare_exchange_strong(expected, newval);
+    return m_stats->expand_state[m_slot].compare_exchange_strong(expected,
+                                                                newval);
 }
 
 void UCTNode::expand_done() {
-    auto v = m_expand_state.exchange(ExpandState::EXPANDED);
+    auto v = m_stats->expand_state[m_slot].exchange(ExpandState::EXPANDED);
 #ifdef NDEBUG
     (void)v;
 #endif
     assert(v == ExpandState::EXPANDING);
 }
 void UCTNode::expand_cancel() {
-    auto v = m_expand_state.exchange(ExpandState::INITIAL);
+    auto v = m_stats->expand_state[m_slot].exchange(ExpandState::INITIAL);
 #ifdef NDEBUG
     (void)v;
 #endif
     assert(v == ExpandState::EXPANDING);
 }
 void UCTNode::wait_expanded() {
-    while (m_expand_state.load() == ExpandState::EXPANDING) {}
-    auto v = m_expand_state.load();
+    const auto& expand_state = m_stats->expand_state[m_slot];
+    while (expand_state.load() == ExpandState::EXPANDING) {}
+    auto v = expand_state.load();
 #ifdef NDEBUG
     (void)v;
 #endif
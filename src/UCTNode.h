@@ -33,6 +33,7 @@
 
 #include "config.h"
 
+#include <array>
 #include <atomic>
 #include <memory>
 #include <vector>
@@ -41,8 +42,11 @@
 #include <cstring>
 
 #include "GameState.h"
+#include "MedianEstimator.h"
 #include "Network.h"
+#include "NodeArena.h"
 #include "SMP.h"
+#include "TranspositionTable.h"
 #include "UCTNodePointer.h"
 #include "UCTSearch.h"
 
@@ -52,14 +56,122 @@ struct UCTStats {
     float azwinrate_avg;
 };
 
+// The statistics of the children of a node that PUCT selection reads for
+// every child, kept by the parent in one array per field.  Selecting a
+// child then scans a few contiguous arrays instead of dereferencing one
+// UCTNode per child.  Every child has a slot, inflated or not, and an
+// inflated UCTNode reads and updates its own slot through m_stats and
+// m_slot.  The root gets a block with a single slot.
+struct ChildStats {
+    enum Status : char {
+        INVALID, // superko
+        PRUNED,
+        ACTIVE
+    };
+
+    // expand_state acts as the lock for the children of the node.
+    // see UCTNode manipulation methods for possible state transition
+    enum class ExpandState : std::uint8_t {
+        // initial state, no children
+        INITIAL = 0,
+
+        // creating children.  the thread that changed the node's state to
+        // EXPANDING is responsible of finishing the expansion and then
+        // move to EXPANDED, or revert to INITIAL if impossible
+        EXPANDING,
+
+        // expansion done.  m_children cannot be modified on a multi-thread
+        // context, until node is destroyed.
+        EXPANDED,
+    };
+
+    // The fields of one slot, to move slots within a block.
+    struct Slot {
+        double blackevals;
+        int visits;
+        int forced;
+        float policy;
+        std::int16_t virtual_loss;
+        std::int16_t move;
+        Status status;
+        ExpandState expand_state;
+    };
+
+    static ChildStats* create(NodeArena& arena, size_t capacity,
+                              bool interleaved = false);
+    static size_t get_bytes(size_t capacity);
+    // Slot of a child that has never been visited.
+    void init_slot(size_t i, int move, float policy);
+    void copy_slot(size_t i, const ChildStats& from, size_t j);
+    Slot get_slot(size_t i) const;
+    void set_slot(size_t i, const Slot& slot);
+
+    size_t capacity;
+    std::atomic<double>* blackevals;
+    std::atomic<int>* visits;
+    // number of forced moves visited after this node, to be
+    // subtracted from visits in the denominator of psa
+    std::atomic<int>* forced;
+    float* policy;
+    std::atomic<std::int16_t>* virtual_loss;
+    std::int16_t* move;
+    std::atomic<Status>* status;
+    std::atomic<ExpandState>* expand_state;
+};
+
+// Samples of a SubtreeStats not added to it yet.  Every simulation
+// updates the statistics of the root, so there each thread queues its
+// samples in its own slot and takes the statistics lock once per batch.
+struct SubtreeSamples {
+    static constexpr size_t SLOTS = 16;
+    static constexpr size_t BATCH = 32;
+    struct Sample {
+        float alpkt;
+        float beta;
+        float eval;
+        bool new_node;
+    };
+    struct Slot {
+        SMP::Mutex mutex;
+        size_t size{0};
+        std::array<Sample, BATCH> samples;
+    };
+    std::array<Slot, SLOTS> slots;
+};
+
+// Statistics over the visited nodes below a node, excluding the node
+// itself.  They are updated during the backup of every simulation that
+// reaches a new node, so reading them does not walk the subtree.
+struct SubtreeStats {
+    SMP::Mutex mutex;
+    // net alpkt of the nodes
+    MedianEstimator alpkt;
+    // as alpkt, but a node also counts once more for each later visit
+    // that ended there, such as a double pass scored by Tromp-Taylor
+    MedianEstimator tt_alpkt;
+    // net beta of the nodes
+    MedianEstimator beta;
+    // sum of the net evals of the nodes
+    double eval_sum{0.0};
+    // Only set on the root, by UCTNode::batch_subtree_stats().  The
+    // slots are locked before the statistics.
+    SubtreeSamples* pending{nullptr};
+
+    // The caller holds mutex.
+    void add(const SubtreeSamples::Sample& sample);
+};
+
 class UCTNode {
 public:
     // When we visit a node, add this amount of virtual losses
     // to it to encourage other CPUs to explore other parts of the
     // search tree.
     static constexpr auto VIRTUAL_LOSS_COUNT = 3;
+    // Upper bound of the adaptive virtual loss of cfg_collision_aware,
+    // so that the 16 bit counters can't overflow with many threads.
+    static constexpr auto MAX_VIRTUAL_LOSS_COUNT = 10 * VIRTUAL_LOSS_COUNT;
     // Defined in UCTNode.cpp
-    explicit UCTNode(int vertex, float policy);
+    UCTNode(ChildStats* stats, size_t slot);
     UCTNode() = delete;
     ~UCTNode() = default;
 
@@ -67,9 +179,12 @@ public:
                          std::atomic<int>& nodecount,
                          GameState& state, float& value, float& alpkt,
                                      float& beta,
-                         float min_psa_ratio = 0.0f);
+                         float min_psa_ratio = 0.0f,
+                         TranspositionEntry* transposition = nullptr);
 
-    const std::vector<UCTNodePointer>& get_children() const;
+    const ArenaVector<UCTNodePointer>& get_children() const;
+    // The arrays uct_select_child() scans
+    const ChildStats* get_child_stats() const;
     void sort_children_by_policy();
     void sort_children(int color, float lcb_min_visits);
     UCTNode& get_best_root_child(int color);
@@ -79,6 +194,10 @@ public:
                               bool nopass = false);
 
     size_t count_nodes_and_clear_expand_state();
+    size_t get_tree_bytes() const;
+    UCTNode* relocate(NodeArena& arena,
+                      TranspositionTable* transpositions) const;
+    static UCTNode* create_root(NodeArena& arena);
     bool first_visit() const;
     bool has_children() const;
     bool expandable(const float min_psa_ratio = 0.0f) const;
@@ -111,15 +230,17 @@ public:
     bool low_visits_child(UCTNode* const child) const;
 #ifdef USE_EVALCMD
     void set_progid(int id);
-    std::vector<int>& get_progid();
+    ArenaVector<int>& get_progid();
 #endif
 #ifndef NDEBUG
     void set_urgency(float urgency, float psa, float q,
                      float num, float den);
     std::array<float, 5> get_urgency() const;
 #endif
-    void virtual_loss();
-    void virtual_loss_undo();
+    void virtual_loss(int count = VIRTUAL_LOSS_COUNT);
+    void virtual_loss_undo(int count = VIRTUAL_LOSS_COUNT);
+    void add_collision();
+    int get_collisions() const;
     void clear_visits();
     void clear_children_visits();
     void update(float eval, bool forced=false);
@@ -140,32 +261,53 @@ public:
     UCTNode* get_first_child() const;
     UCTNode* get_second_child() const;
     UCTNode* get_nopass_child(FastState& state) const;
-    std::unique_ptr<UCTNode> find_child(const int move);
+    UCTNode* find_child(const int move);
     void inflate_all_children();
+    // Moves the children arrays to memory spread over all the NUMA nodes
+    void interleave_children_memory();
     UCTNode* select_child(int move);
     float estimate_alpkt(int passes, bool is_tromptaylor_scoring = false) const;
+    // Minimum, quartiles and maximum of the net alpkt of this node and
+    // the visited nodes below it
+    std::array<float, 5> get_alpkt_quartiles() const;
     float get_beta_median() const;
     float get_azwinrate_avg() const;
     UCTStats get_uct_stats() const;
     void update_alpkt_median(float new_alpkt_value);
+    // Account for the simulation that ended on leaf, which was
+    // visited for the first time if new_leaf
+    void update_subtree_stats(const UCTNode& leaf, bool new_leaf);
+    // Queue the samples of update_subtree_stats() per thread, for the
+    // root.  Only between searches.
+    void batch_subtree_stats();
 
     void clear_expand_state();
+    // Recomputes the agent evaluations after cfg_lambda or cfg_mu
+    // changed, and backs them up again.  Only between searches.
+    void refresh_agent_evals();
 private:
-    enum Status : char {
-        INVALID, // superko
-        PRUNED,
-        ACTIVE
-    };
+    using Status = ChildStats::Status;
+    using ExpandState = ChildStats::ExpandState;
+
     void link_nodelist(std::atomic<int>& nodecount,
                        std::vector<Network::PolicyVertexPair>& nodelist,
                        float min_psa_ratio);
     void accumulate_eval(float eval);
     void kill_superkos(const GameState& state);
     void dirichlet_noise(float epsilon, float alpha);
-    void get_subtree_alpkts(std::vector<float> & vector, int passes,
-                            bool is_tromptaylor_scoring) const;
-    void get_subtree_betas(std::vector<float> & vector) const;
-    void az_sum_recursion(float& sum, size_t& n) const;
+    SubtreeStats* get_or_create_subtree_stats();
+    // The subtree statistics with the queued samples added, if any.
+    SubtreeStats* flush_subtree_stats() const;
+    void add_subtree_sample(const UCTNode& node, bool new_node);
+    void add_subtree_samples(UCTNode& ancestor) const;
+    void rebuild_subtree_stats();
+    UCTNode* inflate_child(const UCTNodePointer& child) const;
+    void sync_child_stats();
+    UCTNode* relocate(NodeArena& arena, TranspositionTable* transpositions,
+                      ChildStats* stats, size_t slot) const;
+    void publish_eval(TranspositionEntry& transposition,
+                      const std::vector<Network::PolicyVertexPair>& nodelist);
+    void refresh_agent_evals(std::vector<UCTNode*>& path);
 
     // Note : This class is very size-sensitive as we are going to create
     // tens of millions of instances of these.  Please put extra caution
@@ -173,14 +315,9 @@ private:
 
     // Move
     std::int16_t m_move;
-    // UCT
-    std::atomic<std::int16_t> m_virtual_loss{0};
-    std::atomic<int> m_visits{0};
-    // number of forced moves visited after this node, to be
-    // subtracted from visits in the denominator of psa
-    std::atomic<int> m_forced{0};
-    // UCT eval
-    float m_policy;
+    // Slot in m_stats holding the UCT statistics of this node
+    std::uint16_t m_slot;
+    ChildStats* m_stats;
     // Original net eval for this node (not children).
     float m_net_eval{0.5f};
     //    float m_net_value{0.5f};
@@ -191,7 +328,7 @@ private:
     float m_eval_base_father{0.0f}; // x base of father node
     float m_eval_bonus_father{0.0f}; // x bar of father node
 #ifdef USE_EVALCMD
-    std::vector<int> m_progid; // progressive unique identifier,
+    ArenaVector<int> m_progid; // progressive unique identifier,
                                // typically it is just one integer,
                                // but a second pass can be visited
                                // more than once and in that case the
@@ -207,31 +344,21 @@ private:
     // Initialized to small non-zero value to avoid accidental zero variances
     // at low visits.
     std::atomic<float> m_squared_eval_diff{1e-4f};
-    std::atomic<double> m_blackevals{0.0};
-    std::atomic<Status> m_status{ACTIVE};
 
     std::atomic<float> m_alpkt_median{0.0f};
-
-    // m_expand_state acts as the lock for m_children.
-    // see manipulation methods below for possible state transition
-    enum class ExpandState : std::uint8_t {
-        // initial state, no children
-        INITIAL = 0,
-
-        // creating children.  the thread that changed the node's state to
-        // EXPANDING is responsible of finishing the expansion and then
-        // move to EXPANDED, or revert to INITIAL if impossible
-        EXPANDING,
-
-        // expansion done.  m_children cannot be modified on a multi-thread
-        // context, until node is destroyed.
-        EXPANDED,
-    };
-    std::atomic<ExpandState> m_expand_state{ExpandState::INITIAL};
+    // Allocated with the first node reached below this one
+    std::atomic<SubtreeStats*> m_subtree_stats{nullptr};
+    // Position shared with other nodes, only with cfg_transpositions
+    std::atomic<TranspositionEntry*> m_transposition{nullptr};
+    // Simulations through this node that ended on a leaf another
+    // thread was already expanding, only with cfg_collision_aware
+    std::atomic<int> m_collisions{0};
 
     // Tree data
     std::atomic<float> m_min_psa_ratio_children{2.0f};
-    std::vector<UCTNodePointer> m_children;
+    ArenaVector<UCTNodePointer> m_children;
+    // Statistics of m_children, slot i belongs to m_children[i]
+    ChildStats* m_child_stats{nullptr};
 
     //  m_expand_state manipulation methods
     // INITIAL -> EXPANDING
@@ -35,32 +35,19 @@
 #include <cassert>
 #include <cstring>
 
+#include "NodeArena.h"
 #include "UCTNode.h"
 //#include "Utils.h"
 
-std::atomic<size_t> UCTNodePointer::m_tree_size = {0};
-
 size_t UCTNodePointer::get_tree_size() {
-    return m_tree_size.load();
-}
-
-void UCTNodePointer::increment_tree_size(size_t sz) {
-    m_tree_size += sz;
-}
-
-void UCTNodePointer::decrement_tree_size(size_t sz) {
-    assert(UCTNodePointer::m_tree_size >= sz);
-    m_tree_size -= sz;
+    return NodeArena::get_total_slab_bytes();
 }
 
 UCTNodePointer::~UCTNodePointer() {
-    auto sz = sizeof(UCTNodePointer);
     auto v = m_data.load();
     if (is_inflated(v)) {
-        delete read_ptr(v);
-        sz += sizeof(UCTNode);
+        read_ptr(v)->~UCTNode();
     }
-    decrement_tree_size(sz);
 }
 
 UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
@@ -71,7 +58,6 @@ UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
 #else
     assert(v == INVALID);
 #endif
-    increment_tree_size(sizeof(UCTNodePointer));
 }
 
 UCTNodePointer::UCTNodePointer(std::int16_t vertex, float policy) {
@@ -81,7 +67,12 @@ UCTNodePointer::UCTNodePointer(std::int16_t vertex, float policy) {
 
     m_data =  (static_cast<std::uint64_t>(i_policy) << 32)
             | (static_cast<std::uint64_t>(i_vertex) << 16);
-    increment_tree_size(sizeof(UCTNodePointer));
+}
+
+UCTNodePointer::UCTNodePointer(UCTNode* node) {
+    auto v = reinterpret_cast<std::uint64_t>(node);
+    assert((v & 3ULL) == 0);
+    m_data = v | POINTER;
 }
 
 UCTNodePointer& UCTNodePointer::operator=(UCTNodePointer&& n) {
@@ -89,35 +80,33 @@ UCTNodePointer& UCTNodePointer::operator=(UCTNodePointer&& n) {
     auto v = std::atomic_exchange(&m_data, nv);
 
     if (is_inflated(v)) {
-        decrement_tree_size(sizeof(UCTNode));
-        delete read_ptr(v);
+        read_ptr(v)->~UCTNode();
     }
     return *this;
 }
 
 UCTNode * UCTNodePointer::release() {
     auto v = std::atomic_exchange(&m_data, INVALID);
-    decrement_tree_size(sizeof(UCTNode));
     return read_ptr(v);
 }
 
-void UCTNodePointer::inflate() const {
+void UCTNodePointer::inflate(ChildStats* stats, size_t slot) const {
     while (true) {
         auto v = m_data.load();
         if (is_inflated(v)) return;
 
+        auto& arena = NodeArena::owner(this);
         auto v2 = reinterpret_cast<std::uint64_t>(
-            new UCTNode(read_vertex(v), read_policy(v)));
+            arena.create<UCTNode>(stats, slot));
         assert((v2 & 3ULL) == 0);
         v2 |= POINTER;
         bool success = m_data.compare_exchange_strong(v, v2);
         if (success) {
-            increment_tree_size(sizeof(UCTNode));
             return;
         } else {
             // this means that somebody else also modified this instance.
             // Try again next time
-            delete read_ptr(v2);
+            read_ptr(v2)->~UCTNode();
         }
     }
 }
@@ -40,6 +40,7 @@
 #include "SMP.h"
 
 class UCTNode;
+struct ChildStats;
 
 // 'lazy-initializable' version of std::unique_ptr<UCTNode>.
 // When a UCTNodePointer is constructed, the constructor arguments
@@ -49,6 +50,9 @@ class UCTNode;
 // of:
 //  - std::unique_ptr<UCTNode> pointer;
 //  - std::pair<float, std::int16_t> args;
+// The UCTNode is allocated from the NodeArena holding the pointer, so
+// destroying it releases no memory: that happens when the arena drops
+// the generation.
 
 // All methods should be thread-safe except destructor and when
 // the instanced is 'moved from'.
@@ -59,10 +63,6 @@ private:
     static constexpr std::uint64_t POINTER = 1;
     static constexpr std::uint64_t UNINFLATED = 0;
 
-    static std::atomic<size_t> m_tree_size;
-    static void increment_tree_size(size_t sz);
-    static void decrement_tree_size(size_t sz);
-
     // the raw storage used here.
     // if bit [1:0] is 1, m_data is the actual pointer.
     // if bit [1:0] is 0, bit [31:16] is the vertex value, bit [63:32] is the policy
@@ -101,6 +101,7 @@ public:
     ~UCTNodePointer();
     UCTNodePointer(UCTNodePointer&& n);
     UCTNodePointer(std::int16_t vertex, float policy);
+    explicit UCTNodePointer(UCTNode* node);
     UCTNodePointer(const UCTNodePointer&) = delete;
 
 
@@ -121,8 +122,9 @@ public:
     UCTNodePointer& operator=(UCTNodePointer&& n);
     UCTNode * release();
 
-    // construct UCTNode instance from the vertex/policy pair
-    void inflate() const;
+    // construct UCTNode instance, keeping its statistics in the
+    // given slot of the parent's ChildStats
+    void inflate(ChildStats* stats, size_t slot) const;
 
     // proxy of UCTNode methods which can be called without
     // constructing UCTNode
@@ -59,8 +59,7 @@ UCTNode* UCTNode::get_first_child() const {
         return nullptr;
     }
 
-    m_children.front().inflate();
-    return m_children.front().get();
+    return inflate_child(m_children.front());
 }
 
 UCTNode* UCTNode::get_second_child() const {
@@ -68,8 +67,7 @@ UCTNode* UCTNode::get_second_child() const {
         return nullptr;
     }
 
-    m_children[1].inflate();
-    return m_children[1].get();
+    return inflate_child(m_children[1]);
 }
 
 void UCTNode::kill_superkos(const GameState& state) {
@@ -102,11 +100,19 @@ void UCTNode::kill_superkos(const GameState& state) {
     }
 
     // Now do the actual deletion.
+    const auto had_visits = std::any_of(
+        begin(m_children), end(m_children), [](const auto &child) {
+            return !child->valid() && child->get_visits() > 0;
+        });
     m_children.erase(
         std::remove_if(begin(m_children), end(m_children),
                        [](const auto &child) { return !child->valid(); }),
         end(m_children)
     );
+    sync_child_stats();
+    if (had_visits) {
+        rebuild_subtree_stats();
+    }
 }
 
 void UCTNode::dirichlet_noise(float epsilon, float alpha) {
@@ -237,6 +243,7 @@ std::tuple<bool,std::vector<int>>
     if (index != 0) {
         // Now swap the child at index with the first child
         std::iter_swap(begin(m_children), begin(m_children) + index);
+        sync_child_stats();
     }
 
     return std::make_tuple(blunder_vector[index], non_blunders);
@@ -257,12 +264,12 @@ UCTNode* UCTNode::get_nopass_child(FastState& state) const {
 }
 
 // Used to find new root in UCTSearch.
-std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
+UCTNode* UCTNode::find_child(const int move) {
     for (auto& child : m_children) {
         if (child.get_move() == move) {
              // no guarantee that this is a non-inflated node
-            child.inflate();
-            return std::unique_ptr<UCTNode>(child.release());
+            inflate_child(child);
+            return child.release();
         }
     }
 
@@ -272,7 +279,34 @@ std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
 
 void UCTNode::inflate_all_children() {
     for (const auto& node : get_children()) {
-        node.inflate();
+        inflate_child(node);
+    }
+}
+
+void UCTNode::interleave_children_memory() {
+    // The arrays are only a few pages, interleaving them where they are
+    // would leave them mostly alone since pages shared with other
+    // objects aren't moved.  Copy them to interleaved slabs instead.
+    if (m_children.empty()) {
+        return;
+    }
+    auto& arena = NodeArena::owner(this);
+    if (NodeArena::numa_node(m_children.begin()) != NodeArena::INTERLEAVED) {
+        const auto capacity = m_children.capacity();
+        m_children.move_storage(
+            arena.allocate_interleaved(capacity * sizeof(UCTNodePointer)),
+            capacity);
+    }
+    if (NodeArena::numa_node(m_child_stats) != NodeArena::INTERLEAVED) {
+        auto stats = ChildStats::create(arena, m_child_stats->capacity, true);
+        for (auto i = size_t{0}; i < m_children.size(); i++) {
+            stats->copy_slot(i, *m_child_stats, i);
+            const auto& child = m_children[i];
+            if (child.is_inflated()) {
+                child->m_stats = stats;
+            }
+        }
+        m_child_stats = stats;
     }
 }
 
@@ -311,6 +345,15 @@ void UCTNode::prepare_root_node(Network & network, int color,
     // This also removes a lot of special cases.
     kill_superkos(root_state);
 
+    if (cfg_numa_interleave_root) {
+        // Every simulation of every thread reads the statistics of
+        // the children of the root.
+        interleave_children_memory();
+    }
+
+    // And updates the subtree statistics of the root.
+    batch_subtree_stats();
+
     if (fast_roll_out) {
         return;
     }
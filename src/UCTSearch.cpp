@@ -35,9 +35,11 @@
 #include <cassert>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <numeric>
 #include <sstream>
 #include <string>
 #include <type_traits>
@@ -57,9 +59,6 @@
 #include "Timing.h"
 #include "Training.h"
 #include "Utils.h"
-#ifdef USE_OPENCL
-#include "OpenCLScheduler.h"
-#endif
 #include "Network.h"
 #include "Random.h"
 
@@ -121,18 +120,59 @@ UCTSearch::UCTSearch(GameState& g, Network& network)
     set_playout_limit(cfg_max_playouts);
     set_visit_limit(cfg_max_visits);
 
-    m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    create_root();
 }
 
 void UCTSearch::reset() {
     set_playout_limit(cfg_max_playouts);
     set_visit_limit(cfg_max_visits);
 
-    m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    create_root();
     m_last_rootstate.reset(nullptr);
     m_nodes = m_root->count_nodes_and_clear_expand_state();
 }
 
+void UCTSearch::refresh_agent_evals() {
+    // The net values don't depend on lambda and mu, the agent
+    // evaluations and what was backed up with them do.
+    if (!m_network.m_value_head_sai || !m_root) {
+        return;
+    }
+    if (m_transpositions) {
+        m_transpositions->refresh_agent_evals();
+    }
+    // A reused root still has the values of its parent in the previous
+    // tree, computed with the old lambda and mu.  Replay its visits as
+    // those of a new root.
+    m_root->set_eval_bonus_father(0.0f);
+    m_root->set_eval_base_father(0.0f);
+    m_root->refresh_agent_evals();
+}
+
+const UCTNode* UCTSearch::get_root() const {
+    return m_root;
+}
+
+std::array<float, 5> UCTSearch::get_alpkt_quartiles(float& beta_median) {
+    // Only a report: the tree is read if the last search was on this
+    // position, but never prepared or discarded here.
+    if (m_root && m_root->has_children() && m_last_rootstate
+        && m_last_rootstate->get_movenum() == m_rootstate.get_movenum()
+        && m_last_rootstate->get_komi() == m_rootstate.get_komi()
+        && m_last_rootstate->board.get_hash()
+           == m_rootstate.board.get_hash()) {
+        beta_median = m_root->get_beta_median();
+        return m_root->get_alpkt_quartiles();
+    }
+
+    const auto netres = m_network.get_output(
+        &m_rootstate, Network::Ensemble::DIRECT,
+        Network::IDENTITY_SYMMETRY, cfg_use_nncache, cfg_use_nncache);
+    const auto alpkt = Network::get_extended(m_rootstate, netres).alpkt;
+    beta_median = netres.beta;
+    return {{alpkt, alpkt, alpkt, alpkt, alpkt}};
+}
+
 bool UCTSearch::advance_to_new_rootstate() {
     if (!m_root || !m_last_rootstate) {
         // No current state
@@ -161,30 +201,14 @@ bool UCTSearch::advance_to_new_rootstate() {
         return false;
     }
 
-    // Make sure that the nodes we destroyed the previous move are
-    // in fact destroyed.
-    while (!m_delete_futures.empty()) {
-        m_delete_futures.front().wait_all();
-        m_delete_futures.pop_front();
-    }
-
-    // Try to replay moves advancing m_root
+    // Try to replay moves advancing m_root.  The siblings we move away
+    // from are not destroyed: their memory is reclaimed together with
+    // the arena generation they belong to, see reclaim_tree_memory().
     for (auto i = 0; i < depth; i++) {
-        ThreadGroup tg(thread_pool);
-
         test->forward_move();
         const auto move = test->get_last_move();
 
-        auto oldroot = std::move(m_root);
-        m_root = oldroot->find_child(move);
-
-        // Lazy tree destruction.  Instead of calling the destructor of the
-        // old root node on the main thread, send the old root to a separate
-        // thread and destroy it from the child thread.  This will save a
-        // bit of time when dealing with large trees.
-        auto p = oldroot.release();
-        tg.add_task([p]() { delete p; });
-        m_delete_futures.push_back(std::move(tg));
+        m_root = m_root->find_child(move);
 
         if (!m_root) {
             // Tree hasn't been expanded this far
@@ -203,22 +227,62 @@ bool UCTSearch::advance_to_new_rootstate() {
     return true;
 }
 
+void UCTSearch::create_root() {
+    m_arena.clear();
+    if (m_transpositions) {
+        m_transpositions->clear();
+    }
+    m_root = UCTNode::create_root(m_arena);
+}
+
+void UCTSearch::reclaim_tree_memory() {
+    // Once more than a quarter of the arena is taken by subtrees we are
+    // no longer using, copy the reused tree to a fresh generation and
+    // release everything else at once.  Copying only when garbage is
+    // significant bounds it, while keeping the cost amortized over the
+    // allocations that created it.
+    const auto live_bytes = m_root->get_tree_bytes();
+    if (4 * live_bytes >= 3 * m_arena.get_allocated()) {
+        return;
+    }
+    m_arena.start_generation();
+    // Only the positions of the reused tree are indexed again.
+    if (m_transpositions) {
+        m_transpositions->clear();
+    }
+    m_root = m_root->relocate(m_arena, m_transpositions.get());
+    m_arena.release_previous_generations();
+}
+
 void UCTSearch::update_root(bool is_evaluating) {
     // Definition of m_playouts is playouts per search call.
     // So reset this count now.
     m_playouts = 0;
+    m_collisions = 0;
+    m_local_accesses = 0;
+    m_remote_accesses = 0;
 
 #ifndef NDEBUG
     auto start_nodes = m_root->count_nodes_and_clear_expand_state();
 #endif
 
     if ( (!advance_to_new_rootstate() && !is_evaluating) || !m_root) {
-        m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+        create_root();
+    } else {
+        reclaim_tree_memory();
     }
 
     // Clear last_rootstate to prevent accidental use.
     m_last_rootstate.reset(nullptr);
 
+    // Nodes expanded before the table existed are not indexed, they
+    // just don't share anything.
+    if (!cfg_transpositions) {
+        m_transpositions.reset();
+    } else if (!m_transpositions) {
+        m_transpositions = std::make_unique<TranspositionTable>();
+    }
+
     // Check how big our search tree (reused or new) is.
     m_nodes = m_root->count_nodes_and_clear_expand_state();
 
@@ -248,8 +312,72 @@ float UCTSearch::get_min_psa_ratio() const {
     return 0.0f;
 }
 
+// Tree nodes and child statistics read by the current simulation of
+// this thread, split by whether their memory is on the NUMA node the
+// thread runs on.  Only with cfg_numa.
+struct NumaAccesses {
+    int node{0};
+    int local{0};
+    int remote{0};
+};
+static thread_local NumaAccesses numa_accesses;
+
+static void count_numa_access(const void* p) {
+    const auto node = NodeArena::numa_node(p);
+    if (node == NodeArena::INTERLEAVED) {
+        // spread over the nodes on purpose
+        return;
+    }
+    if (node == numa_accesses.node) {
+        numa_accesses.local++;
+    } else {
+        numa_accesses.remote++;
+    }
+}
+
 SearchResult UCTSearch::play_simulation(GameState & currstate,
                                         UCTNode* const node) {
+    if (!cfg_collision_aware && !cfg_numa) {
+        return play_simulation(currstate, node,
+                               UCTNode::VIRTUAL_LOSS_COUNT);
+    }
+    auto virtual_loss = UCTNode::VIRTUAL_LOSS_COUNT;
+    if (cfg_collision_aware) {
+        m_in_flight++;
+        virtual_loss = get_virtual_loss();
+    }
+    if (cfg_numa) {
+        numa_accesses.node = SMP::get_numa_node();
+    }
+    const auto result = play_simulation(currstate, node, virtual_loss);
+    if (cfg_collision_aware) {
+        m_in_flight--;
+        if (result.is_collision()) {
+            m_collisions++;
+        }
+    }
+    if (cfg_numa) {
+        m_local_accesses += numa_accesses.local;
+        m_remote_accesses += numa_accesses.remote;
+        numa_accesses.local = numa_accesses.remote = 0;
+    }
+    return result;
+}
+
+// Number of virtual losses added by each simulation.  With
+// cfg_collision_aware it grows with the other threads in flight, in
+// proportion to how often the simulations of this search collide.
+int UCTSearch::get_virtual_loss() const {
+    const auto others = std::max(0, m_in_flight.load() - 1);
+    const auto collisions = m_collisions.load();
+    const auto rate = collisions / double(std::max(1, m_playouts + collisions));
+    const auto count = UCTNode::VIRTUAL_LOSS_COUNT * (1.0 + others * rate);
+    return std::min(UCTNode::MAX_VIRTUAL_LOSS_COUNT, static_cast<int>(count));
+}
+
+SearchResult UCTSearch::play_simulation(GameState & currstate,
+                                        UCTNode* const node,
+                                        const int virtual_loss) {
     auto result = SearchResult{};
 
 #ifndef NDEBUG
@@ -258,7 +386,10 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
     sminfo.visits = node->get_visits();
 #endif
 
-    node->virtual_loss();
+    node->virtual_loss(virtual_loss);
+    if (cfg_numa) {
+        count_numa_access(node);
+    }
 
     if (node->expandable()) {
         if (currstate.get_passes() >= 2) {
@@ -280,19 +411,23 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
 #endif
             }
 #ifdef USE_EVALCMD
-            if (m_evaluating && m_root.get() != node) {
+            if (m_evaluating && m_root != node) {
                 node->set_progid(m_nodecounter++);
             }
 #endif
         } else {
             float value, alpkt, beta;
             const auto had_children = node->has_children();
+            const auto transposition = m_transpositions ?
+                m_transpositions->find_or_insert(m_arena,
+                                                 currstate.board.get_hash())
+                : nullptr;
             const auto success =
                 node->create_children(m_network, m_nodes, currstate, value, alpkt, beta,
-                                      get_min_psa_ratio());
+                                      get_min_psa_ratio(), transposition);
             if (!had_children && success) {
 #ifdef USE_EVALCMD
-                if (m_evaluating && m_root.get() != node) {
+                if (m_evaluating && m_root != node) {
                     node->set_progid(m_nodecounter++);
                 }
 #endif
@@ -302,6 +437,10 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
                 sminfo.score = alpkt;
 #endif
             } else {
+                if (!had_children && cfg_collision_aware) {
+                    // Another thread got to expand this leaf first.
+                    result.set_collision();
+                }
 #ifndef NDEBUG
                 myprintf(": create_children() failed!\n");
 #endif
@@ -316,8 +455,11 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
     auto update_with_current = false;
 
     if (node->has_children() && !result.valid()) {
+        if (cfg_numa) {
+            count_numa_access(node->get_child_stats());
+        }
         auto next = node->uct_select_child(currstate,
-                                           node == m_root.get(),
+                                           node == m_root,
                                            m_per_node_maxvisits,
                                            m_allowed_root_children,
                                            m_nopass);
@@ -339,20 +481,20 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
                 if (m_nopass) {
                     currstate.set_passes(0);
                 }
-                result = play_simulation(currstate, next);
+                result = play_simulation(currstate, next, virtual_loss);
                 if (currstate.board.last_forced()) {
                     result.set_forced();
                 }
 
                 m_allowed_root_children = allowed;
-                if (m_stopping_flag && node == m_root.get()) {
+                if (m_stopping_flag && node == m_root) {
                     m_bestmove = move;
                 }
             }
             update_with_current = (restrict_return &&
                                    node->low_visits_child(next));
 #ifdef USE_EVALCMD
-            if (m_evaluating && node == m_root.get()) {
+            if (m_evaluating && node == m_root) {
                 set_firstmove(move);
             }
 #endif
@@ -389,6 +531,10 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
         node->update(eval, result.is_forced());
         // should check whether it is sai or lz before updating alpkt_median
         node->update_alpkt_median(result_for_updating.get_alpkt());
+        if (result.get_leaf() == nullptr) {
+            result.set_leaf(node, node->get_visits() == 1);
+        }
+        node->update_subtree_stats(*result.get_leaf(), result.is_new_leaf());
 
 #ifdef USE_EVALCMD
         if (m_evaluating) {
@@ -413,13 +559,87 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
             }
         }
     }
-    node->virtual_loss_undo();
+    if (result.is_collision()) {
+        node->add_collision();
+    }
+    node->virtual_loss_undo(virtual_loss);
 
     //    return restrict_return ? current_node_result : result;
     //    return result;
+    current_node_result.set_leaf(result.get_leaf(), result.is_new_leaf());
+    if (result.is_collision()) {
+        current_node_result.set_collision();
+    }
     return update_with_current ? current_node_result : result;
 }
 
+// Descends the tree the way play_simulation() does, leaving a virtual
+// loss on every node of the path, and tells whether it stopped on a leaf
+// that the network has to evaluate.
+bool UCTSearch::select_leaf(GameState& currstate, UCTNode* const node,
+                            std::vector<UCTNode*>& path) {
+    node->virtual_loss();
+    path.emplace_back(node);
+
+    if (node->expandable()) {
+        return currstate.get_passes() < 2;
+    }
+    if (!node->has_children()) {
+        return false;
+    }
+    const auto next = node->uct_select_child(currstate,
+                                             node == m_root,
+                                             m_per_node_maxvisits,
+                                             node == m_root ?
+                                             m_allowed_root_children
+                                             : std::vector<int>{},
+                                             m_nopass);
+    if (next == nullptr) {
+        return false;
+    }
+    const auto move = next->get_move();
+    currstate.play_move(move);
+    if (move != FastBoard::PASS && currstate.superko()) {
+        return false;
+    }
+    if (m_nopass) {
+        currstate.set_passes(0);
+    }
+    return select_leaf(currstate, next, path);
+}
+
+// Selects up to count leaves with virtual loss, as the next simulations
+// of this thread would, and evaluates them with a single request to the
+// network. The simulations that follow find the results in the cache,
+// so the thread doesn't wait for each evaluation in turn.
+void UCTSearch::prefetch_leaves(const int count) {
+    if (!cfg_use_nncache) {
+        return;
+    }
+    auto leaves = std::vector<std::unique_ptr<GameState>>{};
+    auto paths = std::vector<std::vector<UCTNode*>>(count);
+    for (auto& path : paths) {
+        auto currstate = std::make_unique<GameState>(m_rootstate);
+        if (select_leaf(*currstate, m_root, path)) {
+            leaves.emplace_back(std::move(currstate));
+        }
+    }
+
+    if (!leaves.empty()) {
+        auto states = std::vector<const GameState*>{};
+        for (const auto& leaf : leaves) {
+            states.emplace_back(leaf.get());
+        }
+        m_network.get_outputs(states);
+    }
+
+    for (const auto& path : paths) {
+        for (const auto node : path) {
+            node->virtual_loss_undo();
+        }
+    }
+}
+
 void UCTSearch::dump_stats(FastState & state, UCTNode & parent) {
     if (cfg_quiet || !parent.has_children()) {
         return;
@@ -475,6 +695,12 @@ void UCTSearch::dump_stats(FastState & state, UCTNode & parent) {
                  pv.c_str());
 #endif
     }
+    if (cfg_collision_aware && parent.get_visits() > 0) {
+        myprintf("%d collisions in %d visits (%5.2f%%), virtual loss %d\n",
+                 parent.get_collisions(), parent.get_visits(),
+                 parent.get_collisions() * 100.0f / parent.get_visits(),
+                 get_virtual_loss());
+    }
     tree_stats(parent);
 }
 
@@ -537,10 +763,19 @@ void UCTSearch::tree_stats(const UCTNode& node) {
     size_t depth_sum = 0;
     size_t max_depth = 0;
     size_t children_count = 0;
+    // inflated nodes on each NUMA node
+    auto numa_nodes = std::vector<size_t>{};
 
     std::function<void(const UCTNode& node, size_t)> traverse =
           [&](const UCTNode& node, size_t depth) {
         nodes += 1;
+        if (cfg_numa) {
+            const auto numa_node = static_cast<size_t>(NodeArena::numa_node(&node));
+            if (numa_node >= numa_nodes.size()) {
+                numa_nodes.resize(numa_node + 1);
+            }
+            numa_nodes[numa_node]++;
+        }
         non_leaf_nodes += node.get_visits() > 1;
         depth_sum += depth;
         if (depth > max_depth) max_depth = depth;
@@ -565,11 +800,26 @@ void UCTSearch::tree_stats(const UCTNode& node) {
         myprintf("%d non leaf nodes, %.2f average children\n",
                  non_leaf_nodes, (1.0f*children_count) / non_leaf_nodes);
     }
+    if (cfg_numa) {
+        const auto local = m_local_accesses.load();
+        const auto remote = m_remote_accesses.load();
+        myprintf("%.2f%% remote NUMA node accesses, tree nodes by NUMA node:",
+                 remote * 100.0 / std::max<std::uint64_t>(1, local + remote));
+        const auto inflated = std::accumulate(begin(numa_nodes),
+                                              end(numa_nodes), size_t{0});
+        for (auto i = size_t{0}; i < numa_nodes.size(); i++) {
+            if (numa_nodes[i] > 0) {
+                myprintf(" %d: %.1f%%", static_cast<int>(i),
+                         numa_nodes[i] * 100.0 / inflated);
+            }
+        }
+        myprintf("\n");
+    }
 }
 
 
 void UCTSearch::tree_stats() {
-    tree_stats(*(m_root.get()));
+    tree_stats(*(m_root));
     myprintf("%d visits, %d nodes\n", m_root->get_visits(), m_nodes.load());
     const auto maxplay = (m_maxplayouts == UNLIMITED_PLAYOUTS) ?
         "inf" : std::to_string(m_maxplayouts);
@@ -988,7 +1238,11 @@ bool UCTSearch::stop_thinking(int elapsed_centis, int time_for_move) const {
 }
 
 void UCTWorker::operator()() {
+    auto simulations = 0;
     do {
+        if (cfg_leaf_batch > 1 && simulations++ % cfg_leaf_batch == 0) {
+            m_search->prefetch_leaves(cfg_leaf_batch);
+        }
         auto currstate = std::make_unique<GameState>(m_rootstate);
         auto result = m_search->play_simulation(*currstate, m_root);
         if (result.valid()) {
@@ -1060,16 +1314,20 @@ int UCTSearch::think(int color, passflag_t passflag) {
     myprintf("cpus=%i\n", cpus);
     ThreadGroup tg(thread_pool);
     for (int i = 1; i < cpus; i++) {
-      tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+      tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
 
     auto keeprunning = true;
     auto last_update = 0;
     auto last_output = 0;
+    auto simulations = 0;
     do {
+        if (cfg_leaf_batch > 1 && simulations++ % cfg_leaf_batch == 0) {
+            prefetch_leaves(cfg_leaf_batch);
+        }
         auto currstate = std::make_unique<GameState>(m_rootstate);
 
-        auto result = play_simulation(*currstate, m_root.get());
+        auto result = play_simulation(*currstate, m_root);
 #ifndef NDEBUG
         auto nodes = std::stringstream();
         nodes << std::setprecision(2) << std::fixed;
@@ -1235,14 +1493,16 @@ int UCTSearch::think(int color, passflag_t passflag) {
              m_playouts.load(),
              (m_playouts * 100.0) / (elapsed_centis+1));
 
-#ifdef USE_OPENCL
-#ifndef NDEBUG
-    myprintf("batch stats: %d %d\n",
-        batch_stats.single_evals.load(),
-        batch_stats.batch_evals.load()
-    );
-#endif
-#endif
+    const auto batches = m_network.get_batch_histogram();
+    if (!batches.empty()) {
+        auto sizes = std::string{};
+        for (auto i = size_t{1}; i < batches.size(); i++) {
+            if (batches[i] > 0) {
+                sizes += str(boost::format(" %d:%d") % i % batches[i]);
+            }
+        }
+        myprintf("batch sizes:%s\n", sizes.c_str());
+    }
 
     //    int bestmove = get_best_move(passflag);
 
@@ -1303,7 +1563,7 @@ Network::Netresult UCTSearch::dump_evals(int req_playouts, std::string & dump_st
         // todo: check rootnode visits instead of playouts
         auto currstate = std::make_unique<GameState>(m_rootstate);
 
-        auto result = play_simulation(*currstate, m_root.get());
+        auto result = play_simulation(*currstate, m_root);
         if (!result.valid()) {
             myprintf("Invalid result at n=%d.\n",n);
         } else {
@@ -1316,13 +1576,13 @@ Network::Netresult UCTSearch::dump_evals(int req_playouts, std::string & dump_st
     std::vector<float> value_vec;
     std::vector<float> alpkt_vec;
     std::vector<float> beta_vec;
-    dump_evals_recursion(dump_str, m_root.get(), -1, color, sgf_str,
+    dump_evals_recursion(dump_str, m_root, -1, color, sgf_str,
                          value_vec, alpkt_vec, beta_vec);
 
     Network::Netresult result;
     {
         std::vector<float> freq_visits;
-        m_root->get_children_visits(m_rootstate, *(m_root.get()), freq_visits, true);
+        m_root->get_children_visits(m_rootstate, *(m_root), freq_visits, true);
 
         std::copy(freq_visits.begin(), freq_visits.end()-1, result.policy.begin());
         result.policy_pass = freq_visits.back();
@@ -1512,7 +1772,7 @@ void UCTSearch::select_dame_sequence(FullBoard *board) {
     do {
         auto currstate = std::make_unique<GameState>(m_rootstate);
 
-        play_simulation(*currstate, m_root.get());
+        play_simulation(*currstate, m_root);
     } while (!m_stopping_flag);
 
     m_stopping_moves = stop_moves;
@@ -1542,14 +1802,18 @@ void UCTSearch::ponder() {
     m_run = true;
     ThreadGroup tg(thread_pool);
     for (auto i = size_t{1}; i < cfg_num_threads; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
     Time start;
     auto keeprunning = true;
     auto last_output = 0;
+    auto simulations = 0;
     do {
+        if (cfg_leaf_batch > 1 && simulations++ % cfg_leaf_batch == 0) {
+            prefetch_leaves(cfg_leaf_batch);
+        }
         auto currstate = std::make_unique<GameState>(m_rootstate);
-        auto result = play_simulation(*currstate, m_root.get());
+        auto result = play_simulation(*currstate, m_root);
         if (result.valid()) {
             increment_playouts();
         }
@@ -1700,7 +1964,7 @@ void UCTSearch::fast_roll_out() {
         do {
             auto currstate = std::make_unique<GameState>(m_rootstate);
 
-            auto result = play_simulation(*currstate, m_root.get());
+            auto result = play_simulation(*currstate, m_root);
 
             if (result.valid()) {
                 increment_playouts();
@@ -1787,7 +2051,7 @@ void UCTSearch::explore_move(int move) {
 
         m_nopass = true;
         m_allowed_root_children = {move};
-        play_simulation(*currstate, m_root.get());
+        play_simulation(*currstate, m_root);
         m_nopass = nopass_old;
     }
     m_allowed_root_children = allowed;
@@ -1799,7 +2063,7 @@ void UCTSearch::explore_root_nopass() {
         const auto nopass_old = m_nopass;
 
         m_nopass = true;
-        play_simulation(*currstate, m_root.get());
+        play_simulation(*currstate, m_root);
         m_nopass = nopass_old;
     }
 }
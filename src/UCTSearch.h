@@ -32,13 +32,16 @@
 #define UCTSEARCH_H_INCLUDED
 
 #include <list>
+#include <array>
 #include <atomic>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <future>
 
 #include "ThreadPool.h"
+#include "TranspositionTable.h"
 #include "FastBoard.h"
 #include "FastState.h"
 #include "GameState.h"
@@ -46,6 +49,8 @@
 #include "Utils.h"
 #include "Network.h"
 
+class UCTNode;
+
 
 class SearchResult {
 public:
@@ -56,6 +61,17 @@ public:
     float eval_with_bonus(float bonus, float base) const;
     bool is_forced() const { return m_forced; }
     void set_forced() { m_forced = true; }
+    // The leaf was being expanded by another thread
+    bool is_collision() const { return m_collision; }
+    void set_collision() { m_collision = true; }
+    // Deepest node updated by the simulation, and whether that was
+    // its first visit.
+    const UCTNode* get_leaf() const { return m_leaf; }
+    bool is_new_leaf() const { return m_new_leaf; }
+    void set_leaf(const UCTNode* leaf, bool new_leaf) {
+        m_leaf = leaf;
+        m_new_leaf = new_leaf;
+    }
     static SearchResult from_eval(float value, float alpkt, float beta) {
         return SearchResult(value, alpkt, beta);
     }
@@ -70,6 +86,9 @@ private:
     float m_alpkt{0.0f};
     float m_beta{1.0f};
     bool m_forced{false};
+    bool m_collision{false};
+    const UCTNode* m_leaf{nullptr};
+    bool m_new_leaf{false};
 };
 
 namespace TimeManagement {
@@ -115,6 +134,15 @@ public:
 
     UCTSearch(GameState& g, Network & network);
     void reset();
+    // Keeps the tree when cfg_lambda or cfg_mu change, re-evaluating
+    // it with the net values stored in the nodes.
+    void refresh_agent_evals();
+    // Only between searches.
+    const UCTNode* get_root() const;
+    // Minimum, quartiles and maximum of the alpkt of the nodes of the
+    // tree of the current position, and the median of their beta.  Only
+    // the net values of the position without a tree for it.
+    std::array<float, 5> get_alpkt_quartiles(float& beta_median);
     int think(int color, passflag_t passflag = NORMAL);
 #ifdef USE_EVALCMD
     void set_firstmove(int move);
@@ -138,11 +166,17 @@ public:
     void tree_stats();
     std::string explain_last_think() const;
     SearchResult play_simulation(GameState& currstate, UCTNode* const node);
+    void prefetch_leaves(int count);
 
     // if true, it won't issue passes unless there is no other move
     void passlock(bool lock);
 private:
     float get_min_psa_ratio() const;
+    bool select_leaf(GameState& currstate, UCTNode* const node,
+                     std::vector<UCTNode*>& path);
+    SearchResult play_simulation(GameState& currstate, UCTNode* const node,
+                                 int virtual_loss);
+    int get_virtual_loss() const;
     void dump_stats(FastState& state, UCTNode& parent);
     void print_move_choices_by_policy(KoState& state, UCTNode& parent,
                                       int at_least_as_many, float probab_threash);
@@ -166,12 +200,26 @@ private:
     void explore_root_nopass();
     void fast_roll_out();
     void output_analysis(FastState & state, UCTNode & parent);
+    void create_root();
+    void reclaim_tree_memory();
 
     GameState & m_rootstate;
     std::unique_ptr<GameState> m_last_rootstate;
-    std::unique_ptr<UCTNode> m_root;
+    // Holds all the nodes of the tree, m_root included.
+    NodeArena m_arena;
+    UCTNode* m_root{nullptr};
+    // Positions of the tree, with cfg_transpositions
+    std::unique_ptr<TranspositionTable> m_transpositions;
     std::atomic<int> m_nodes{0};
     std::atomic<int> m_playouts{0};
+    // Simulations in progress and those ending in a collision, only
+    // with cfg_collision_aware
+    std::atomic<int> m_in_flight{0};
+    std::atomic<int> m_collisions{0};
+    // Node visits of this search whose memory was on the NUMA node of
+    // the thread or on another one, only with cfg_numa
+    std::atomic<std::uint64_t> m_local_accesses{0};
+    std::atomic<std::uint64_t> m_remote_accesses{0};
     std::atomic<bool> m_run{false};
     int m_maxplayouts;
     int m_maxvisits;
@@ -223,8 +271,6 @@ private:
 
     int m_bestmove = FastBoard::PASS;
 
-    std::list<Utils::ThreadGroup> m_delete_futures;
-
     Network & m_network;
 };
 
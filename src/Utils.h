@@ -34,8 +34,12 @@
 #include "config.h"
 
 #include <atomic>
+#include <cstdint>
 #include <limits>
 #include <string>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "ThreadPool.h"
 
@@ -65,6 +69,26 @@ namespace Utils {
         return (x << k) | (x >> (std::numeric_limits<T>::digits - k));
     }
 
+    // Index of the lowest set bit, x must not be 0.
+    inline int lowest_bit(const std::uint64_t x) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, x);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctzll(x);
+#endif
+    }
+
+    // Number of set bits.
+    inline int popcount(const std::uint64_t x) {
+#ifdef _MSC_VER
+        return static_cast<int>(__popcnt64(x));
+#else
+        return __builtin_popcountll(x);
+#endif
+    }
+
     inline bool is7bit(int c) {
         return c >= 0 && c <= 127;
     }
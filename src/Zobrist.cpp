@@ -30,12 +30,18 @@
 
 #include "config.h"
 #include "Zobrist.h"
+#include "Network.h"
 #include "Random.h"
 
 std::array<std::array<std::uint64_t, FastBoard::NUM_VERTICES>,     4> Zobrist::zobrist;
 std::array<std::uint64_t, FastBoard::NUM_VERTICES>                    Zobrist::zobrist_ko;
 std::array<std::array<std::uint64_t, FastBoard::NUM_VERTICES * 2>, 2> Zobrist::zobrist_pris;
 std::array<std::uint64_t, 5>                                          Zobrist::zobrist_pass;
+std::array<std::array<Zobrist::sym_keys_t, FastBoard::NUM_VERTICES>, 2> Zobrist::zobrist_sym_stone;
+std::array<Zobrist::sym_keys_t, FastBoard::NUM_VERTICES>                 Zobrist::zobrist_sym_ko;
+
+static_assert(Zobrist::NUM_SYMMETRIES == Network::NUM_SYMMETRIES,
+              "Zobrist and Network symmetries differ");
 
 void Zobrist::init_zobrist(Random& rng) {
     for (int i = 0; i < 4; i++) {
@@ -57,4 +63,27 @@ void Zobrist::init_zobrist(Random& rng) {
     for (int i = 0; i < 5; i++) {
         Zobrist::zobrist_pass[i]  = rng.randuint64();
     }
+
+    // Vertices outside of the board, and NO_VERTEX, are their own
+    // symmetric.
+    constexpr auto side = BOARD_SIZE + 2;
+    for (int v = 0; v < FastBoard::NUM_VERTICES; v++) {
+        const auto x = v % side - 1;
+        const auto y = v / side - 1;
+        const auto on_board = x >= 0 && x < BOARD_SIZE
+                              && y >= 0 && y < BOARD_SIZE;
+        for (int s = 0; s < NUM_SYMMETRIES; s++) {
+            auto sym_v = v;
+            if (on_board) {
+                const auto sym_xy = Network::get_symmetry({x, y}, s);
+                sym_v = (sym_xy.second + 1) * side + sym_xy.first + 1;
+            }
+            for (int color = 0; color < 2; color++) {
+                Zobrist::zobrist_sym_stone[color][v][s] =
+                    Zobrist::zobrist[FastBoard::EMPTY][sym_v]
+                    ^ Zobrist::zobrist[color][sym_v];
+            }
+            Zobrist::zobrist_sym_ko[v][s] = Zobrist::zobrist_ko[sym_v];
+        }
+    }
 }
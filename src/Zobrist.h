@@ -48,6 +48,16 @@ public:
     static std::array<std::array<std::uint64_t, FastBoard::NUM_VERTICES * 2>, 2> zobrist_pris;
     static std::array<std::uint64_t, 5>                                          zobrist_pass;
 
+    // Tables for the hashes of the 8 symmetric positions of a
+    // BOARD_SIZE board, indexed by vertex then symmetry, so that a stone
+    // updates the 8 hashes from a single cache line.
+    static constexpr auto NUM_SYMMETRIES = 8;
+    using sym_keys_t = std::array<std::uint64_t, NUM_SYMMETRIES>;
+    // zobrist[EMPTY][sym(v)] ^ zobrist[color][sym(v)]
+    static std::array<std::array<sym_keys_t, FastBoard::NUM_VERTICES>, 2> zobrist_sym_stone;
+    // zobrist_ko[sym(v)]
+    static std::array<sym_keys_t, FastBoard::NUM_VERTICES>                 zobrist_sym_ko;
+
     static void init_zobrist(Random& rng);
 };
 
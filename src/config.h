@@ -143,8 +143,10 @@ static constexpr auto MAX_CPUS = 256;
 // If OpenCL are fully usable, then check the OpenCL against CPU
 // implementation with some probability.
 #define USE_OPENCL_SELFCHECK
-static constexpr auto SELFCHECK_PROBABILITY = 2000;
 #endif
+// The int8 CPU implementation can be checked against the single
+// precision one in the same way, so the self-check is always compiled.
+static constexpr auto SELFCHECK_PROBABILITY = 2000;
 
 #if (_MSC_VER >= 1400) /* VC8+ Disable all deprecation warnings */
     #pragma warning(disable : 4996)
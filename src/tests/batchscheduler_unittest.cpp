@@ -0,0 +1,234 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "BatchPolicy.h"
+#include "BatchScheduler.h"
+
+TEST(BatchPolicyTest, UnknownWaitsForFullBatch) {
+    auto policy = BatchPolicy(8);
+    auto decision = policy.decide(1, 0.0);
+    EXPECT_EQ(decision.batch_size, 8u);
+    EXPECT_EQ(decision.wait_ms, double{BatchPolicy::MAX_WAIT_MS});
+
+    decision = policy.decide(8, 0.0);
+    EXPECT_EQ(decision.batch_size, 8u);
+    EXPECT_EQ(decision.wait_ms, 0.0);
+}
+
+TEST(BatchPolicyTest, LatencyInterpolation) {
+    auto policy = BatchPolicy(8);
+    EXPECT_EQ(policy.get_latency(4), 0.0);
+    policy.record_batch(2, 2.0);
+    policy.record_batch(6, 4.0);
+    EXPECT_DOUBLE_EQ(policy.get_latency(4), 3.0);
+    EXPECT_DOUBLE_EQ(policy.get_latency(1), 2.0);
+    EXPECT_DOUBLE_EQ(policy.get_latency(8), 4.0);
+    EXPECT_EQ(policy.get_histogram()[2], 1u);
+    EXPECT_EQ(policy.get_histogram()[6], 1u);
+}
+
+TEST(BatchPolicyTest, ThroughputPrefersFullBatches) {
+    auto policy = BatchPolicy(8);
+    // A position every 0.1 ms, and a forward pass that takes as long
+    // for one position as for eight.
+    for (auto i = 0; i < 10; i++) {
+        policy.record_arrival(i * 0.1);
+    }
+    policy.record_batch(1, 5.0);
+    policy.record_batch(8, 5.0);
+    auto decision = policy.decide(2, 0.0);
+    EXPECT_EQ(decision.batch_size, 8u);
+    EXPECT_NEAR(decision.wait_ms, 0.6, 1e-6);
+}
+
+TEST(BatchPolicyTest, SlowArrivalsRunNow) {
+    auto policy = BatchPolicy(8);
+    // A position every 20 ms: waiting for the next one is never worth it.
+    for (auto i = 0; i < 10; i++) {
+        policy.record_arrival(i * 20.0);
+    }
+    policy.record_batch(1, 1.0);
+    policy.record_batch(8, 2.0);
+    auto decision = policy.decide(3, 0.0);
+    EXPECT_EQ(decision.batch_size, 3u);
+    EXPECT_EQ(decision.wait_ms, 0.0);
+}
+
+TEST(BatchPolicyTest, BusyPipelineKeepsFilling) {
+    auto policy = BatchPolicy(8);
+    for (auto i = 0; i < 10; i++) {
+        policy.record_arrival(i * 20.0);
+    }
+    policy.record_batch(1, 1.0);
+    policy.record_batch(8, 2.0);
+    // Same as above, but the previous batch needs 3 ms more.
+    auto decision = policy.decide(3, 0.0, 3.0);
+    EXPECT_EQ(decision.batch_size, 8u);
+    EXPECT_EQ(decision.wait_ms, 3.0);
+}
+
+TEST(BatchPolicyTest, LatencyTargetLimitsBatch) {
+    auto policy = BatchPolicy(8, 4.0);
+    for (auto i = 0; i < 10; i++) {
+        policy.record_arrival(i * 1.0);
+    }
+    policy.record_batch(1, 1.0);
+    policy.record_batch(8, 1.0);
+    // 1 ms per position: the target leaves room for two more.
+    auto decision = policy.decide(2, 1.0);
+    EXPECT_EQ(decision.batch_size, 4u);
+    // The oldest position already waited too long.
+    decision = policy.decide(2, 3.5);
+    EXPECT_EQ(decision.batch_size, 2u);
+    EXPECT_EQ(decision.wait_ms, 0.0);
+}
+
+namespace {
+
+// Doubles its inputs, taking a little longer for larger batches.
+class MockScheduler : public BatchScheduler {
+public:
+    std::atomic<int> m_finishing{0};
+    std::atomic<int> m_overlaps{0};
+
+    MockScheduler(size_t max_batch_size, size_t workers)
+        : BatchScheduler(max_batch_size, 0.0) {
+        start_workers(workers);
+    }
+    virtual ~MockScheduler() {
+        stop_workers();
+    }
+
+    virtual void initialize(const int) {}
+    virtual void push_weights(unsigned int, unsigned int, unsigned int,
+                              std::shared_ptr<const ForwardPipeWeights>) {}
+
+protected:
+    virtual void forward_batch(size_t,
+                               const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               std::vector<float>&,
+                               size_t batch_size) {
+        if (m_finishing > 0) {
+            m_overlaps++;
+        }
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(200 + 20 * batch_size));
+        for (auto i = size_t{0}; i < input.size(); i++) {
+            output_pol[i] = 2.0f * input[i];
+        }
+        for (auto i = size_t{0}; i < batch_size; i++) {
+            output_val[i] = input[i * input.size() / batch_size];
+        }
+    }
+    virtual void finish_batch(size_t,
+                              std::vector<float>&,
+                              std::vector<float>&,
+                              std::vector<float>&,
+                              size_t) {
+        m_finishing++;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        m_finishing--;
+    }
+};
+
+}
+
+TEST(BatchSchedulerTest, MockPipe) {
+    constexpr auto THREADS = 8;
+    constexpr auto EVALS = 200;
+    MockScheduler scheduler(4, 2);
+
+    auto threads = std::vector<std::thread>{};
+    auto errors = std::vector<int>(THREADS, 0);
+    for (auto t = 0; t < THREADS; t++) {
+        threads.emplace_back([&scheduler, &errors, t]() {
+            for (auto n = 0; n < EVALS; n++) {
+                const auto value = float(t * EVALS + n);
+                auto input = std::vector<float>(3, value);
+                auto pol = std::vector<float>(3);
+                auto val = std::vector<float>(1);
+                auto vbe = std::vector<float>();
+                scheduler.forward(input, pol, val, vbe);
+                if (pol[2] != 2.0f * value || val[0] != value) {
+                    errors[t]++;
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (auto t = 0; t < THREADS; t++) {
+        EXPECT_EQ(errors[t], 0);
+    }
+
+    const auto histogram = scheduler.get_batch_histogram();
+    ASSERT_EQ(histogram.size(), 5u);
+    EXPECT_EQ(histogram[0], 0u);
+    auto evals = std::uint64_t{0};
+    for (auto i = size_t{1}; i < histogram.size(); i++) {
+        evals += i * histogram[i];
+    }
+    EXPECT_EQ(evals, std::uint64_t{THREADS * EVALS});
+    // The next batch is evaluated while the previous one is finished.
+    EXPECT_GT(scheduler.m_overlaps, 0);
+}
+
+TEST(BatchSchedulerTest, ForwardMultipleSharesBatch) {
+    MockScheduler scheduler(4, 1);
+    auto inputs = std::vector<std::vector<float>>{};
+    for (auto i = 0; i < 4; i++) {
+        inputs.emplace_back(2, float(i));
+    }
+    auto pol = std::vector<std::vector<float>>(4, std::vector<float>(2));
+    auto val = std::vector<std::vector<float>>(4, std::vector<float>(1));
+    auto vbe = std::vector<std::vector<float>>(4);
+    scheduler.forward_multiple(inputs, pol, val, vbe);
+    for (auto i = 0; i < 4; i++) {
+        EXPECT_EQ(pol[i][1], 2.0f * i);
+        EXPECT_EQ(val[i][0], float(i));
+    }
+    const auto histogram = scheduler.get_batch_histogram();
+    EXPECT_EQ(histogram[4], 1u);
+}
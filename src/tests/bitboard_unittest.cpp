@@ -0,0 +1,140 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+#include "config.h"
+#include "BitBoard.h"
+#include "FastBoard.h"
+#include "FastState.h"
+
+TEST(BitBoardTest, DilateDoesNotWrap) {
+    const auto& g = BitBoard::geometry(5);
+    auto corner = BitBoard{};
+    corner.set(4);              // x = 4, y = 0
+    const auto dilated = corner.dilate(g);
+    EXPECT_EQ(dilated.count(), 3);
+    EXPECT_TRUE(dilated.test(3));
+    EXPECT_TRUE(dilated.test(9));
+    EXPECT_FALSE(dilated.test(5));
+
+    auto last = BitBoard{};
+    last.set(24);               // x = 4, y = 4
+    EXPECT_EQ(last.dilate(g).count(), 3);
+    EXPECT_FALSE(last.dilate(g).test(25));
+}
+
+TEST(BitBoardTest, FloodStopsAtWalls) {
+    const auto& g = BitBoard::geometry(5);
+    // A wall on column 2
+    auto wall = BitBoard{};
+    for (auto y = 0; y < 5; y++) {
+        wall.set(y * 5 + 2);
+    }
+    auto seed = BitBoard{};
+    seed.set(0);
+    const auto reach = seed.flood(wall.complement(g), g);
+    EXPECT_EQ(reach.count(), 10);
+    EXPECT_FALSE(reach.test(3));
+}
+
+// Stones of a color plus the empty intersections they reach, by BFS.
+static int reference_reach(const FastBoard& board, const int color) {
+    const auto size = board.get_boardsize();
+    auto reached = std::vector<bool>(size * size, false);
+    auto open = std::vector<int>{};
+    for (auto idx = 0; idx < size * size; idx++) {
+        if (board.get_state(idx % size, idx / size) == color) {
+            reached[idx] = true;
+            open.push_back(idx);
+        }
+    }
+    auto count = int(open.size());
+    while (!open.empty()) {
+        const auto idx = open.back();
+        open.pop_back();
+        const auto x = idx % size;
+        const auto y = idx / size;
+        const int dx[] = {1, -1, 0, 0};
+        const int dy[] = {0, 0, 1, -1};
+        for (auto k = 0; k < 4; k++) {
+            const auto nx = x + dx[k];
+            const auto ny = y + dy[k];
+            if (nx < 0 || ny < 0 || nx >= size || ny >= size) continue;
+            const auto nidx = ny * size + nx;
+            if (!reached[nidx]
+                && board.get_state(nx, ny) == FastBoard::EMPTY) {
+                reached[nidx] = true;
+                open.push_back(nidx);
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+static void check_random_games(const int size) {
+    auto rng = std::mt19937(size);
+    for (auto game = 0; game < 10; game++) {
+        FastState state;
+        state.init_game(size, 7.5f);
+        for (auto move = 0; move < 2 * size * size; move++) {
+            const auto score = state.board.area_score(7.5f);
+            const auto expected = reference_reach(state.board, FastBoard::BLACK)
+                - reference_reach(state.board, FastBoard::WHITE) - 7.5f;
+            ASSERT_EQ(score, expected);
+
+            const auto color = state.get_to_move();
+            const auto legal = state.get_legal_bits(color);
+            auto candidates = std::vector<int>{};
+            for (auto idx = 0; idx < size * size; idx++) {
+                const auto vertex = state.board.get_vertex(idx % size, idx / size);
+                ASSERT_EQ(state.is_move_legal(color, vertex), legal.test(idx));
+                if (state.is_move_legal(color, vertex)
+                    && !state.board.is_eye(color, vertex)) {
+                    candidates.push_back(vertex);
+                }
+            }
+            if (candidates.empty()) {
+                break;
+            }
+            state.play_move(candidates[rng() % candidates.size()]);
+        }
+    }
+}
+
+TEST(BitBoardTest, RandomGamesMatchReference) {
+    check_random_games(BOARD_SIZE);
+    check_random_games(9);
+}
@@ -30,10 +30,15 @@
 
 #include "config.h"
 
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <random>
 #include <regex>
 #include <string>
 #include <vector>
@@ -43,6 +48,7 @@
 #include "NNCache.h"
 #include "Random.h"
 #include "ThreadPool.h"
+#include "UCTSearch.h"
 #include "Utils.h"
 #include "Zobrist.h"
 
@@ -156,6 +162,118 @@ TEST_F(LeelaTest, Transposition) {
     EXPECT_EQ(ko_hash, maingame.board.get_ko_hash());
 }
 
+TEST_F(LeelaTest, SearchOnHeap) {
+    // std::make_unique only guarantees fundamental alignment before C++17.
+    static_assert(alignof(UCTSearch) <= alignof(std::max_align_t),
+                  "UCTSearch must not be over-aligned");
+    static_assert(alignof(Network) <= alignof(std::max_align_t),
+                  "Network must not be over-aligned");
+
+    auto maingame = get_gamestate();
+    auto search = std::make_unique<UCTSearch>(maingame, *GTP::s_network);
+    testing::internal::CaptureStderr();
+    auto move = search->think(FastBoard::BLACK);
+    testing::internal::GetCapturedStderr();
+
+    EXPECT_TRUE(maingame.is_move_legal(FastBoard::BLACK, move));
+}
+
+// Small network with random weights and a SAI value head, which the
+// agent evaluations depend on, unlike that of 0k.txt.
+static void write_sai_weights(const std::string& filename) {
+    constexpr auto INPUTS = 18;
+    constexpr auto CHANNELS = 8;
+    constexpr auto VALUE_CHANNELS = 8;
+    std::mt19937 rng(7);
+    std::ofstream out(filename);
+    auto random_line = [&](size_t n, float stddev) {
+        std::normal_distribution<float> dist(0.0f, stddev);
+        for (auto i = size_t{0}; i < n; i++) {
+            out << (i ? " " : "") << dist(rng);
+        }
+        out << "\n";
+    };
+    auto const_line = [&](size_t n, float value) {
+        for (auto i = size_t{0}; i < n; i++) {
+            out << (i ? " " : "") << value;
+        }
+        out << "\n";
+    };
+    auto conv = [&](int inputs, int outputs, int filter_size) {
+        const auto fan_in = inputs * filter_size * filter_size;
+        random_line(outputs * fan_in, 1.0f / std::sqrt(float(fan_in)));
+        random_line(outputs, 0.01f);
+        random_line(outputs, 0.1f);
+        const_line(outputs, 1.5f);
+    };
+
+    out << "1\n";
+    // input convolution and one residual block
+    conv(INPUTS, CHANNELS, 3);
+    conv(CHANNELS, CHANNELS, 3);
+    conv(CHANNELS, CHANNELS, 3);
+    // policy head
+    conv(CHANNELS, 2, 1);
+    random_line(2 * NUM_INTERSECTIONS * POTENTIAL_MOVES,
+                1.0f / std::sqrt(2.0f * NUM_INTERSECTIONS));
+    random_line(POTENTIAL_MOVES, 0.05f);
+    // value head, with alpha and beta
+    conv(CHANNELS, 1, 1);
+    random_line(NUM_INTERSECTIONS * VALUE_CHANNELS,
+                0.3f / std::sqrt(float(NUM_INTERSECTIONS)));
+    random_line(VALUE_CHANNELS, 0.05f);
+    random_line(2 * VALUE_CHANNELS, 0.3f);
+    random_line(2, 0.1f);
+}
+
+TEST_F(LeelaTest, RefreshAgentEvalsKeepsTheStatistics) {
+    const auto weights = std::string{"sai_test_weights.txt"};
+    write_sai_weights(weights);
+    auto network = std::make_unique<Network>();
+    testing::internal::CaptureStderr();
+    network->initialize(200, weights);
+    testing::internal::GetCapturedStderr();
+    std::remove(weights.c_str());
+    ASSERT_TRUE(network->m_value_head_sai);
+
+    cfg_max_playouts = UCTSearch::UNLIMITED_PLAYOUTS;
+    cfg_max_visits = 200;
+    auto maingame = get_gamestate();
+    auto search = std::make_unique<UCTSearch>(maingame, *network);
+    testing::internal::CaptureStderr();
+    search->think(FastBoard::BLACK);
+    testing::internal::GetCapturedStderr();
+
+    struct ChildStatistics {
+        int move;
+        int visits;
+        float eval;
+    };
+    auto root_children = [&search]() {
+        auto children = std::vector<ChildStatistics>{};
+        for (const auto& child : search->get_root()->get_children()) {
+            if (child.get_visits() > 0) {
+                children.push_back({child.get_move(), child.get_visits(),
+                                    child->get_raw_eval(FastBoard::BLACK)});
+            }
+        }
+        return children;
+    };
+    const auto before = root_children();
+    ASSERT_GT(before.size(), size_t{1});
+
+    // What lz-setoption name lambda does, here with the same lambda.
+    search->refresh_agent_evals();
+    const auto after = root_children();
+
+    ASSERT_EQ(before.size(), after.size());
+    for (auto i = size_t{0}; i < before.size(); i++) {
+        EXPECT_EQ(before[i].move, after[i].move);
+        EXPECT_EQ(before[i].visits, after[i].visits);
+        EXPECT_NEAR(before[i].eval, after[i].eval, 1e-5f);
+    }
+}
+
 TEST_F(LeelaTest, KoPntNotSame) {
     auto maingame = get_gamestate();
 
@@ -196,6 +314,37 @@ TEST_F(LeelaTest, KoPntNotSame) {
     EXPECT_NE(hash, maingame.board.get_hash());
 }
 
+TEST_F(LeelaTest, SymmetryHash) {
+    auto maingame = get_gamestate();
+
+    testing::internal::CaptureStdout();
+    GTP::execute(maingame, "play b C3");
+    GTP::execute(maingame, "play w R5");
+
+    // Symmetry 2 mirrors the board left to right
+    auto sym_hash = maingame.get_symmetry_hash(2);
+    EXPECT_FALSE(maingame.is_symmetry_invariant(2));
+
+    GTP::execute(maingame, "clear_board");
+
+    GTP::execute(maingame, "play b R3");
+    GTP::execute(maingame, "play w C5");
+    EXPECT_EQ(sym_hash, maingame.board.get_hash());
+
+    GTP::execute(maingame, "clear_board");
+
+    // Symmetric along the diagonal (symmetry 4) only
+    GTP::execute(maingame, "play b D4");
+    GTP::execute(maingame, "play w D16");
+    GTP::execute(maingame, "play b Q16");
+    GTP::execute(maingame, "play w Q4");
+    std::string output = testing::internal::GetCapturedStdout();
+
+    EXPECT_TRUE(maingame.is_symmetry_invariant(4));
+    EXPECT_FALSE(maingame.is_symmetry_invariant(1));
+    EXPECT_EQ(maingame.get_symmetry_hash(4), maingame.board.get_hash());
+}
+
 TEST_F(LeelaTest, MoveOnOccupiedPnt) {
     auto maingame = get_gamestate();
     std::string output;
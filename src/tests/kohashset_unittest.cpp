@@ -0,0 +1,110 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "config.h"
+#include "KoHashSet.h"
+
+TEST(KoHashSetTest, InsertAndFind) {
+    std::mt19937_64 rng(17);
+    std::vector<std::uint64_t> hashes(500);
+    for (auto& hash : hashes) {
+        hash = rng();
+    }
+    hashes[100] = 0;
+
+    KoHashSet set;
+    for (auto i = size_t{0}; i < hashes.size(); i++) {
+        EXPECT_FALSE(set.contains(hashes[i]));
+        set.insert(hashes[i]);
+        set.insert(hashes[i / 2]);
+        ASSERT_EQ(i + 1, set.size());
+    }
+    for (const auto hash : hashes) {
+        EXPECT_TRUE(set.contains(hash));
+    }
+    EXPECT_FALSE(set.contains(rng()));
+
+    set.clear();
+    EXPECT_EQ(size_t{0}, set.size());
+    EXPECT_FALSE(set.contains(hashes[0]));
+}
+
+TEST(KoHashSetTest, CopiesAreIndependent) {
+    KoHashSet set;
+    for (auto i = std::uint64_t{1}; i <= 40; i++) {
+        set.insert(i);
+    }
+    auto copy = set;
+    for (auto i = std::uint64_t{1}; i <= 40; i++) {
+        copy.insert(1000 + i);
+    }
+    set.insert(2000);
+
+    EXPECT_EQ(size_t{41}, set.size());
+    EXPECT_EQ(size_t{80}, copy.size());
+    EXPECT_TRUE(set.contains(40));
+    EXPECT_TRUE(set.contains(2000));
+    EXPECT_FALSE(set.contains(1001));
+    EXPECT_TRUE(copy.contains(1040));
+    EXPECT_FALSE(copy.contains(2000));
+}
+
+TEST(KoHashSetTest, CopiesOfALongGame) {
+    std::mt19937_64 rng(29);
+    KoHashSet game;
+    std::vector<std::uint64_t> played;
+    for (auto move = 0; move < 1000; move++) {
+        played.emplace_back(rng());
+        game.insert(played.back());
+
+        // A playout from this position.
+        auto copy = game;
+        std::vector<std::uint64_t> extra(20);
+        for (auto& hash : extra) {
+            hash = rng();
+            copy.insert(hash);
+        }
+        ASSERT_EQ(played.size() + extra.size(), copy.size());
+        EXPECT_TRUE(copy.contains(played[move / 2]));
+        EXPECT_TRUE(copy.contains(extra[move % extra.size()]));
+        EXPECT_FALSE(game.contains(extra[move % extra.size()]));
+    }
+    ASSERT_EQ(played.size(), game.size());
+    for (const auto hash : played) {
+        EXPECT_TRUE(game.contains(hash));
+    }
+}
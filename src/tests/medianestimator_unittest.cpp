@@ -0,0 +1,90 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "config.h"
+#include "MedianEstimator.h"
+#include "Utils.h"
+
+TEST(MedianEstimatorTest, ExactForFewValues) {
+    const auto values = std::vector<float>{3.0f, -1.0f, 7.5f, 2.0f, 0.5f};
+    auto estimator = MedianEstimator{};
+    for (auto i = size_t{0}; i < values.size(); i++) {
+        estimator.add(values[i]);
+        auto prefix = std::vector<float>(begin(values),
+                                         begin(values) + i + 1);
+        EXPECT_EQ(estimator.size(), i + 1);
+        EXPECT_FLOAT_EQ(estimator.get_median(), Utils::median(prefix));
+        EXPECT_FLOAT_EQ(estimator.get_quartiles()[2], estimator.get_median());
+    }
+    const auto quartiles = estimator.get_quartiles();
+    EXPECT_FLOAT_EQ(quartiles[0], -1.0f);
+    EXPECT_FLOAT_EQ(quartiles[1], 0.5f);
+    EXPECT_FLOAT_EQ(quartiles[3], 3.0f);
+    EXPECT_FLOAT_EQ(quartiles[4], 7.5f);
+}
+
+TEST(MedianEstimatorTest, ConstantValues) {
+    auto estimator = MedianEstimator{};
+    for (auto i = 0; i < 1000; i++) {
+        estimator.add(4.5f);
+    }
+    EXPECT_FLOAT_EQ(estimator.get_median(), 4.5f);
+}
+
+TEST(MedianEstimatorTest, ApproximatesLargeSamples) {
+    auto rng = std::mt19937{42};
+    auto normal = std::normal_distribution<float>{-7.5f, 3.0f};
+    auto estimator = MedianEstimator{};
+    auto values = std::vector<float>{};
+    for (auto i = 0; i < 20000; i++) {
+        values.emplace_back(normal(rng));
+        estimator.add(values.back());
+    }
+    EXPECT_NEAR(estimator.get_median(), Utils::median(values), 0.1f);
+    // quartiles of a normal distribution are 0.674 sigma away
+    const auto quartiles = estimator.get_quartiles();
+    EXPECT_NEAR(quartiles[1], -7.5f - 0.674f * 3.0f, 0.2f);
+    EXPECT_NEAR(quartiles[3], -7.5f + 0.674f * 3.0f, 0.2f);
+    EXPECT_FLOAT_EQ(quartiles[0], *std::min_element(begin(values), end(values)));
+    EXPECT_FLOAT_EQ(quartiles[4], *std::max_element(begin(values), end(values)));
+
+    // Sorted input is the worst case for the marker adjustments.
+    auto sorted = MedianEstimator{};
+    for (auto i = 0; i <= 1000; i++) {
+        sorted.add(float(i));
+    }
+    EXPECT_NEAR(sorted.get_median(), 500.0f, 25.0f);
+}
@@ -0,0 +1,213 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "NNCache.h"
+
+static NNCache::Netresult make_result(std::uint64_t hash) {
+    auto result = NNCache::Netresult{};
+    result.policy.fill(static_cast<float>(hash % 1000));
+    result.policy_pass = static_cast<float>(hash % 7);
+    result.value = static_cast<float>(hash % 13);
+    return result;
+}
+
+static bool is_consistent(std::uint64_t hash,
+                          const NNCache::Netresult& result) {
+    const auto expected = make_result(hash);
+    return result.policy == expected.policy
+        && result.policy_pass == expected.policy_pass
+        && result.value == expected.value;
+}
+
+TEST(NNCacheTest, InsertLookup) {
+    NNCache cache{64};
+    auto result = NNCache::Netresult{};
+    EXPECT_FALSE(cache.lookup(12345, result));
+
+    cache.insert(12345, make_result(12345));
+    ASSERT_TRUE(cache.lookup(12345, result));
+    EXPECT_TRUE(is_consistent(12345, result));
+
+    const auto rate = cache.hit_rate();
+    EXPECT_EQ(1, rate.first);
+    EXPECT_EQ(2, rate.second);
+
+    cache.clear();
+    EXPECT_FALSE(cache.lookup(12345, result));
+}
+
+TEST(NNCacheTest, ReferencedEntriesSurviveEviction) {
+    // A single set: every hash competes for the same entries.
+    NNCache cache{NNCache::WAYS};
+    auto result = NNCache::Netresult{};
+    const auto hot = std::uint64_t{1};
+    cache.insert(hot, make_result(hot));
+    for (auto hash = std::uint64_t{2}; hash < 100; hash++) {
+        ASSERT_TRUE(cache.lookup(hot, result));
+        cache.insert(hash, make_result(hash));
+    }
+    EXPECT_TRUE(cache.lookup(hot, result));
+    // The oldest cold entries were evicted.
+    EXPECT_FALSE(cache.lookup(2, result));
+    EXPECT_TRUE(cache.lookup(99, result));
+}
+
+TEST(NNCacheTest, ResizeKeepsEntries) {
+    NNCache cache{1024};
+    for (auto hash = std::uint64_t{1}; hash <= 100; hash++) {
+        cache.insert(hash, make_result(hash));
+    }
+    cache.resize(4096);
+    auto result = NNCache::Netresult{};
+    for (auto hash = std::uint64_t{1}; hash <= 100; hash++) {
+        ASSERT_TRUE(cache.lookup(hash, result));
+        EXPECT_TRUE(is_consistent(hash, result));
+    }
+}
+
+TEST(NNCacheTest, ConcurrentLookupsNeverSeeTornEntries) {
+    NNCache cache{256};
+    std::atomic<int> torn{0};
+    auto threads = std::vector<std::thread>{};
+    for (auto t = 0; t < 4; t++) {
+        threads.emplace_back([&cache, &torn, t]() {
+            auto result = NNCache::Netresult{};
+            for (auto i = std::uint64_t{0}; i < 20000; i++) {
+                const auto hash = 1 + (i * 7 + t) % 1000;
+                if (cache.lookup(hash, result)) {
+                    if (!is_consistent(hash, result)) {
+                        torn++;
+                    }
+                } else {
+                    cache.insert(hash, make_result(hash));
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(0, torn.load());
+}
+
+static NNCache::Netresult make_policy() {
+    // A peaked policy over a long tail, like the network output.
+    auto result = NNCache::Netresult{};
+    auto sum = 0.0f;
+    for (auto i = size_t{0}; i < NUM_INTERSECTIONS; i++) {
+        result.policy[i] = std::exp(-0.1f * i);
+        sum += result.policy[i];
+    }
+    for (auto& p : result.policy) {
+        p /= sum;
+    }
+    result.value = 0.25f;
+    return result;
+}
+
+TEST(NNCacheTest, CompactFormats) {
+    using format_t = NNCache::policy_format_t;
+    const auto original = make_policy();
+    for (const auto format : {format_t::FLOAT, format_t::HALF, format_t::LOG8}) {
+        const auto tolerance = (format == format_t::FLOAT ? 0.0f
+                                : format == format_t::HALF ? 1e-3f : 0.05f);
+        NNCache cache{64, format};
+        cache.insert(1, original);
+        auto result = NNCache::Netresult{};
+        ASSERT_TRUE(cache.lookup(1, result));
+        EXPECT_EQ(original.value, result.value);
+        for (auto i = size_t{0}; i < NUM_INTERSECTIONS; i++) {
+            // Tiny probabilities lose their relative precision, HALF in
+            // its subnormal range and LOG8 below ~1e-9.
+            const auto floor = (format == format_t::FLOAT ? 0.0f : 1e-7f);
+            EXPECT_NEAR(original.policy[i], result.policy[i],
+                        tolerance * original.policy[i] + floor) << "at " << i;
+        }
+    }
+    EXPECT_LT(NNCache::entry_size(format_t::LOG8, 0) * 3,
+              NNCache::entry_size(format_t::FLOAT, 0));
+}
+
+TEST(NNCacheTest, TopKKeepsResidual) {
+    const auto topk = 16;
+    const auto original = make_policy();
+    NNCache cache{64, NNCache::policy_format_t::FLOAT, topk};
+    cache.insert(1, original);
+    auto result = NNCache::Netresult{};
+    ASSERT_TRUE(cache.lookup(1, result));
+
+    auto sum = 0.0f;
+    for (auto i = size_t{0}; i < NUM_INTERSECTIONS; i++) {
+        if (i < topk) {
+            EXPECT_EQ(original.policy[i], result.policy[i]);
+        } else {
+            EXPECT_LE(result.policy[i], original.policy[topk - 1]);
+        }
+        sum += result.policy[i];
+    }
+    EXPECT_NEAR(1.0f, sum, 1e-4f);
+}
+
+TEST(NNCacheTest, SnapshotRoundTrip) {
+    const auto filename = std::string{"nncache_unittest.snap"};
+    NNCache cache{1024, NNCache::policy_format_t::HALF};
+    for (auto hash = std::uint64_t{1}; hash <= 100; hash++) {
+        cache.insert(hash, make_result(hash));
+    }
+    ASSERT_TRUE(cache.save(filename, "net-a"));
+
+    NNCache other_net{1024, NNCache::policy_format_t::HALF};
+    EXPECT_EQ(0u, other_net.load(filename, "net-b"));
+    NNCache other_format{1024, NNCache::policy_format_t::FLOAT};
+    EXPECT_EQ(0u, other_format.load(filename, "net-a"));
+
+    NNCache restored{1024, NNCache::policy_format_t::HALF};
+    EXPECT_EQ(100u, restored.load(filename, "net-a"));
+    auto expected = NNCache::Netresult{};
+    auto result = NNCache::Netresult{};
+    for (auto hash = std::uint64_t{1}; hash <= 100; hash++) {
+        ASSERT_TRUE(cache.lookup(hash, expected));
+        ASSERT_TRUE(restored.lookup(hash, result));
+        EXPECT_EQ(expected.policy, result.policy);
+        EXPECT_EQ(expected.value, result.value);
+    }
+    std::remove(filename.c_str());
+}
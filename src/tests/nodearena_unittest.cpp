@@ -0,0 +1,117 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include <gtest/gtest.h>
+#include <cstddef>
+#include <memory>
+
+#include "config.h"
+#include "NodeArena.h"
+
+namespace {
+    struct Holder {
+        ArenaVector<int> values;
+    };
+}
+
+TEST(NodeArenaTest, OwnerFromAddress) {
+    auto arena = std::make_unique<NodeArena>();
+    for (auto i = 0; i < 10000; i++) {
+        auto p = arena->allocate(100);
+        EXPECT_EQ(&NodeArena::owner(p), arena.get());
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p)
+                  % NodeArena::ALIGNMENT, 0u);
+    }
+}
+
+TEST(NodeArenaTest, GenerationsReleaseInBulk) {
+    auto arena = std::make_unique<NodeArena>();
+    const auto before = NodeArena::get_total_slab_bytes();
+
+    arena->allocate(1000);
+    EXPECT_EQ(arena->get_allocated(), NodeArena::round_size(1000));
+    EXPECT_EQ(NodeArena::get_total_slab_bytes(),
+              before + NodeArena::SLAB_SIZE);
+
+    arena->start_generation();
+    arena->allocate(10);
+    EXPECT_EQ(arena->get_allocated(),
+              NodeArena::round_size(1000) + NodeArena::round_size(10));
+    EXPECT_EQ(NodeArena::get_total_slab_bytes(),
+              before + 2 * NodeArena::SLAB_SIZE);
+
+    arena->release_previous_generations();
+    EXPECT_EQ(arena->get_allocated(), NodeArena::round_size(10));
+    EXPECT_EQ(NodeArena::get_total_slab_bytes(),
+              before + NodeArena::SLAB_SIZE);
+
+    arena.reset();
+    EXPECT_EQ(NodeArena::get_total_slab_bytes(), before);
+}
+
+TEST(NodeArenaTest, InterleavedSlabsAreSeparate) {
+    auto arena = std::make_unique<NodeArena>();
+    const auto before = NodeArena::get_total_slab_bytes();
+
+    auto p = arena->allocate(100);
+    auto q = arena->allocate_interleaved(100);
+    EXPECT_EQ(&NodeArena::owner(q), arena.get());
+    EXPECT_EQ(NodeArena::numa_node(q), NodeArena::INTERLEAVED);
+    EXPECT_NE(NodeArena::numa_node(p), NodeArena::INTERLEAVED);
+    EXPECT_EQ(NodeArena::get_total_slab_bytes(),
+              before + 2 * NodeArena::SLAB_SIZE);
+    EXPECT_EQ(arena->get_allocated(), 2 * NodeArena::round_size(100));
+
+    arena.reset();
+    EXPECT_EQ(NodeArena::get_total_slab_bytes(), before);
+}
+
+TEST(NodeArenaTest, ArenaVectorGrowAndErase) {
+    auto arena = std::make_unique<NodeArena>();
+    auto holder = arena->create<Holder>();
+    auto& values = holder->values;
+
+    for (auto i = 0; i < 1000; i++) {
+        values.push_back(i);
+    }
+    ASSERT_EQ(values.size(), 1000u);
+    for (auto i = 0; i < 1000; i++) {
+        EXPECT_EQ(values[i], i);
+    }
+
+    values.erase(
+        std::remove_if(begin(values), end(values),
+                       [](int v) { return v % 2 == 1; }),
+        end(values));
+    ASSERT_EQ(values.size(), 500u);
+    EXPECT_EQ(values.front(), 0);
+    EXPECT_EQ(*values.rbegin(), 998);
+}
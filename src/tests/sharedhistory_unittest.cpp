@@ -0,0 +1,94 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include <gtest/gtest.h>
+#include <cstddef>
+#include <vector>
+
+#include "config.h"
+#include "SharedHistory.h"
+
+TEST(SharedHistoryTest, AppendAndIndex) {
+    SharedHistory<int> history;
+    for (auto i = 0; i < 100; i++) {
+        history.push_back(i);
+        ASSERT_EQ(size_t(i + 1), history.size());
+        EXPECT_EQ(i, history.back());
+    }
+    for (auto i = 0; i < 100; i++) {
+        EXPECT_EQ(i, history[i]);
+    }
+    const auto all = history.to_vector();
+    ASSERT_EQ(size_t{100}, all.size());
+    for (auto i = 0; i < 100; i++) {
+        EXPECT_EQ(i, all[i]);
+    }
+}
+
+TEST(SharedHistoryTest, CopiesAreIndependent) {
+    SharedHistory<int> history;
+    for (auto i = 0; i < 40; i++) {
+        history.push_back(i);
+    }
+    auto copy = history;
+    for (auto i = 0; i < 40; i++) {
+        copy.push_back(1000 + i);
+    }
+    history.push_back(-1);
+
+    ASSERT_EQ(size_t{41}, history.size());
+    ASSERT_EQ(size_t{80}, copy.size());
+    EXPECT_EQ(-1, history[40]);
+    EXPECT_EQ(1000, copy[40]);
+    EXPECT_EQ(39, copy[39]);
+    EXPECT_EQ(1039, copy.back());
+}
+
+TEST(SharedHistoryTest, Truncate) {
+    SharedHistory<int> history;
+    for (auto i = 0; i < 50; i++) {
+        history.push_back(i);
+    }
+    auto copy = history;
+    history.truncate(20);
+    ASSERT_EQ(size_t{20}, history.size());
+    EXPECT_EQ(19, history.back());
+    history.push_back(-1);
+    EXPECT_EQ(-1, history[20]);
+    // The copy still sees the old elements.
+    EXPECT_EQ(20, copy[20]);
+    EXPECT_EQ(49, copy.back());
+
+    history.truncate(100);
+    EXPECT_EQ(size_t{21}, history.size());
+    history.clear();
+    EXPECT_TRUE(history.empty());
+}
@@ -0,0 +1,118 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include <gtest/gtest.h>
+#include <array>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "config.h"
+#include "ThreadPool.h"
+
+using namespace Utils;
+
+TEST(ThreadPoolTest, TaskInlineAndHeap) {
+    auto calls = 0;
+    auto small = Task([&calls]() { calls++; });
+    auto big_data = std::array<char, 2 * Task::INLINE_SIZE>{};
+    auto big = Task([&calls, big_data]() { calls += 1 + big_data[0]; });
+
+    auto moved = std::move(small);
+    EXPECT_FALSE(small);
+    moved();
+    big();
+    EXPECT_EQ(calls, 2);
+
+    auto owned = std::make_shared<int>(0);
+    {
+        auto holder = Task([owned]() {});
+        EXPECT_EQ(owned.use_count(), 2);
+    }
+    EXPECT_EQ(owned.use_count(), 1);
+}
+
+TEST(ThreadPoolTest, GroupRunsAllTasks) {
+    ThreadPool pool;
+    pool.initialize(4);
+    std::atomic<int> count{0};
+    ThreadGroup tg(pool);
+    for (auto i = 0; i < 1000; i++) {
+        tg.add_task([&count, &pool]() {
+            EXPECT_GE(pool.get_worker_index(), 0);
+            count++;
+        });
+    }
+    tg.wait_all();
+    EXPECT_EQ(count, 1000);
+    EXPECT_EQ(pool.get_worker_index(), -1);
+}
+
+TEST(ThreadPoolTest, NestedTasksAndFutures) {
+    ThreadPool pool;
+    pool.initialize(2);
+    std::atomic<int> count{0};
+    std::mutex mutex;
+    std::vector<std::future<int>> results;
+    {
+        ThreadGroup outer(pool);
+        for (auto i = 0; i < 10; i++) {
+            outer.add_task([&]() {
+                // Queued on the deque of this worker, stolen by the
+                // other one or run once this task returns.
+                auto result = pool.add_task([&count](int n) {
+                    count += n;
+                    return n;
+                }, 2);
+                count++;
+                std::lock_guard<std::mutex> lock(mutex);
+                results.emplace_back(std::move(result));
+            });
+        }
+        outer.wait_all();
+    }
+    for (auto& result : results) {
+        EXPECT_EQ(result.get(), 2);
+    }
+    EXPECT_EQ(count, 30);
+}
+
+TEST(ThreadPoolTest, GroupRethrows) {
+    ThreadPool pool;
+    pool.initialize(2);
+    ThreadGroup tg(pool);
+    tg.add_task([]() { throw std::runtime_error("task failed"); });
+    tg.add_task([]() {});
+    EXPECT_THROW(tg.wait_all(), std::runtime_error);
+}
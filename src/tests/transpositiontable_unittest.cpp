@@ -0,0 +1,82 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include <gtest/gtest.h>
+#include <memory>
+
+#include "config.h"
+#include "NodeArena.h"
+#include "TranspositionTable.h"
+
+TEST(TranspositionTableTest, SameHashSameEntry) {
+    auto arena = std::make_unique<NodeArena>();
+    auto table = std::make_unique<TranspositionTable>();
+
+    auto a = table->find_or_insert(*arena, 0x1234);
+    auto b = table->find_or_insert(*arena, 0x5678);
+    // Same bucket, different hash.
+    auto c = table->find_or_insert(*arena, 0x1234 + (1ULL << 40));
+    EXPECT_NE(a, b);
+    EXPECT_NE(a, c);
+    EXPECT_EQ(table->find_or_insert(*arena, 0x1234), a);
+    EXPECT_EQ(table->find_or_insert(*arena, 0x1234 + (1ULL << 40)), c);
+    EXPECT_EQ(a->hash, 0x1234u);
+
+    table->clear();
+    EXPECT_NE(table->find_or_insert(*arena, 0x1234), a);
+}
+
+TEST(TranspositionTableTest, RelocateCopiesOnce) {
+    auto arena = std::make_unique<NodeArena>();
+    auto table = std::make_unique<TranspositionTable>();
+
+    auto entry = table->find_or_insert(*arena, 42);
+    entry->visits = 3;
+    entry->blackevals = 1.5;
+    auto eval = arena->create<SharedEval>();
+    eval->net_eval = 0.25f;
+    eval->nodelist.emplace_back(0.75f, 100);
+    entry->eval = eval;
+
+    arena->start_generation();
+    table->clear();
+    auto copy = table->relocate(*entry, *arena);
+    EXPECT_EQ(table->relocate(*entry, *arena), copy);
+    arena->release_previous_generations();
+
+    EXPECT_EQ(table->find_or_insert(*arena, 42), copy);
+    EXPECT_EQ(copy->visits, 3);
+    EXPECT_DOUBLE_EQ(copy->blackevals, 1.5);
+    ASSERT_NE(copy->eval.load(), nullptr);
+    EXPECT_FLOAT_EQ(copy->eval.load()->net_eval, 0.25f);
+    ASSERT_EQ(copy->eval.load()->nodelist.size(), 1u);
+    EXPECT_EQ(copy->eval.load()->nodelist[0].second, 100);
+}
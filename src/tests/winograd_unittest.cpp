@@ -0,0 +1,139 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+#include "config.h"
+#include "CPUPipe.h"
+#include "Network.h"
+#include "Random.h"
+
+// The SIMD transforms change the order of some operations (and use FMA),
+// so they are compared to the scalar ones with a tolerance.
+constexpr auto TOLERANCE = 1e-4f;
+
+static std::vector<float> random_vector(const size_t size) {
+    auto dist = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+    auto out = std::vector<float>(size);
+    for (auto& val : out) {
+        val = dist(Random::get_Rng());
+    }
+    return out;
+}
+
+static void expect_near(const std::vector<float>& a,
+                        const std::vector<float>& b) {
+    ASSERT_EQ(a.size(), b.size());
+    for (auto i = size_t{0}; i < a.size(); i++) {
+        EXPECT_NEAR(a[i], b[i], TOLERANCE * (1.0f + std::abs(a[i])))
+            << "at index " << i;
+    }
+}
+
+class WinogradTest : public ::testing::TestWithParam<size_t> {
+protected:
+    const int C = 12;
+    const int K = 10;
+};
+
+TEST_P(WinogradTest, TransformInMatchesScalar) {
+    const auto batch_size = GetParam();
+    const auto simd = CPUPipe::detect_simd();
+    const auto in = random_vector(batch_size * C * NUM_INTERSECTIONS);
+    const auto v_size = WINOGRAD_TILE * C * WINOGRAD_P * batch_size;
+
+    auto V_scalar = std::vector<float>(v_size);
+    auto V_simd = std::vector<float>(v_size);
+    CPUPipe::winograd_transform_in(CPUPipe::simd_t::SCALAR,
+                                   in, V_scalar, C, batch_size);
+    CPUPipe::winograd_transform_in(simd, in, V_simd, C, batch_size);
+    expect_near(V_scalar, V_simd);
+}
+
+TEST_P(WinogradTest, TransformOutMatchesScalar) {
+    const auto batch_size = GetParam();
+    const auto simd = CPUPipe::detect_simd();
+    const auto M = random_vector(WINOGRAD_TILE * K * WINOGRAD_P * batch_size);
+    const auto y_size = batch_size * K * NUM_INTERSECTIONS;
+
+    auto Y_scalar = std::vector<float>(y_size);
+    auto Y_simd = std::vector<float>(y_size);
+    CPUPipe::winograd_transform_out(CPUPipe::simd_t::SCALAR,
+                                    M, Y_scalar, K, batch_size);
+    CPUPipe::winograd_transform_out(simd, M, Y_simd, K, batch_size);
+    expect_near(Y_scalar, Y_simd);
+}
+
+TEST_P(WinogradTest, FusedTransformOutMatchesScalar) {
+    const auto batch_size = GetParam();
+    const auto simd = CPUPipe::detect_simd();
+    const auto M = random_vector(WINOGRAD_TILE * K * WINOGRAD_P * batch_size);
+    const auto means = random_vector(K);
+    auto stddevs = random_vector(K);
+    for (auto& val : stddevs) {
+        val = std::abs(val) + 0.5f;
+    }
+    const auto y_size = batch_size * K * NUM_INTERSECTIONS;
+    const auto res = random_vector(y_size);
+
+    for (const auto eltwise : {static_cast<const float*>(nullptr), res.data()}) {
+        auto Y_plain = std::vector<float>(y_size);
+        auto Y_scalar = std::vector<float>(y_size);
+        auto Y_simd = std::vector<float>(y_size);
+        CPUPipe::winograd_transform_out(CPUPipe::simd_t::SCALAR,
+                                        M, Y_plain, K, batch_size);
+        CPUPipe::winograd_transform_out(CPUPipe::simd_t::SCALAR,
+                                        M, Y_scalar, K, batch_size,
+                                        means.data(), stddevs.data(), eltwise);
+        CPUPipe::winograd_transform_out(simd,
+                                        M, Y_simd, K, batch_size,
+                                        means.data(), stddevs.data(), eltwise);
+        expect_near(Y_scalar, Y_simd);
+
+        // The fused version must match batchnorm + residual + ReLU
+        // applied after the plain transform.
+        for (auto i = size_t{0}; i < y_size; i++) {
+            const auto k = (i / NUM_INTERSECTIONS) % K;
+            auto val = stddevs[k] * (Y_plain[i] - means[k]);
+            if (eltwise != nullptr) {
+                val += eltwise[i];
+            }
+            val = val > 0.0f ? val : 0.0f;
+            EXPECT_NEAR(val, Y_scalar[i], TOLERANCE * (1.0f + std::abs(val)));
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(BatchSizes, WinogradTest,
+                        ::testing::Values(size_t{1}, size_t{3}));